@@ -0,0 +1,250 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "batch.h"
+#include "cache.h"
+
+struct fileList {
+    char **paths;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+/* shared by the workers of one batch, each file's latency goes to its own slot */
+struct batchJob {
+    const struct fileList *files;
+    /* every worker reads its strips through io_uring */
+    bool async;
+    /* files are decoded through the image cache, which has a budget */
+    bool cached;
+    atomic_uint next;
+    atomic_uint failed;
+    atomic_uint_fast64_t bytes;
+    double *latencies;
+    pthread_mutex_t lock;
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool addFile(struct fileList *list, const char *path) {
+    char *copy;
+
+    if (list->count == list->capacity) {
+        uint32_t capacity = list->capacity ? 2 * list->capacity : 64;
+        char **p = realloc(list->paths, sizeof(char *) * capacity);
+
+        if (p == NULL)
+            return true;
+
+        list->paths = p;
+        list->capacity = capacity;
+    }
+
+    copy = strdup(path);
+
+    if (copy == NULL)
+        return true;
+
+    list->paths[list->count++] = copy;
+    return false;
+}
+
+static bool addDirectory(struct fileList *list, const char *path) {
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    struct stat st;
+    bool error = false;
+
+    if (dir == NULL)
+        return true;
+
+    while (!error && (entry = readdir(dir)) != NULL) {
+        size_t size = strlen(path) + strlen(entry->d_name) + 2;
+        char *full;
+
+        if (entry->d_name[0] == '.')
+            continue;
+
+        full = malloc(size);
+
+        if (full == NULL) {
+            error = true;
+            break;
+        }
+
+        snprintf(full, size, "%s/%s", path, entry->d_name);
+
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode))
+            error = addFile(list, full);
+
+        free(full);
+    }
+
+    closedir(dir);
+    return error;
+}
+
+static bool addStdin(struct fileList *list) {
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t length;
+    bool error = false;
+
+    while (!error && (length = getline(&line, &size, stdin)) > 0) {
+        if (line[length - 1] == '\n')
+            line[--length] = '\0';
+
+        if (length != 0)
+            error = addFile(list, line);
+    }
+
+    free(line);
+    return error;
+}
+
+static void freeList(struct fileList *list) {
+    for (uint32_t i = 0; i < list->count; ++i)
+        free(list->paths[i]);
+
+    free(list->paths);
+}
+
+static void *batchWorker(void *arg) {
+    struct batchJob *job = arg;
+    struct tiffError error;
+    struct tiffStats stats;
+    struct tiffOptions opts = {.threads = 1, .stats = &stats, .async = job->async};
+    tiff_t tiff = NULL;
+    uint32_t i;
+
+    /* the image buffer of one file is decoded into again for the next, it only ever grows */
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->files->count) {
+        const char *path = job->files->paths[i];
+        double start = now();
+        int fd = open(path, O_RDONLY);
+        tiff_t decoded = NULL;
+
+        if (fd >= 0) {
+            decoded = job->cached ? cacheReadFD(fd, &opts, &error) : readFDReuse(fd, tiff, &opts, &error);
+            close(fd);
+        }
+
+        if (decoded != NULL)
+            atomic_fetch_add(&job->bytes, stats.bytesRead);
+
+        /* failed files are left out of the distribution, they sort before every real sample */
+        job->latencies[i] = decoded != NULL ? now() - start : -1;
+
+        if (decoded == NULL) {
+            atomic_fetch_add(&job->failed, 1);
+            pthread_mutex_lock(&job->lock);
+            if (fd < 0)
+                fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            else
+                fprintf(stderr, "%s: %s: %X\n", path, tiffErrorF(error), error.data);
+            pthread_mutex_unlock(&job->lock);
+            continue;
+        }
+
+        /* cached images are shared, only the worker's own one is decoded into again */
+        if (job->cached)
+            tiffFree(decoded);
+        else
+            tiff = decoded;
+    }
+
+    tiffFree(tiff);
+    return NULL;
+}
+
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+bool batchRun(char *const paths[], int count, unsigned threads, bool async, struct batchReport *report) {
+    struct fileList files = {0};
+    struct batchJob job = {.files = &files, .async = async, .lock = PTHREAD_MUTEX_INITIALIZER};
+    struct cacheStats cache;
+    pthread_t *workers;
+    unsigned started = 0;
+    double start;
+    double *samples;
+    uint32_t decoded;
+    struct stat st;
+    bool error = false;
+
+    for (int i = 0; i < count && !error; ++i) {
+        if (strcmp(paths[i], "-") == 0)
+            error = addStdin(&files);
+        else if (stat(paths[i], &st) == 0 && S_ISDIR(st.st_mode))
+            error = addDirectory(&files, paths[i]);
+        else
+            error = addFile(&files, paths[i]);
+
+        if (error)
+            perror(paths[i]);
+    }
+
+    cacheGetStats(&cache);
+    job.cached = cache.budget != 0;
+    job.latencies = calloc(files.count ? files.count : 1, sizeof(double));
+
+    if (error || job.latencies == NULL) {
+        freeList(&files);
+        free(job.latencies);
+        return true;
+    }
+
+    if (threads == 0)
+        threads = 1;
+
+    if (threads > files.count && files.count != 0)
+        threads = files.count;
+
+    /* the calling thread is one of the workers */
+    workers = threads > 1 ? malloc(sizeof(pthread_t) * (threads - 1)) : NULL;
+    start = now();
+
+    if (workers != NULL) {
+        for (; started < threads - 1; ++started) {
+            if (pthread_create(&workers[started], NULL, batchWorker, &job) != 0)
+                break;
+        }
+    }
+
+    batchWorker(&job);
+
+    for (unsigned i = 0; i < started; ++i)
+        pthread_join(workers[i], NULL);
+
+    report->seconds = now() - start;
+    report->files = files.count;
+    report->failed = job.failed;
+    report->bytes = job.bytes;
+
+    /* nearest rank percentiles of the decoded files, the rank of p is ceil(p * n / 100) */
+    qsort(job.latencies, files.count, sizeof(double), compareDoubles);
+    decoded = files.count - job.failed;
+    samples = job.latencies + job.failed;
+    report->p50 = decoded ? samples[(decoded * 50 + 99) / 100 - 1] : 0;
+    report->p99 = decoded ? samples[(decoded * 99 + 99) / 100 - 1] : 0;
+
+    free(workers);
+    free(job.latencies);
+    freeList(&files);
+    return false;
+}
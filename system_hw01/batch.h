@@ -0,0 +1,31 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include "tiff.h"
+
+#ifndef SYSTEM_HW01_BATCH_H
+#define SYSTEM_HW01_BATCH_H
+
+/* aggregate results of a batch, latencies are per decoded file from open to the image,
+ * failed files are not part of them */
+struct batchReport {
+    uint32_t files;
+    uint32_t failed;
+    /* read from the files that decoded */
+    uint64_t bytes;
+    double seconds;
+    double p50;
+    double p99;
+};
+
+/*
+ * decodes every file in paths with readFD semantics on a pool of threads workers, each reusing its
+ * image buffer from one file to the next. a directory stands for the regular files directly in it,
+ * "-" for the paths read from stdin one per line. failures are reported on stderr and counted.
+ * with async the strips of every file are read through io_uring, see tiffOptions. when the image
+ * cache has a budget every file goes through it, see cacheReadFD.
+ */
+bool batchRun(char *const paths[], int count, unsigned threads, bool async, struct batchReport *report);
+
+#endif //SYSTEM_HW01_BATCH_H
@@ -0,0 +1,2265 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include "tiff.h"
+#include "unpack.h"
+#include "stream.h"
+#include "compress.h"
+#include "fax.h"
+#include "render.h"
+#include "predict.h"
+#include "cache.h"
+#include "bilevel.h"
+#include "orient.h"
+
+#define BENCH_RUNS 5
+
+/* levels a pyramid of the largest side benchmarked can have */
+#define PYRAMID_BENCH_LEVELS 32
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct bitWriter {
+    uint8_t *out;
+    size_t size;
+    uint32_t bits;
+    uint32_t held;
+};
+
+static void putCode(struct bitWriter *w, uint32_t code, uint32_t width) {
+    w->bits = w->bits << width | code;
+    w->held += width;
+
+    while (w->held >= 8) {
+        w->held -= 8;
+        w->out[w->size++] = (uint8_t) (w->bits >> w->held);
+    }
+}
+
+/* a plain tiff lzw encoder for generating test data, output must hold 2 * srcSize + 16 bytes */
+static size_t lzwEncode(const uint8_t *src, size_t srcSize, uint8_t *out) {
+    static uint16_t child[4096][256];
+    struct bitWriter w = {.out = out};
+    uint32_t next = 258;
+    uint32_t width = 9;
+    uint32_t prefix;
+
+    /* the table is left empty between calls, and only the prefixes in use are cleared */
+    putCode(&w, 256, width);
+
+    if (srcSize == 0) {
+        putCode(&w, 257, width);
+        return w.size;
+    }
+
+    prefix = src[0];
+    for (size_t i = 1; i < srcSize; ++i) {
+        if (child[prefix][src[i]] != 0) {
+            prefix = child[prefix][src[i]];
+            continue;
+        }
+
+        putCode(&w, prefix, width);
+        child[prefix][src[i]] = next++;
+
+        if (next >= 1u << width && width < 12)
+            ++width;
+
+        if (next >= 4093) {
+            putCode(&w, 256, width);
+            memset(child, 0, next * sizeof(child[0]));
+            next = 258;
+            width = 9;
+        }
+
+        prefix = src[i];
+    }
+
+    putCode(&w, prefix, width);
+    if (++next >= 1u << width && width < 12)
+        ++width;
+    putCode(&w, 257, width);
+    memset(child, 0, next * sizeof(child[0]));
+
+    if (w.held != 0)
+        out[w.size++] = (uint8_t) (w.bits << (8 - w.held));
+
+    return w.size;
+}
+
+/* smooth data runs like a scan, noisy data is what photos look like to packbits */
+static void fillSamples(uint8_t *data, size_t size, bool smooth) {
+    uint8_t v = 0;
+
+    srand(11);
+    for (size_t i = 0; i < size; ++i) {
+        if (!smooth || rand() % 16 == 0)
+            v = (uint8_t) rand();
+        data[i] = v;
+    }
+}
+
+/* a file every benchmark reads, written by writeSynth */
+struct synth {
+    uint32_t width;
+    uint32_t height;
+    uint16_t bitsPerSample;
+    uint32_t rowsPerStrip;
+    enum byteOrder order;
+    uint16_t compression;
+    uint16_t predictor;
+    /* strips are stored last first, an order the kernel does not read ahead in */
+    bool reversed;
+    /* written as the ORIENTATION tag when not 0 */
+    uint16_t orientation;
+    /* the image is stored this many times, each ifd after the strips of its page, 0 for once */
+    uint32_t pages;
+};
+
+static void synthPut16(const struct synth *s, uint8_t *p, uint16_t v) {
+    v = s->order == MM ? htobe16(v) : htole16(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static void synthPut32(const struct synth *s, uint8_t *p, uint32_t v) {
+    v = s->order == MM ? htobe32(v) : htole32(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static void synthTag(const struct synth *s, uint8_t *p, uint16_t id, uint16_t type, uint32_t count, uint32_t value) {
+    synthPut16(s, p, id);
+    synthPut16(s, p + 2, type);
+    synthPut32(s, p + 4, count);
+    if (type == WORD && count == 1)
+        synthPut16(s, p + 8, value), synthPut16(s, p + 10, 0);
+    else
+        synthPut32(s, p + 8, value);
+}
+
+/*
+ * compresses the stored rows strip by strip, packbits a row at a time, returns the file size or 0 on error.
+ * with predictor 2 the rows are taken as already differenced. g4 codes 1 bit rows, set bits black.
+ */
+static size_t writeSynth(int fd, const struct synth *s, const uint8_t *rows) {
+    size_t rowBytes = ((size_t) s->width * s->bitsPerSample + 7) / 8;
+    uint32_t strips = (s->height + s->rowsPerStrip - 1) / s->rowsPerStrip;
+    uint32_t pages = s->pages != 0 ? s->pages : 1;
+    uint16_t tags = 9 + (s->predictor == HORIZONTAL_DIFFERENCING) + (s->orientation != 0);
+    size_t bound = (s->compression == CCITT_T6 ? 4 : 2) * rowBytes * s->height + 16 * (size_t) strips + 1;
+    size_t capacity = 8 + (bound + 8 * strips + 2 + tags * 12 + 4) * pages;
+    uint8_t *file = calloc(capacity, 1);
+    uint32_t *offsets = malloc(2 * sizeof(uint32_t) * strips);
+    size_t size = 8;
+    size_t next = 4;
+    size_t start, tables, ifd;
+    uint8_t *tag;
+    bool error;
+
+    if (file == NULL || offsets == NULL) {
+        free(file), free(offsets);
+        return 0;
+    }
+
+    synthPut16(s, file, s->order);
+    synthPut16(s, file + 2, 42);
+
+    for (uint32_t page = 0; page < pages; ++page) {
+        start = size;
+
+        for (uint32_t k = 0; k < strips; ++k) {
+            uint32_t j = s->reversed ? strips - 1 - k : k;
+            uint32_t first = j * s->rowsPerStrip;
+            uint32_t count = s->height - first < s->rowsPerStrip ? s->height - first : s->rowsPerStrip;
+            const uint8_t *src = rows + first * rowBytes;
+
+            offsets[j] = size;
+            if (s->compression == LZW) {
+                size += lzwEncode(src, count * rowBytes, file + size);
+            } else if (s->compression == PACKBITS) {
+                for (uint32_t y = 0; y < count; ++y)
+                    size += packBitsEncode(src + y * rowBytes, rowBytes, file + size);
+            } else if (s->compression == CCITT_T6) {
+                size_t n = ccittT6Encode(src, s->width, count, file + size, start + bound - size);
+
+                if (n == 0) {
+                    free(file), free(offsets);
+                    return 0;
+                }
+                size += n;
+            } else {
+                memcpy(file + size, src, count * rowBytes);
+                size += count * rowBytes;
+            }
+            offsets[strips + j] = size - offsets[j];
+        }
+
+        size += size % 2;
+        tables = size;
+        for (uint32_t j = 0; j < 2 * strips; ++j)
+            synthPut32(s, file + tables + 4 * j, offsets[j]);
+        ifd = tables + 8 * strips;
+
+        /* the header points at the first ifd, every ifd at the one after it */
+        synthPut32(s, file + next, ifd);
+
+        /* a single strip keeps its offset and count in the tags themselves */
+        synthPut16(s, file + ifd, tags);
+        tag = file + ifd + 2;
+        synthTag(s, tag, IMAGE_WIDTH, DWORD, 1, s->width), tag += 12;
+        synthTag(s, tag, IMAGE_LENGTH, DWORD, 1, s->height), tag += 12;
+        synthTag(s, tag, BITS_PER_SAMPLE, WORD, 1, s->bitsPerSample), tag += 12;
+        synthTag(s, tag, COMPRESSION, WORD, 1, s->compression), tag += 12;
+        synthTag(s, tag, PHOTOMETRIC_INTERPRETATION, WORD, 1, s->bitsPerSample == 1 ? WHITE_IS_ZERO : BLACK_IS_ZERO);
+        tag += 12;
+        synthTag(s, tag, STRIP_OFFSETS, DWORD, strips, strips == 1 ? offsets[0] : tables), tag += 12;
+        if (s->orientation != 0)
+            synthTag(s, tag, ORIENTATION, WORD, 1, s->orientation), tag += 12;
+        synthTag(s, tag, SAMPLES_PER_PIXEL, WORD, 1, 1), tag += 12;
+        synthTag(s, tag, ROWS_PER_STRIP, DWORD, 1, s->rowsPerStrip), tag += 12;
+        synthTag(s, tag, STRIP_BYTE_COUNTS, DWORD, strips, strips == 1 ? offsets[1] : tables + 4 * strips);
+        tag += 12;
+        if (s->predictor == HORIZONTAL_DIFFERENCING)
+            synthTag(s, tag, PREDICTOR, WORD, 1, HORIZONTAL_DIFFERENCING), tag += 12;
+        synthPut32(s, tag, 0);
+        next = tag - file;
+        size = ifd + 2 + tags * 12 + 4;
+    }
+
+    error = ftruncate(fd, 0) != 0 || pwrite(fd, file, size, 0) != (ssize_t) size;
+    free(file), free(offsets);
+    return error ? 0 : size;
+}
+
+/* writes s with noisy rows, the way photos look to the codecs, returns true on error */
+static bool writeSynthNoise(int fd, const struct synth *s) {
+    size_t size = ((size_t) s->width * s->bitsPerSample + 7) / 8 * s->height;
+    uint8_t *rows = malloc(size);
+    bool error = rows == NULL;
+
+    if (!error) {
+        fillSamples(rows, size, false);
+        error = writeSynth(fd, s, rows) == 0;
+    }
+
+    free(rows);
+    return error;
+}
+
+/* best of BENCH_RUNS decodes with the given thread count, in seconds */
+static double timeThreads(int fd, unsigned threads) {
+    struct tiffOptions opts = {.threads = threads};
+    struct tiffError error;
+    double best = -1;
+
+    for (int i = 0; i < BENCH_RUNS; ++i) {
+        double start = now();
+        tiff_t tiff = readFDOptions(fd, &opts, &error);
+        double elapsed = now() - start;
+
+        if (tiff == NULL) {
+            fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+            return -1;
+        }
+
+        tiffFree(tiff);
+
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+/* the per pixel loop readFD used before the unpack kernels, kept as the baseline */
+static void unpackRowReference(const uint8_t *packed, uint32_t width, uint8_t *row, uint8_t flip) {
+    for (uint32_t j = 0; j < width; ++j) {
+        uint8_t shift = j % 8;
+        uint32_t bi = j / 8;
+        uint8_t v = (packed[bi] & ((uint8_t) 0x01 << (7 - shift))) == 0 ? (uint8_t) 0 : (uint8_t) 255;
+
+        row[j] = v ^ flip;
+    }
+}
+
+static int benchThreads(uint32_t width, uint32_t height, uint32_t rowsPerStrip) {
+    char path[] = "/tmp/tiffbenchXXXXXX";
+    struct synth s = {.width = width, .height = height, .bitsPerSample = 1, .rowsPerStrip = rowsPerStrip,
+                      .order = II, .compression = NO_COMPRESSION};
+    unsigned threads[] = {1, 2, 4, 8};
+    double base;
+    int fd;
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        perror("BENCH FILE ERROR");
+        return 1;
+    }
+    unlink(path);
+
+    if (writeSynthNoise(fd, &s)) {
+        perror("BENCH WRITE ERROR");
+        close(fd);
+        return 1;
+    }
+
+    printf("bilevel %ux%u, %u rows per strip\n", width, height, rowsPerStrip);
+    printf("%8s %12s %12s %8s\n", "threads", "ms", "Mpixel/s", "speedup");
+
+    base = timeThreads(fd, 1);
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]) && base > 0; ++i) {
+        double t = timeThreads(fd, threads[i]);
+
+        if (t < 0)
+            break;
+
+        printf("%8u %12.2f %12.1f %8.2f\n", threads[i], t * 1e3, (double) width * height / t / 1e6, base / t);
+    }
+
+    close(fd);
+    return 0;
+}
+
+static int benchUnpack(uint32_t width, uint32_t rows) {
+    struct {
+        const char *name;
+        unpackFn fn;
+    } kernels[] = {
+            {"reference", unpackRowReference},
+            {"scalar",    unpackRowScalar},
+#if defined(__x86_64__) || defined(__i386__)
+            {"sse2",      unpackRowSSE2},
+            {"avx2",      __builtin_cpu_supports("avx2") ? unpackRowAVX2 : NULL},
+#endif
+    };
+    size_t rowBytes = (width + 7) / 8;
+    uint8_t *packed = malloc(rowBytes * rows);
+    uint8_t *out = malloc((size_t) width * rows);
+    uint8_t *expect = malloc((size_t) width * rows);
+    double base = -1;
+
+    if (packed == NULL || out == NULL || expect == NULL) {
+        free(packed), free(out), free(expect);
+        return 1;
+    }
+
+    srand(7);
+    for (size_t i = 0; i < rowBytes * rows; ++i)
+        packed[i] = (uint8_t) rand();
+
+    for (uint32_t r = 0; r < rows; ++r)
+        unpackRowReference(packed + r * rowBytes, width, expect + (size_t) r * width, 0xFF);
+
+    printf("unpack %u pixel rows x %u, runtime pick: %s\n", width, rows, unpackKernelName());
+    printf("%10s %12s %12s %8s\n", "kernel", "ms", "Mpixel/s", "speedup");
+
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+        double best = -1;
+
+        if (kernels[k].fn == NULL)
+            continue;
+
+        for (int i = 0; i < BENCH_RUNS; ++i) {
+            double start = now();
+            for (uint32_t r = 0; r < rows; ++r)
+                kernels[k].fn(packed + r * rowBytes, width, out + (size_t) r * width, 0xFF);
+            double elapsed = now() - start;
+
+            if (best < 0 || elapsed < best)
+                best = elapsed;
+        }
+
+        if (base < 0)
+            base = best;
+
+        printf("%10s %12.2f %12.1f %8.2f%s\n", kernels[k].name, best * 1e3, (double) width * rows / best / 1e6,
+               base / best, memcmp(out, expect, (size_t) width * rows) == 0 ? "" : "  MISMATCH");
+    }
+
+    free(packed), free(out), free(expect);
+    return 0;
+}
+
+/* one be16toh per sample, what a reader without the swap kernels would do for big endian files */
+static void swapBytes16Reference(const uint8_t *src, uint8_t *dst, size_t count) {
+    const uint16_t *in = (const uint16_t *) src;
+    uint16_t *out = (uint16_t *) dst;
+
+    for (size_t i = 0; i < count; ++i)
+        out[i] = be16toh(in[i]);
+}
+
+static int benchSwap(size_t count) {
+    struct {
+        const char *name;
+        swapFn fn;
+    } kernels[] = {
+            {"be16toh", swapBytes16Reference},
+            {"scalar",  swapBytes16Scalar},
+#if defined(__x86_64__) || defined(__i386__)
+            {"sse2",    swapBytes16SSE2},
+            {"avx2",    __builtin_cpu_supports("avx2") ? swapBytes16AVX2 : NULL},
+#endif
+    };
+    uint8_t *src = malloc(2 * count);
+    uint8_t *out = malloc(2 * count);
+    uint8_t *expect = malloc(2 * count);
+    double base = -1;
+
+    if (src == NULL || out == NULL || expect == NULL) {
+        free(src), free(out), free(expect);
+        return 1;
+    }
+
+    srand(5);
+    for (size_t i = 0; i < 2 * count; ++i)
+        src[i] = (uint8_t) rand();
+
+    for (size_t i = 0; i < count; ++i)
+        expect[2 * i] = src[2 * i + 1], expect[2 * i + 1] = src[2 * i];
+
+    printf("swap %zu 16 bit samples, runtime pick: %s\n", count, unpackKernelName());
+    printf("%10s %12s %12s %8s\n", "kernel", "ms", "MB/s", "speedup");
+
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+        double best = -1;
+
+        if (kernels[k].fn == NULL)
+            continue;
+
+        for (int i = 0; i < BENCH_RUNS; ++i) {
+            double start = now();
+            kernels[k].fn(src, out, count);
+            double elapsed = now() - start;
+
+            if (best < 0 || elapsed < best)
+                best = elapsed;
+        }
+
+        if (base < 0)
+            base = best;
+
+        printf("%10s %12.2f %12.0f %8.2f%s\n", kernels[k].name, best * 1e3, 2 * count / best / 1e6, base / best,
+               (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__ && k == 0) || memcmp(out, expect, 2 * count) == 0
+               ? "" : "  MISMATCH");
+    }
+
+    free(src), free(out), free(expect);
+    return 0;
+}
+
+/* peak rss is reset through clear_refs where the kernel allows it, so file generation does not count */
+static void resetPeak(void) {
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+
+    if (fd >= 0) {
+        if (write(fd, "5", 1) != 1)
+            perror("clear_refs");
+        close(fd);
+    }
+}
+
+static long peakKB(void) {
+    struct rusage usage;
+    char line[128];
+    long kb = -1;
+    FILE *status = fopen("/proc/self/status", "r");
+
+    while (status != NULL && fgets(line, sizeof(line), status) != NULL) {
+        if (sscanf(line, "VmHWM: %ld kB", &kb) == 1)
+            break;
+    }
+
+    if (status != NULL)
+        fclose(status);
+
+    if (kb >= 0)
+        return kb;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/* streams first, since peak rss only grows, then decodes the whole image for comparison */
+static int benchStream(uint32_t width, uint32_t height, uint32_t rowsPerStrip) {
+    char path[] = "/tmp/tiffbenchXXXXXX";
+    struct synth s = {.width = width, .height = height, .bitsPerSample = 1, .rowsPerStrip = rowsPerStrip,
+                      .order = II, .compression = NO_COMPRESSION};
+    struct tiffError error;
+    const uint8_t *rows;
+    uint32_t first, count;
+    uint64_t pixels = 0;
+    long base, streamed, full;
+    double start, streamTime, fullTime;
+    tiffStream_t stream;
+    tiff_t tiff;
+    int fd;
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        perror("BENCH FILE ERROR");
+        return 1;
+    }
+    unlink(path);
+
+    if (writeSynthNoise(fd, &s)) {
+        perror("BENCH WRITE ERROR");
+        close(fd);
+        return 1;
+    }
+
+    resetPeak();
+    base = peakKB();
+    start = now();
+    stream = streamOpen(fd, 0, &error);
+
+    while (stream != NULL && !streamNextRows(stream, &rows, &first, &count, &error) && count != 0)
+        pixels += (uint64_t) count * stream->width;
+
+    streamTime = now() - start;
+    streamClose(stream);
+    streamed = peakKB() - base;
+
+    resetPeak();
+    base = peakKB();
+    start = now();
+    tiff = readFD(fd, &error);
+    fullTime = now() - start;
+    full = peakKB() - base;
+    tiffFree(tiff);
+    close(fd);
+
+    if (stream == NULL || tiff == NULL || pixels != (uint64_t) width * height) {
+        fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+        return 1;
+    }
+
+    printf("bilevel %ux%u, %u rows per strip\n", width, height, rowsPerStrip);
+    printf("%8s %12s %14s\n", "reader", "ms", "peak rss +KB");
+    printf("%8s %12.2f %14ld\n", "stream", streamTime * 1e3, streamed);
+    printf("%8s %12.2f %14ld\n", "readFD", fullTime * 1e3, full);
+    return 0;
+}
+
+static int benchCodecs(size_t size, int files, char *paths[]) {
+    uint8_t *raw = malloc(size);
+    uint8_t *encoded = malloc(2 * size + 16);
+    uint8_t *decoded = malloc(size);
+    const char *kinds[] = {"noisy", "smooth"};
+
+    if (raw == NULL || encoded == NULL || decoded == NULL) {
+        free(raw), free(encoded), free(decoded);
+        return 1;
+    }
+
+    printf("codec throughput over %zu bytes, MB/s of decoded output\n", size);
+    printf("%10s %8s %10s %10s\n", "codec", "data", "ratio", "MB/s");
+
+    for (int smooth = 0; smooth < 2; ++smooth) {
+        fillSamples(raw, size, smooth);
+
+        for (uint16_t c = 0; c < 2; ++c) {
+            const struct codec *codec = findCodec(c == 0 ? PACKBITS : LZW);
+            struct codecParams params = {0};
+            size_t n = c == 0 ? packBitsEncode(raw, size, encoded) : lzwEncode(raw, size, encoded);
+            double best = -1;
+            bool ok = true;
+
+            for (int i = 0; i < BENCH_RUNS; ++i) {
+                double start = now();
+                ok &= !codec->decode(encoded, n, decoded, size, &params);
+                double elapsed = now() - start;
+
+                if (best < 0 || elapsed < best)
+                    best = elapsed;
+            }
+
+            printf("%10s %8s %10.2f %10.1f%s\n", codec->name, kinds[smooth], (double) size / n, size / best / 1e6,
+                   ok && memcmp(raw, decoded, size) == 0 ? "" : "  MISMATCH");
+        }
+    }
+
+    free(raw), free(encoded), free(decoded);
+
+    /* real samples go through the whole reader */
+    for (int f = 0; f < files; ++f) {
+        struct tiffError error;
+        double best = -1;
+        uint64_t pixels = 0;
+        int fd = open(paths[f], O_RDONLY);
+
+        if (fd < 0) {
+            perror(paths[f]);
+            return 1;
+        }
+
+        for (int i = 0; i < BENCH_RUNS; ++i) {
+            double start = now();
+            tiff_t tiff = readFD(fd, &error);
+            double elapsed = now() - start;
+
+            if (tiff == NULL) {
+                fprintf(stderr, "%s: %s: %X\n", paths[f], tiffErrorF(error), error.data);
+                close(fd);
+                return 1;
+            }
+
+            pixels = (uint64_t) tiff->width * tiff->height;
+            tiffFree(tiff);
+
+            if (best < 0 || elapsed < best)
+                best = elapsed;
+        }
+
+        printf("%s: %.1f MB/s decoded\n", paths[f], pixels / best / 1e6);
+        close(fd);
+    }
+
+    return 0;
+}
+
+/* a 200 dpi page of text: lines of glyph strokes that change a little from one row to the next */
+static void fillPage(uint8_t *packed, uint32_t width, uint32_t height) {
+    size_t rowBytes = (width + 7) / 8;
+    uint8_t *line = malloc(rowBytes);
+
+    memset(packed, 0, rowBytes * height);
+    srand(7);
+
+    for (uint32_t y = 100; line != NULL && y + 40 < height - 100; y += 40) {
+        for (uint32_t row = 0; row < 24; ++row) {
+            if (row % 6 == 0) {
+                uint32_t x = 80 + rand() % 20;
+
+                memset(line, 0, rowBytes);
+                while (x + 10 < width - 80) {
+                    uint32_t stroke = 1 + rand() % 5;
+                    uint32_t gap = rand() % 8 == 0 ? 30 : 8;
+
+                    for (uint32_t i = x; i < x + stroke; ++i)
+                        line[i / 8] |= 0x80 >> i % 8;
+                    x += stroke + 1 + rand() % gap;
+                }
+            }
+
+            memcpy(packed + (y + row) * rowBytes, line, rowBytes);
+        }
+    }
+
+    free(line);
+}
+
+/* pages per second for the g4 codec alone and through readFD, on a synthetic page and on given files */
+static int benchFax(uint32_t width, uint32_t height, int files, char *paths[]) {
+    char path[] = "/tmp/tiffbenchXXXXXX";
+    struct synth s = {.width = width, .height = height, .bitsPerSample = 1, .rowsPerStrip = height, .order = II,
+                      .compression = CCITT_T6};
+    size_t size = (width + 7) / 8 * height;
+    uint8_t *page = malloc(size);
+    uint8_t *encoded = malloc(4 * size);
+    uint8_t *decoded = malloc(size);
+    struct codecParams params = {width, 1, 0};
+    const struct codec *codec = findCodec(CCITT_T6);
+    size_t n = 0;
+    int pages = 0;
+    double start, elapsed;
+    bool ok = true;
+    int fd;
+
+    if (page != NULL && encoded != NULL && decoded != NULL) {
+        fillPage(page, width, height);
+        n = ccittT6Encode(page, width, height, encoded, 4 * size);
+    }
+
+    if (n == 0) {
+        free(page), free(encoded), free(decoded);
+        return 1;
+    }
+
+    printf("g4 page %ux%u, %zu bytes, ratio %.1f\n", width, height, n, (double) size / n);
+
+    start = now();
+    do {
+        ok &= !codec->decode(encoded, n, decoded, size, &params);
+        ++pages;
+    } while ((elapsed = now() - start) < 1);
+
+    printf("%-24s %10.0f pages/s%s\n", "g4 decode", pages / elapsed,
+           ok && memcmp(page, decoded, size) == 0 ? "" : "  MISMATCH");
+    free(encoded), free(decoded);
+
+    fd = mkstemp(path);
+    if (fd < 0 || (unlink(path), writeSynth(fd, &s, page) == 0)) {
+        perror("BENCH WRITE ERROR");
+        free(page);
+        return 1;
+    }
+    free(page);
+
+    for (int f = -1; f < files; ++f) {
+        struct tiffError error;
+
+        if (f >= 0) {
+            close(fd);
+            fd = open(paths[f], O_RDONLY);
+
+            if (fd < 0) {
+                perror(paths[f]);
+                return 1;
+            }
+        }
+
+        pages = 0;
+        start = now();
+        do {
+            tiff_t tiff = readFD(fd, &error);
+
+            if (tiff == NULL) {
+                fprintf(stderr, "%s: %s: %X\n", f < 0 ? "g4 page" : paths[f], tiffErrorF(error), error.data);
+                close(fd);
+                return 1;
+            }
+
+            tiffFree(tiff);
+            ++pages;
+        } while ((elapsed = now() - start) < 1);
+
+        printf("%-24s %10.0f pages/s\n", f < 0 ? "g4 readFD" : paths[f], pages / elapsed);
+    }
+
+    close(fd);
+    return 0;
+}
+
+/* walking the ifd chain against loading a saved index, and reading pages from either */
+static int benchPages(uint32_t count) {
+    char path[] = "/tmp/tiffbenchXXXXXX";
+    char indexPath[] = "/tmp/tiffbenchXXXXXX";
+    struct synth s = {.width = 64, .height = 64, .bitsPerSample = 1, .rowsPerStrip = 64, .order = II,
+                      .compression = NO_COMPRESSION, .pages = count};
+    struct tiffError error;
+    tiffPages_t pages;
+    double start, walk, save, load, last;
+    int fd = mkstemp(path);
+    int indexFd = mkstemp(indexPath);
+
+    if (fd < 0 || indexFd < 0 || writeSynthNoise(fd, &s)) {
+        perror("BENCH WRITE ERROR");
+        return 1;
+    }
+    unlink(path);
+    unlink(indexPath);
+
+    start = now();
+    pages = pagesOpen(fd, &error);
+    walk = now() - start;
+
+    if (pages == NULL || pagesCount(pages) != count) {
+        fprintf(stderr, "%s: %X\n", pages == NULL ? tiffErrorF(error) : "PAGE COUNT", error.data);
+        return 1;
+    }
+
+    start = now();
+    if (pagesSave(fd, pages, indexFd, &error)) {
+        fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+        return 1;
+    }
+    save = now() - start;
+    pagesClose(pages);
+
+    start = now();
+    pages = pagesLoad(fd, indexFd, &error);
+    load = now() - start;
+
+    if (pages == NULL) {
+        fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+        return 1;
+    }
+
+    start = now();
+    for (int i = 0; i < 1000; ++i) {
+        tiff_t tiff = readPage(fd, pages, count - 1 - i % 10, &error);
+
+        if (tiff == NULL) {
+            fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+            return 1;
+        }
+
+        tiffFree(tiff);
+    }
+    last = (now() - start) / 1000;
+
+    printf("%u pages, index of %ld bytes\n", count, (long) lseek(indexFd, 0, SEEK_END));
+    printf("%-24s %10.2f ms\n", "walk ifd chain", walk * 1e3);
+    printf("%-24s %10.2f ms\n", "save index", save * 1e3);
+    printf("%-24s %10.2f ms\n", "load index", load * 1e3);
+    printf("%-24s %10.2f us\n", "readPage near the end", last * 1e6);
+
+    pagesClose(pages);
+    close(fd);
+    close(indexFd);
+    return 0;
+}
+
+/* best of BENCH_RUNS reads of fd, with the last image left in *kept */
+static double timeRead(int fd, const struct tiffOptions *opts, tiff_t *kept) {
+    struct tiffError error;
+    double best = -1;
+
+    *kept = NULL;
+
+    for (int i = 0; i < BENCH_RUNS; ++i) {
+        double start = now();
+        tiff_t tiff = readFDOptions(fd, opts, &error);
+        double elapsed = now() - start;
+
+        if (tiff == NULL) {
+            fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+            return -1;
+        }
+
+        tiffFree(*kept);
+        *kept = tiff;
+
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+/* best of BENCH_RUNS passes of invert, count and compare over every row, in seconds each */
+static void timeOps(tiff_t tiff, double times[3], uint64_t *black) {
+    uint64_t equal = 0;
+
+    times[0] = times[1] = times[2] = -1;
+
+    for (int i = 0; i < BENCH_RUNS; ++i) {
+        double t[3];
+        double start = now();
+
+        tiffInvert(tiff);
+        t[0] = now() - start;
+        start = now();
+        *black = tiffCountBlack(tiff);
+        t[1] = now() - start;
+        start = now();
+        for (uint32_t y = 0; y + 1 < tiff->height; ++y)
+            equal += tiffRowCompare(tiff, y, y + 1) == tiff->width;
+        t[2] = now() - start;
+
+        for (int k = 0; k < 3; ++k) {
+            if (times[k] < 0 || t[k] < times[k])
+                times[k] = t[k];
+        }
+    }
+
+    if (equal != 0)
+        printf("%lu equal rows\n", equal);
+}
+
+static int benchPacked(uint32_t width, uint32_t height, uint32_t rowsPerStrip) {
+    char path[] = "/tmp/tiffbenchXXXXXX";
+    struct synth s = {.width = width, .height = height, .bitsPerSample = 1, .rowsPerStrip = rowsPerStrip,
+                      .order = II, .compression = NO_COMPRESSION};
+    struct tiffOptions opts[2] = {{.threads = 1}, {.threads = 1, .packed = true}};
+    const char *names[2] = {"gray8", "packed1"};
+    tiff_t tiffs[2];
+    double read[2], ops[2][3];
+    uint64_t black[2];
+    int fd;
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        perror("BENCH FILE ERROR");
+        return 1;
+    }
+    unlink(path);
+
+    if (writeSynthNoise(fd, &s)) {
+        perror("BENCH WRITE ERROR");
+        close(fd);
+        return 1;
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        read[i] = timeRead(fd, &opts[i], &tiffs[i]);
+
+        if (read[i] < 0) {
+            tiffFree(tiffs[0]);
+            close(fd);
+            return 1;
+        }
+
+        timeOps(tiffs[i], ops[i], &black[i]);
+    }
+
+    close(fd);
+
+    printf("bilevel %ux%u, %u rows per strip\n", width, height, rowsPerStrip);
+    printf("%8s %10s %10s %10s %10s %10s\n", "format", "MB", "read ms", "invert ms", "count ms", "compare ms");
+
+    for (int i = 0; i < 2; ++i) {
+        printf("%8s %10.2f %10.2f %10.2f %10.2f %10.2f\n", names[i], tiffs[i]->stride * tiffs[i]->height / 1e6,
+               read[i] * 1e3, ops[i][0] * 1e3, ops[i][1] * 1e3, ops[i][2] * 1e3);
+        tiffFree(tiffs[i]);
+    }
+
+    if (black[0] != black[1]) {
+        fprintf(stderr, "black pixels differ: %lu and %lu\n", black[0], black[1]);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* writes a document page in both formats, uncompressed and packbits, timing the best of BENCH_RUNS */
+static int benchWrite(uint32_t width, uint32_t height, uint32_t rowsPerStrip) {
+    char path[] = "/tmp/tiffbenchXXXXXX";
+    struct tiff images[2] = {{.width = width, .height = height, .format = PACKED1, .stride = (width + 7) / 8},
+                             {.width = width, .height = height, .format = GRAY8, .stride = width}};
+    uint16_t compressions[2] = {NO_COMPRESSION, PACKBITS};
+    const char *names[2] = {"none", "packbits"};
+    struct tiffError error;
+    struct stat st;
+    int fd;
+
+    images[0].data = malloc(images[0].stride * height);
+    images[1].data = malloc(images[1].stride * height);
+    fd = mkstemp(path);
+
+    if (images[0].data == NULL || images[1].data == NULL || fd < 0) {
+        perror("BENCH FILE ERROR");
+        free(images[0].data);
+        free(images[1].data);
+        return 1;
+    }
+    unlink(path);
+
+    fillPage(images[0].data, width, height);
+    for (uint32_t y = 0; y < height; ++y)
+        unpackRow(images[0].data + y * images[0].stride, width, images[1].data + (size_t) y * width, 0xFF);
+
+    printf("page %ux%u, %u rows per strip, 0 for strips of about 8 KB\n", width, height, rowsPerStrip);
+    printf("%8s %10s %10s %10s %10s\n", "format", "codec", "ms", "MB/s", "file KB");
+
+    for (int i = 0; i < 2; ++i) {
+        for (int c = 0; c < 2; ++c) {
+            struct tiffWriteOptions opts = {rowsPerStrip, compressions[c]};
+            double best = -1;
+
+            for (int r = 0; r < BENCH_RUNS; ++r) {
+                double start;
+
+                if (ftruncate(fd, 0) != 0)
+                    perror("BENCH TRUNCATE");
+
+                start = now();
+                if (writeFD(fd, &images[i], &opts, &error)) {
+                    fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+                    close(fd);
+                    free(images[0].data);
+                    free(images[1].data);
+                    return 1;
+                }
+                if (best < 0 || now() - start < best)
+                    best = now() - start;
+            }
+
+            fstat(fd, &st);
+            printf("%8s %10s %10.2f %10.0f %10ld\n", i == 0 ? "packed1" : "gray8", names[c], best * 1e3,
+                   images[i].stride * height / best / 1e6, (long) st.st_size / 1024);
+        }
+    }
+
+    close(fd);
+    free(images[0].data);
+    free(images[1].data);
+    return 0;
+}
+
+/* decodes a bilevel and an 8 bit image at every scale, with the peak rss each decode added */
+static int benchThumb(uint32_t width, uint32_t height, uint32_t rowsPerStrip) {
+    char paths[2][21] = {"/tmp/tiffbenchXXXXXX", "/tmp/tiffbenchXXXXXX"};
+    struct synth s[2] = {{.width = width, .height = height, .bitsPerSample = 1, .rowsPerStrip = rowsPerStrip,
+                          .order = II, .compression = NO_COMPRESSION},
+                         {.width = width, .height = height, .bitsPerSample = 8, .rowsPerStrip = rowsPerStrip,
+                          .order = II, .compression = NO_COMPRESSION}};
+    struct tiffError error;
+    int fds[2];
+
+    fds[0] = mkstemp(paths[0]);
+    fds[1] = mkstemp(paths[1]);
+
+    if (fds[0] < 0 || fds[1] < 0) {
+        perror("BENCH FILE ERROR");
+        return 1;
+    }
+    unlink(paths[0]);
+    unlink(paths[1]);
+
+    if (writeSynthNoise(fds[0], &s[0]) || writeSynthNoise(fds[1], &s[1])) {
+        perror("BENCH WRITE ERROR");
+        close(fds[0]);
+        close(fds[1]);
+        return 1;
+    }
+
+    printf("%ux%u, %u rows per strip\n", width, height, rowsPerStrip);
+    printf("%8s %6s %10s %14s\n", "image", "scale", "ms", "peak rss +KB");
+
+    for (int f = 0; f < 2; ++f) {
+        for (unsigned scale = 1; scale <= 8; scale *= 2) {
+            struct tiffOptions opts = {.threads = 1, .scale = scale};
+            double start;
+            long base;
+            tiff_t tiff;
+
+            resetPeak();
+            base = peakKB();
+            start = now();
+            tiff = readFDOptions(fds[f], &opts, &error);
+
+            if (tiff == NULL) {
+                fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+                close(fds[0]);
+                close(fds[1]);
+                return 1;
+            }
+
+            printf("%8s %6u %10.2f %14ld\n", f == 0 ? "bilevel" : "gray8", scale, (now() - start) * 1e3,
+                   peakKB() - base);
+            tiffFree(tiff);
+        }
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+}
+
+/* the one fprintf per pixel text output main used before the renderer */
+static void renderReference(FILE *out, tiff_t tiff) {
+    for (uint32_t y = 0; y < tiff->height; ++y) {
+        for (uint32_t x = 0; x < tiff->width; ++x) {
+            uint8_t v = tiff->data[(size_t) y * tiff->width + x];
+
+            fprintf(out, "%s", v == 0 ? "0" : v == 255 ? "1" : "X");
+        }
+        fprintf(out, "\n");
+    }
+}
+
+/* renders a bilevel image to /dev/null in every format, text from both pixel formats */
+static int benchRender(uint32_t width, uint32_t height) {
+    char path[] = "/tmp/tiffbenchXXXXXX";
+    struct synth s = {.width = width, .height = height, .bitsPerSample = 1, .rowsPerStrip = 64, .order = II,
+                      .compression = NO_COMPRESSION};
+    struct tiffOptions opts[2] = {{.threads = 1}, {.threads = 1, .packed = true}};
+    struct {
+        const char *name;
+        int image;
+        enum renderFormat format;
+    } cases[] = {{"text", 0, RENDER_TEXT}, {"text", 1, RENDER_TEXT}, {"pbm", 1, RENDER_PBM},
+                 {"pgm", 1, RENDER_PGM}, {"pgm", 0, RENDER_PGM}};
+    struct tiffError error;
+    tiff_t tiffs[2] = {NULL, NULL};
+    FILE *null = fopen("/dev/null", "w");
+    double start;
+    int fd = mkstemp(path);
+
+    if (fd < 0 || null == NULL) {
+        perror("BENCH FILE ERROR");
+        return 1;
+    }
+    unlink(path);
+
+    if (writeSynthNoise(fd, &s) || (tiffs[0] = readFDOptions(fd, &opts[0], &error)) == NULL ||
+        (tiffs[1] = readFDOptions(fd, &opts[1], &error)) == NULL) {
+        perror("BENCH WRITE ERROR");
+        tiffFree(tiffs[0]);
+        close(fd);
+        fclose(null);
+        return 1;
+    }
+
+    close(fd);
+    printf("bilevel %ux%u to /dev/null\n", width, height);
+    printf("%10s %8s %10s\n", "output", "from", "ms");
+
+    start = now();
+    renderReference(null, tiffs[0]);
+    fflush(null);
+    printf("%10s %8s %10.2f\n", "fprintf", "gray8", (now() - start) * 1e3);
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        start = now();
+        if (renderImage(fileno(null), tiffs[cases[i].image], cases[i].format, &error))
+            fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+        printf("%10s %8s %10.2f\n", cases[i].name, cases[i].image ? "packed1" : "gray8", (now() - start) * 1e3);
+    }
+
+    tiffFree(tiffs[0]);
+    tiffFree(tiffs[1]);
+    fclose(null);
+    return 0;
+}
+
+/* 0 for black and 255 for white, what every reader should return for the stored pixel */
+static uint8_t synthPixel(const struct synth *s, const uint8_t *rows, uint32_t x, uint32_t y) {
+    size_t rowBytes = ((size_t) s->width * s->bitsPerSample + 7) / 8;
+
+    if (s->bitsPerSample == 16)
+        return rows[y * rowBytes + 2 * x + (s->order == II)];
+    if (s->bitsPerSample == 8)
+        return rows[y * rowBytes + x];
+    return rows[y * rowBytes + x / 8] & 0x80 >> x % 8 ? 0 : 255;
+}
+
+/* true when the image is the file from (x, y) on, thumbnails may be off by one from the mean of each box */
+static bool synthCheck(const struct synth *s, const uint8_t *rows, tiff_t tiff, uint32_t x, uint32_t y,
+                       unsigned scale) {
+    for (uint32_t ty = 0; ty < tiff->height; ++ty) {
+        for (uint32_t tx = 0; tx < tiff->width; ++tx) {
+            uint32_t sum = 0, count = 0;
+            int diff;
+
+            for (uint32_t by = y + ty * scale; by < y + (ty + 1) * scale && by < s->height; ++by) {
+                for (uint32_t bx = x + tx * scale; bx < x + (tx + 1) * scale && bx < s->width; ++bx)
+                    sum += synthPixel(s, rows, bx, by), ++count;
+            }
+
+            diff = (int) tiffPixel(tiff, tx, ty) - (int) (count ? sum / count : 0);
+            if (diff > (scale > 1) || diff < -(scale > 1))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+enum corpusReader {
+    CORPUS_READ_FD,
+    CORPUS_THREADS,
+    CORPUS_PACKED,
+    CORPUS_MAPPED,
+    CORPUS_REGION,
+    CORPUS_THUMB,
+    CORPUS_ASYNC
+};
+
+#define CORPUS_THREAD_COUNT 4
+
+/* best of BENCH_RUNS reads of fd through one reader, with the last image left in *kept */
+static double timeCorpusRead(int fd, const struct synth *s, enum corpusReader reader, tiff_t *kept) {
+    struct tiffOptions opts = {.threads = reader == CORPUS_THREADS ? CORPUS_THREAD_COUNT : 1,
+                               .packed = reader == CORPUS_PACKED, .scale = reader == CORPUS_THUMB ? 4 : 1,
+                               .async = reader == CORPUS_ASYNC};
+    struct tiffError error;
+    double best = -1;
+
+    *kept = NULL;
+
+    for (int i = 0; i < BENCH_RUNS; ++i) {
+        double start = now();
+        tiff_t tiff;
+
+        if (reader == CORPUS_READ_FD)
+            tiff = readFD(fd, &error);
+        else if (reader == CORPUS_MAPPED)
+            tiff = readMapped(fd, false, NULL, &error);
+        else if (reader == CORPUS_REGION)
+            tiff = readRegion(fd, s->width / 4, s->height / 4, s->width / 2, s->height / 2, &error);
+        else
+            tiff = readFDOptions(fd, &opts, &error);
+
+        double elapsed = now() - start;
+
+        if (tiff == NULL) {
+            fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+            tiffFree(*kept);
+            *kept = NULL;
+            return -1;
+        }
+
+        tiffFree(*kept);
+        *kept = tiff;
+
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+/*
+ * writes every combination of size, gray bits per sample, strip layout, byte order and compression, and times
+ * each reader on it. results are csv on stdout, one line per file and reader; files are kept in dir if given.
+ */
+static int benchCorpus(uint32_t side, const char *dir) {
+    const char *readers[] = {"readFD", "threads", "packed", "mapped", "region", "thumb4", "async"};
+    const char *codecs[] = {"none", "packbits", "lzw"};
+    uint16_t compressions[] = {NO_COMPRESSION, PACKBITS, LZW};
+    uint32_t heights[] = {64, side / 4, side};
+    uint16_t depths[] = {1, 8, 16};
+    enum byteOrder orders[] = {II, MM};
+    uint8_t *rows = malloc(2 * (size_t) side * side);
+    int status = 0;
+
+    if (rows == NULL || side < 64) {
+        fprintf(stderr, "BENCH CORPUS ERROR\n");
+        free(rows);
+        return 1;
+    }
+
+    printf("file,width,height,bits,order,compression,rows_per_strip,strips,file_bytes,reader,threads,ms,"
+           "mpixels_per_s,ok\n");
+
+    for (int h = 0; h < 3; ++h) {
+        if (h > 0 && heights[h] <= heights[h - 1])
+            continue;
+
+        for (int d = 0; d < 3; ++d) {
+            struct synth s = {.width = heights[h] - 3, .height = heights[h], .bitsPerSample = depths[d]};
+            uint32_t layouts[] = {s.height, 16, 1};
+
+            /* smooth rows, so that the codecs have runs to find */
+            fillSamples(rows, ((size_t) s.width * s.bitsPerSample + 7) / 8 * s.height, true);
+
+            for (int l = 0; l < 3; ++l) {
+                for (int o = 0; o < 2; ++o) {
+                    for (int c = 0; c < 3; ++c) {
+                        char name[64], path[PATH_MAX];
+                        size_t size;
+                        int fd;
+
+                        s.rowsPerStrip = layouts[l];
+                        s.order = orders[o];
+                        s.compression = compressions[c];
+                        snprintf(name, sizeof(name), "%ux%u-%ubit-%s-%s-%urps.tif", s.width, s.height,
+                                 s.bitsPerSample, o == 0 ? "ii" : "mm", codecs[c], s.rowsPerStrip);
+
+                        if (dir != NULL) {
+                            snprintf(path, sizeof(path), "%s/%s", dir, name);
+                            fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+                        } else {
+                            strcpy(path, "/tmp/tiffbenchXXXXXX");
+                            fd = mkstemp(path);
+                            if (fd >= 0)
+                                unlink(path);
+                        }
+
+                        if (fd < 0 || (size = writeSynth(fd, &s, rows)) == 0) {
+                            perror(path);
+                            if (fd >= 0)
+                                close(fd);
+                            free(rows);
+                            return 1;
+                        }
+
+                        for (enum corpusReader r = CORPUS_READ_FD; r <= CORPUS_ASYNC; ++r) {
+                            uint32_t x = r == CORPUS_REGION ? s.width / 4 : 0;
+                            uint32_t y = r == CORPUS_REGION ? s.height / 4 : 0;
+                            double pixels = r == CORPUS_REGION ? (double) (s.width / 2) * (s.height / 2)
+                                                               : (double) s.width * s.height;
+                            tiff_t tiff;
+                            double best;
+                            bool ok;
+
+                            if ((r == CORPUS_PACKED && s.bitsPerSample != 1) ||
+                                (r == CORPUS_THUMB && s.bitsPerSample == 16))
+                                continue;
+
+                            best = timeCorpusRead(fd, &s, r, &tiff);
+                            ok = best >= 0 && synthCheck(&s, rows, tiff, x, y, r == CORPUS_THUMB ? 4 : 1);
+                            status |= !ok;
+                            printf("%s,%u,%u,%u,%s,%s,%u,%u,%zu,%s,%u,%.4f,%.1f,%d\n", name, s.width, s.height,
+                                   s.bitsPerSample, o == 0 ? "II" : "MM", codecs[c], s.rowsPerStrip,
+                                   (s.height + s.rowsPerStrip - 1) / s.rowsPerStrip, size, readers[r],
+                                   r == CORPUS_THREADS ? CORPUS_THREAD_COUNT : 1, best * 1e3,
+                                   best > 0 ? pixels / best / 1e6 : 0, ok);
+                            tiffFree(tiff);
+                        }
+
+                        close(fd);
+                    }
+                }
+            }
+        }
+    }
+
+    free(rows);
+    return status;
+}
+
+/* times the predictor kernels on differenced rows, then a single strip lzw file with predictor 2 on threads */
+static int benchPredict(uint32_t side) {
+    struct {
+        const char *name;
+        predictFn fn[2];
+    } kernels[] = {
+            {"scalar", {predictRow8Scalar, predictRow16Scalar}},
+#if defined(__x86_64__) || defined(__i386__)
+            {"ssse3",  {__builtin_cpu_supports("ssse3") ? predictRow8SSSE3 : NULL,
+                        __builtin_cpu_supports("ssse3") ? predictRow16SSSE3 : NULL}},
+#endif
+    };
+    uint16_t samples[] = {1, 3};
+    size_t size = 6 * (size_t) side * side;
+    uint8_t *diff = malloc(size);
+    uint8_t *out = malloc(size);
+    uint8_t *expect = malloc(size);
+    struct synth s = {.width = side - 3, .height = side, .bitsPerSample = 8, .rowsPerStrip = side, .order = II,
+                      .compression = LZW, .predictor = HORIZONTAL_DIFFERENCING};
+    char path[] = "/tmp/tiffbenchXXXXXX";
+    int status = 0;
+    int fd;
+
+    if (diff == NULL || out == NULL || expect == NULL || side < 64) {
+        fprintf(stderr, "BENCH PREDICT ERROR\n");
+        free(diff), free(out), free(expect);
+        return 1;
+    }
+
+    fillSamples(diff, size, false);
+
+    printf("predictor 2 on %u rows of %u pixels, runtime pick: %s\n", side, side, predictKernelName());
+    printf("%10s %5s %8s %12s %12s %8s\n", "kernel", "bits", "samples", "ms", "MB/s", "speedup");
+
+    for (int wide = 0; wide < 2; ++wide) {
+        for (int n = 0; n < 2; ++n) {
+            size_t rowBytes = (size_t) side * samples[n] * (wide ? 2 : 1);
+            double base = -1;
+
+            for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+                predictFn fn = kernels[k].fn[wide];
+                double best = -1;
+
+                if (fn == NULL)
+                    continue;
+
+                for (int i = 0; i < BENCH_RUNS; ++i) {
+                    memcpy(out, diff, rowBytes * side);
+                    double start = now();
+                    for (uint32_t y = 0; y < side; ++y)
+                        fn(out + y * rowBytes, side, samples[n]);
+                    double elapsed = now() - start;
+
+                    if (best < 0 || elapsed < best)
+                        best = elapsed;
+                }
+
+                if (base < 0) {
+                    base = best;
+                    memcpy(expect, out, rowBytes * side);
+                }
+
+                printf("%10s %5d %8u %12.2f %12.0f %8.2f%s\n", kernels[k].name, wide ? 16 : 8, samples[n],
+                       best * 1e3, rowBytes * side / best / 1e6, base / best,
+                       memcmp(out, expect, rowBytes * side) == 0 ? "" : "  MISMATCH");
+                status |= memcmp(out, expect, rowBytes * side) != 0;
+            }
+        }
+    }
+
+    /* smooth rows differenced the way a writer would, so that lzw has runs to find */
+    fillSamples(expect, (size_t) s.width * s.height, true);
+    for (uint32_t y = 0; y < s.height; ++y) {
+        const uint8_t *row = expect + (size_t) y * s.width;
+
+        diff[(size_t) y * s.width] = row[0];
+        for (uint32_t x = 1; x < s.width; ++x)
+            diff[(size_t) y * s.width + x] = (uint8_t) (row[x] - row[x - 1]);
+    }
+
+    fd = mkstemp(path);
+    if (fd >= 0)
+        unlink(path);
+
+    if (fd < 0 || writeSynth(fd, &s, diff) == 0) {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        free(diff), free(out), free(expect);
+        return 1;
+    }
+
+    printf("single strip lzw with predictor 2, %ux%u 8 bit\n", s.width, s.height);
+    printf("%8s %12s %12s\n", "threads", "ms", "Mpixels/s");
+
+    for (unsigned threads = 1; threads <= CORPUS_THREAD_COUNT; threads *= 2) {
+        struct tiffOptions opts = {.threads = threads};
+        tiff_t kept = NULL;
+        double best = -1;
+
+        for (int i = 0; i < BENCH_RUNS; ++i) {
+            struct tiffError error;
+            double start = now();
+            tiff_t tiff = readFDOptions(fd, &opts, &error);
+            double elapsed = now() - start;
+
+            if (tiff == NULL) {
+                fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+                tiffFree(kept);
+                close(fd);
+                free(diff), free(out), free(expect);
+                return 1;
+            }
+
+            tiffFree(kept);
+            kept = tiff;
+
+            if (best < 0 || elapsed < best)
+                best = elapsed;
+        }
+
+        printf("%8u %12.2f %12.1f%s\n", threads, best * 1e3, (double) s.width * s.height / best / 1e6,
+               synthCheck(&s, expect, kept, 0, 0, 1) ? "" : "  MISMATCH");
+        status |= !synthCheck(&s, expect, kept, 0, 0, 1);
+        tiffFree(kept);
+    }
+
+    close(fd);
+    free(diff), free(out), free(expect);
+    return status;
+}
+
+/* pages of fd in the page cache */
+static size_t cachedPages(int fd) {
+    struct stat st;
+    size_t pages, cached = 0;
+    unsigned char *resident;
+    void *map;
+
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+        return 0;
+
+    pages = (st.st_size + 4095) / 4096;
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    resident = malloc(pages);
+
+    if (map != MAP_FAILED && resident != NULL && mincore(map, st.st_size, resident) == 0) {
+        for (size_t i = 0; i < pages; ++i)
+            cached += resident[i] & 1;
+    }
+
+    if (map != MAP_FAILED)
+        munmap(map, st.st_size);
+    free(resident);
+    return cached;
+}
+
+/*
+ * reads uncompressed files with their strips in order and last first after dropping them from the page
+ * cache, through readFD and a stream, and counts the pages the stream leaves cached.
+ */
+static int benchCold(uint32_t side) {
+    uint8_t *rows = malloc((size_t) side * side);
+    int status = 0;
+
+    if (rows == NULL || side < 64) {
+        fprintf(stderr, "BENCH COLD ERROR\n");
+        free(rows);
+        return 1;
+    }
+
+    fillSamples(rows, (size_t) side * side, true);
+
+    printf("cold reads of %ux%u 8 bit, 16 rows per strip\n", side, side);
+    printf("%10s %12s %12s %14s\n", "layout", "readFD ms", "stream ms", "pages cached");
+
+    for (int reversed = 0; reversed < 2; ++reversed) {
+        struct synth s = {.width = side, .height = side, .bitsPerSample = 8, .rowsPerStrip = 16, .order = II,
+                          .compression = NO_COMPRESSION, .reversed = reversed};
+        char path[] = "/tmp/tiffbenchXXXXXX";
+        double read = -1, streamed = -1;
+        size_t pages = 0;
+        int fd = mkstemp(path);
+
+        if (fd >= 0)
+            unlink(path);
+
+        if (fd < 0 || writeSynth(fd, &s, rows) == 0) {
+            perror(path);
+            if (fd >= 0)
+                close(fd);
+            free(rows);
+            return 1;
+        }
+
+        /* fdatasync first, dirty pages are not dropped */
+        fdatasync(fd);
+
+        for (int i = 0; i < BENCH_RUNS; ++i) {
+            struct tiffError error;
+            tiffStream_t stream;
+            const uint8_t *block;
+            uint32_t first, count;
+            double start, elapsed;
+            tiff_t tiff;
+
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            start = now();
+            tiff = readFD(fd, &error);
+            elapsed = now() - start;
+
+            if (tiff == NULL || !synthCheck(&s, rows, tiff, 0, 0, 1)) {
+                fprintf(stderr, "%s\n", tiff == NULL ? tiffErrorF(error) : "MISMATCH");
+                status = 1;
+            }
+
+            tiffFree(tiff);
+            if (read < 0 || elapsed < read)
+                read = elapsed;
+
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            start = now();
+            stream = streamOpen(fd, 0, &error);
+            while (stream != NULL && !streamNextRows(stream, &block, &first, &count, &error) && count);
+            streamClose(stream);
+            elapsed = now() - start;
+
+            if (streamed < 0 || elapsed < streamed)
+                streamed = elapsed;
+            pages = cachedPages(fd);
+        }
+
+        printf("%10s %12.2f %12.2f %14zu\n", reversed ? "reversed" : "in order", read * 1e3, streamed * 1e3, pages);
+        close(fd);
+    }
+
+    free(rows);
+    return status;
+}
+
+/* decodes a hot set of files again and again through readFD and through the image cache */
+static int benchCache(uint32_t side, uint32_t count) {
+    struct synth s = {.width = side, .height = side, .bitsPerSample = 8, .rowsPerStrip = 16, .order = II,
+                      .compression = LZW};
+    uint8_t *rows = malloc((size_t) side * side);
+    int *fds = malloc(sizeof(int) * count);
+    struct cacheStats stats;
+    double times[3] = {0};
+    int status = 0;
+
+    if (rows == NULL || fds == NULL || count == 0) {
+        fprintf(stderr, "BENCH CACHE ERROR\n");
+        free(rows), free(fds);
+        return 1;
+    }
+
+    fillSamples(rows, (size_t) side * side, true);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        char path[] = "/tmp/tiffbenchXXXXXX";
+
+        fds[i] = mkstemp(path);
+        if (fds[i] >= 0)
+            unlink(path);
+
+        if (fds[i] < 0 || writeSynth(fds[i], &s, rows) == 0) {
+            perror(path);
+            for (uint32_t j = 0; j <= i; ++j)
+                if (fds[j] >= 0)
+                    close(fds[j]);
+            free(rows), free(fds);
+            return 1;
+        }
+    }
+
+    cacheClear();
+    cacheSetBudget((size_t) count * side * side + (1u << 20));
+
+    /* readFD on every pass, then the cache: its first pass misses and the ones after hit */
+    for (int pass = 0; pass < 2 * BENCH_RUNS; ++pass) {
+        bool cached = pass >= BENCH_RUNS;
+        double elapsed = 0;
+
+        for (uint32_t i = 0; i < count; ++i) {
+            struct tiffError error;
+            double start = now();
+            tiff_t tiff = cached ? cacheReadFD(fds[i], NULL, &error) : readFD(fds[i], &error);
+
+            /* the first pass of each reader is checked, outside of the time taken */
+            elapsed += now() - start;
+
+            if (tiff == NULL || ((pass == 0 || pass == BENCH_RUNS) && !synthCheck(&s, rows, tiff, 0, 0, 1))) {
+                fprintf(stderr, "%s\n", tiff == NULL ? tiffErrorF(error) : "MISMATCH");
+                status = 1;
+            }
+
+            tiffFree(tiff);
+        }
+
+        times[!cached ? 0 : pass == BENCH_RUNS ? 1 : 2] += elapsed / count;
+    }
+
+    cacheGetStats(&stats);
+    printf("%u files of %ux%u 8 bit lzw, %d passes\n", count, side, side, BENCH_RUNS);
+    printf("%10s %12s\n", "reader", "us per read");
+    printf("%10s %12.2f\n", "readFD", times[0] / BENCH_RUNS * 1e6);
+    printf("%10s %12.2f\n", "miss", times[1] * 1e6);
+    printf("%10s %12.2f\n", "hit", times[2] / (BENCH_RUNS - 1) * 1e6);
+    printf("cache: %lu hits, %lu misses, %lu evicted, %u images in %.1f MB\n", stats.hits, stats.misses,
+           stats.evictions, stats.entries, stats.bytes / 1e6);
+
+    cacheSetBudget(0);
+    for (uint32_t i = 0; i < count; ++i)
+        close(fds[i]);
+    free(rows), free(fds);
+    return status;
+}
+
+/* best of BENCH_RUNS reads of fd with the histogram counted after the decode in a second pass, and during it */
+static int benchHistogram(uint32_t side) {
+    struct {
+        const char *name;
+        struct synth s;
+        bool packed;
+    } cases[] = {
+            {"gray8",   {.bitsPerSample = 8, .compression = NO_COMPRESSION}},
+            {"lzw8",    {.bitsPerSample = 8, .compression = LZW}},
+            {"gray16",  {.bitsPerSample = 16, .compression = NO_COMPRESSION}},
+            {"packed1", {.bitsPerSample = 1, .compression = NO_COMPRESSION}, true},
+    };
+    uint8_t *rows = malloc(2 * (size_t) side * side);
+    char path[] = "/tmp/tiffbenchXXXXXX";
+    int status = 0;
+    int fd;
+
+    if (rows == NULL || (fd = mkstemp(path)) < 0) {
+        perror("BENCH HISTOGRAM ERROR");
+        free(rows);
+        return 1;
+    }
+    unlink(path);
+
+    fillSamples(rows, 2 * (size_t) side * side, true);
+
+    printf("histogram of %ux%u images, best of %d\n", side, side, BENCH_RUNS);
+    printf("%8s %10s %12s %12s %10s\n", "format", "read ms", "+measure ms", "fused ms", "saved %");
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        struct synth *sy = &cases[c].s;
+        struct tiffHistogram after, fused;
+        struct tiffOptions plain = {.threads = 1, .packed = cases[c].packed};
+        struct tiffOptions measured = plain;
+        double times[3] = {-1, -1, -1};
+        tiff_t tiff;
+
+        sy->width = side, sy->height = side, sy->rowsPerStrip = 16, sy->order = II;
+        measured.histogram = &fused;
+
+        if (writeSynth(fd, sy, rows) == 0) {
+            perror(path);
+            status = 1;
+            break;
+        }
+
+        for (int i = 0; i < BENCH_RUNS; ++i) {
+            struct tiffError error;
+            double t[3];
+
+            for (int k = 0; k < 3; ++k) {
+                double start = now();
+
+                tiff = readFDOptions(fd, k == 2 ? &measured : &plain, &error);
+                if (tiff == NULL) {
+                    fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+                    close(fd), free(rows);
+                    return 1;
+                }
+
+                if (k == 1)
+                    tiffMeasure(tiff, &after);
+
+                t[k] = now() - start;
+
+                if (k == 2 && i == 0 && (memcmp(&after, &fused, sizeof(after)) != 0 ||
+                                         fused.black != tiffCountBlack(tiff) ||
+                                         fused.pixels != (uint64_t) side * side)) {
+                    fprintf(stderr, "%s: histograms differ\n", cases[c].name);
+                    status = 1;
+                }
+
+                tiffFree(tiff);
+            }
+
+            for (int k = 0; k < 3; ++k) {
+                if (times[k] < 0 || t[k] < times[k])
+                    times[k] = t[k];
+            }
+        }
+
+        printf("%8s %10.2f %12.2f %12.2f %10.1f\n", cases[c].name, times[0] * 1e3, times[1] * 1e3, times[2] * 1e3,
+               (1 - times[2] / times[1]) * 100);
+    }
+
+    close(fd);
+    free(rows);
+    return status;
+}
+
+/* the threshold kernels against each other, then otsu and dithering of a whole image on 1 to 4 threads */
+static int benchBilevel(uint32_t side) {
+    struct {
+        const char *name;
+        thresholdFn fn;
+    } kernels[] = {
+            {"scalar", thresholdRowScalar},
+#if defined(__x86_64__) || defined(__i386__)
+            {"ssse3",  __builtin_cpu_supports("ssse3") ? thresholdRowSSSE3 : NULL},
+            {"avx2",   __builtin_cpu_supports("avx2") ? thresholdRowAVX2 : NULL},
+#endif
+    };
+    struct synth s = {.width = side - 3, .height = side, .bitsPerSample = 8, .rowsPerStrip = 16, .order = II,
+                      .compression = NO_COMPRESSION};
+    size_t stride = (s.width + 7) / 8;
+    uint8_t *rows = malloc((size_t) side * side);
+    uint8_t *packed = malloc(stride * side);
+    uint8_t *expect = malloc(stride * side);
+    char path[] = "/tmp/tiffbenchXXXXXX";
+    struct tiffHistogram histogram;
+    struct tiffOptions opts = {.threads = 1, .histogram = &histogram};
+    struct tiffError error;
+    tiff_t gray = NULL, first = NULL;
+    double base = -1;
+    int status = 0;
+    int fd = -1;
+
+    if (rows == NULL || packed == NULL || expect == NULL || side < 64 || (fd = mkstemp(path)) < 0) {
+        fprintf(stderr, "BENCH BILEVEL ERROR\n");
+        free(rows), free(packed), free(expect);
+        return 1;
+    }
+    unlink(path);
+
+    fillSamples(rows, (size_t) side * side, true);
+
+    if (writeSynth(fd, &s, rows) == 0 || (gray = readFDOptions(fd, &opts, &error)) == NULL) {
+        fprintf(stderr, "BENCH BILEVEL READ ERROR\n");
+        close(fd), free(rows), free(packed), free(expect);
+        return 1;
+    }
+
+    printf("threshold %ux%u to packed bits, runtime pick: %s\n", s.width, side, thresholdKernelName());
+    printf("%10s %12s %12s %8s\n", "kernel", "ms", "MB/s", "speedup");
+
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+        double best = -1;
+
+        if (kernels[k].fn == NULL)
+            continue;
+
+        for (int i = 0; i < BENCH_RUNS; ++i) {
+            double start = now();
+            for (uint32_t y = 0; y < side; ++y)
+                kernels[k].fn(tiffRow(gray, y), s.width, 128, packed + y * stride);
+            double elapsed = now() - start;
+
+            if (best < 0 || elapsed < best)
+                best = elapsed;
+        }
+
+        if (base < 0) {
+            base = best;
+            memcpy(expect, packed, stride * side);
+        } else if (memcmp(expect, packed, stride * side) != 0) {
+            fprintf(stderr, "%s: packed rows differ from scalar\n", kernels[k].name);
+            status = 1;
+        }
+
+        printf("%10s %12.2f %12.1f %8.2f\n", kernels[k].name, best * 1e3, (double) s.width * side / best / 1e6,
+               base / best);
+    }
+
+    printf("otsu: threshold %u from the histogram of the decode\n", bilevelOtsu(&histogram));
+    printf("%10s %8s %12s %12s\n", "method", "threads", "ms", "black %");
+
+    for (int method = BILEVEL_THRESHOLD; method <= BILEVEL_DITHER; ++method) {
+        for (unsigned threads = 1; threads <= 4; threads *= 2) {
+            struct bilevelOptions bo = {.method = method, .threads = threads, .histogram = &histogram};
+            struct tiffHistogram out;
+            double best = -1;
+            tiff_t tiff = NULL;
+
+            for (int i = 0; i < BENCH_RUNS; ++i) {
+                double start = now();
+
+                tiffFree(tiff);
+                tiff = bilevelImage(gray, &bo, &error);
+                if (tiff == NULL) {
+                    fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+                    status = 1;
+                    break;
+                }
+
+                if (best < 0 || now() - start < best)
+                    best = now() - start;
+            }
+
+            if (tiff == NULL)
+                continue;
+
+            /* every thread count has to come to the same pixels as the serial run */
+            if (threads == 1) {
+                tiffFree(first);
+                first = tiffRetain(tiff);
+            } else if (memcmp(first->data, tiff->data, stride * side) != 0) {
+                fprintf(stderr, "%d on %u threads differs from 1\n", method, threads);
+                status = 1;
+            }
+
+            tiffMeasure(tiff, &out);
+            printf("%10s %8u %12.2f %12.2f\n", method == BILEVEL_THRESHOLD ? "threshold" : method == BILEVEL_OTSU ?
+                                                  "otsu" : "dither", threads, best * 1e3, out.blackRatio * 100);
+            tiffFree(tiff);
+        }
+    }
+
+    /* the writer gets the dithered rows a band at a time, they have to read back as the image */
+    {
+        struct bilevelOptions bo = {.method = BILEVEL_DITHER, .threads = 2};
+        struct tiffOptions po = {.packed = true};
+        double start = now();
+        tiff_t back;
+
+        if (bilevelWrite(fd, gray, &bo, NULL, &error) || (back = readFDOptions(fd, &po, &error)) == NULL) {
+            fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+            status = 1;
+        } else {
+            printf("dither to the writer: %.2f ms\n", (now() - start) * 1e3);
+            if (back->format != PACKED1 || memcmp(back->data, first->data, stride * side) != 0) {
+                fprintf(stderr, "written image differs\n");
+                status = 1;
+            }
+            tiffFree(back);
+        }
+    }
+
+    tiffFree(first);
+    tiffFree(gray);
+    close(fd);
+    free(rows), free(packed), free(expect);
+    return status;
+}
+
+/* the stored pixel shown at (x, y) of the upright image */
+static uint8_t orientedPixel(const struct synth *s, const uint8_t *rows, uint32_t x, uint32_t y) {
+    bool swap = s->orientation >= LEFT_TOP;
+    bool reverseRows = s->orientation == BOTTOM_RIGHT || s->orientation == BOTTOM_LEFT ||
+                       s->orientation == RIGHT_TOP || s->orientation == RIGHT_BOTTOM;
+    bool reverseColumns = s->orientation == TOP_RIGHT || s->orientation == BOTTOM_RIGHT ||
+                          s->orientation == RIGHT_BOTTOM || s->orientation == LEFT_BOTTOM;
+    uint32_t sx = swap ? y : x, sy = swap ? x : y;
+
+    return synthPixel(s, rows, reverseColumns ? s->width - 1 - sx : sx, reverseRows ? s->height - 1 - sy : sy);
+}
+
+/*
+ * reads of the same pixels stored in each of the eight orientations and turned upright, against the
+ * upright read. then a rotation a pixel at a time against the blocked one, on the decoded image.
+ */
+static int benchOrient(uint32_t side) {
+    struct {
+        const char *name;
+        struct synth s;
+        bool packed;
+    } cases[] = {
+            {"gray8",   {.bitsPerSample = 8, .compression = NO_COMPRESSION}},
+            {"lzw8",    {.bitsPerSample = 8, .compression = LZW}},
+            {"gray16",  {.bitsPerSample = 16, .compression = NO_COMPRESSION}},
+            {"packed1", {.bitsPerSample = 1, .compression = NO_COMPRESSION}, true},
+    };
+    uint8_t *rows = malloc(2 * (size_t) side * side);
+    uint8_t *naive = malloc((size_t) side * side);
+    char path[] = "/tmp/tiffbenchXXXXXX";
+    struct tiffOptions opts = {.threads = 1, .orient = true};
+    struct tiffError error;
+    int status = 0;
+    int fd;
+
+    if (rows == NULL || naive == NULL || side < 64 || (fd = mkstemp(path)) < 0) {
+        fprintf(stderr, "BENCH ORIENT ERROR\n");
+        free(rows), free(naive);
+        return 1;
+    }
+    unlink(path);
+
+    fillSamples(rows, 2 * (size_t) side * side, true);
+
+    printf("reads of %ux%u turned upright, best of %d, transpose kernel: %s\n", side - 3, side, BENCH_RUNS,
+           transposeKernelName());
+    printf("%8s", "format");
+    for (int o = TOP_LEFT; o <= LEFT_BOTTOM; ++o)
+        printf(" %7d ms", o);
+    printf("\n");
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        struct synth *sy = &cases[c].s;
+
+        sy->width = side - 3, sy->height = side, sy->rowsPerStrip = 16, sy->order = II;
+        opts.packed = cases[c].packed;
+        printf("%8s", cases[c].name);
+
+        for (uint16_t o = TOP_LEFT; o <= LEFT_BOTTOM; ++o) {
+            double best = -1;
+            tiff_t tiff = NULL;
+
+            sy->orientation = o;
+            if (writeSynth(fd, sy, rows) == 0) {
+                perror(path);
+                close(fd), free(rows), free(naive);
+                return 1;
+            }
+
+            for (int i = 0; i < BENCH_RUNS; ++i) {
+                double start = now();
+
+                tiffFree(tiff);
+                if ((tiff = readFDOptions(fd, &opts, &error)) == NULL) {
+                    fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+                    close(fd), free(rows), free(naive);
+                    return 1;
+                }
+
+                if (best < 0 || now() - start < best)
+                    best = now() - start;
+            }
+
+            if (tiff->width != (o >= LEFT_TOP ? sy->height : sy->width) ||
+                tiff->height != (o >= LEFT_TOP ? sy->width : sy->height)) {
+                fprintf(stderr, "%s %u: %ux%u\n", cases[c].name, o, tiff->width, tiff->height);
+                status = 1;
+            } else {
+                for (uint32_t y = 0; y < tiff->height; ++y) {
+                    uint32_t x = 0;
+
+                    while (x < tiff->width && tiffPixel(tiff, x, y) == orientedPixel(sy, rows, x, y))
+                        ++x;
+
+                    if (x < tiff->width) {
+                        fprintf(stderr, "%s %u: differs at %u, %u\n", cases[c].name, o, x, y);
+                        status = 1;
+                        break;
+                    }
+                }
+            }
+
+            printf(" %10.2f", best * 1e3);
+            fflush(stdout);
+            tiffFree(tiff);
+        }
+
+        printf("\n");
+    }
+
+    /* the upright 8 bit image, turned a quarter clockwise */
+    {
+        struct synth *sy = &cases[0].s;
+        double start, blocked = -1, simple = -1;
+        struct tiffOptions plain = {.threads = 1};
+        tiff_t tiff;
+
+        sy->orientation = 0;
+        if (writeSynth(fd, sy, rows) == 0 || (tiff = readFDOptions(fd, &plain, &error)) == NULL) {
+            fprintf(stderr, "BENCH ORIENT READ ERROR\n");
+            close(fd), free(rows), free(naive);
+            return 1;
+        }
+
+        for (int i = 0; i < BENCH_RUNS; ++i) {
+            start = now();
+            for (uint32_t y = 0; y < sy->width; ++y) {
+                for (uint32_t x = 0; x < side; ++x)
+                    naive[(size_t) y * side + x] = tiff->data[(size_t) (side - 1 - x) * tiff->stride + y];
+            }
+            if (simple < 0 || now() - start < simple)
+                simple = now() - start;
+
+            start = now();
+            if (orientImage(tiff, RIGHT_TOP, 1, &error) || orientImage(tiff, LEFT_BOTTOM, 1, &error)) {
+                fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+                status = 1;
+                break;
+            }
+            /* two turns, there and back */
+            if (blocked < 0 || (now() - start) / 2 < blocked)
+                blocked = (now() - start) / 2;
+        }
+
+        if (orientImage(tiff, RIGHT_TOP, 1, &error) == false &&
+            memcmp(tiff->data, naive, (size_t) sy->width * side) != 0) {
+            fprintf(stderr, "blocked rotation differs from the naive one\n");
+            status = 1;
+        }
+
+        printf("quarter turn of the decoded gray8: per pixel %.2f ms, blocked %.2f ms\n", simple * 1e3,
+               blocked * 1e3);
+        tiffFree(tiff);
+    }
+
+    close(fd);
+    free(rows), free(naive);
+    return status;
+}
+
+/* halves a GRAY8 image in memory the way every level of a pyramid is made, the edge boxes averaging what they hold */
+static void halveReference(const uint8_t *src, uint32_t width, uint32_t height, uint8_t *dst) {
+    uint32_t outWidth = (width + 1) / 2;
+
+    for (uint32_t y = 0; y < (height + 1) / 2; ++y) {
+        for (uint32_t x = 0; x < outWidth; ++x) {
+            uint32_t sum = 0, n = 0;
+
+            for (uint32_t dy = 2 * y; dy < 2 * y + 2 && dy < height; ++dy) {
+                for (uint32_t dx = 2 * x; dx < 2 * x + 2 && dx < width; ++dx)
+                    sum += src[(size_t) dy * width + dx], ++n;
+            }
+
+            dst[(size_t) y * outWidth + x] = (uint8_t) ((sum + n / 2) / n);
+        }
+    }
+}
+
+/*
+ * a pyramid streamed from a stripped gray image against the whole image read and halved in memory a level
+ * at a time. every level read back must match the one made in memory.
+ */
+static int benchPyramid(uint32_t side) {
+    char paths[2][21] = {"/tmp/tiffbenchXXXXXX", "/tmp/tiffbenchXXXXXX"};
+    struct synth s = {.width = side - 5, .height = side, .bitsPerSample = 8, .rowsPerStrip = 16, .order = II,
+                      .compression = NO_COMPRESSION};
+    struct tiffWriteOptions tileOpts[2] = {{.tileWidth = 256, .tileLength = 256},
+                                           {.compression = PACKBITS, .tileWidth = 256, .tileLength = 256}};
+    const char *names[2] = {"none", "packbits"};
+    uint8_t *levels[PYRAMID_BENCH_LEVELS] = {0};
+    uint32_t widths[PYRAMID_BENCH_LEVELS], heights[PYRAMID_BENCH_LEVELS];
+    uint32_t count = 1;
+    struct tiffError error;
+    double start, memory = -1;
+    int status = 0;
+    uint8_t *rows;
+    int fds[2];
+
+    rows = malloc((size_t) s.width * s.height);
+    fds[0] = mkstemp(paths[0]);
+    fds[1] = mkstemp(paths[1]);
+
+    if (rows == NULL || fds[0] < 0 || fds[1] < 0 || side < 64) {
+        perror("BENCH FILE ERROR");
+        free(rows);
+        return 1;
+    }
+    unlink(paths[0]);
+    unlink(paths[1]);
+
+    fillSamples(rows, (size_t) s.width * s.height, true);
+
+    if (writeSynth(fds[0], &s, rows) == 0) {
+        perror("BENCH WRITE ERROR");
+        free(rows);
+        close(fds[0]), close(fds[1]);
+        return 1;
+    }
+
+    free(rows);
+
+    /* down to a level that fits in one tile, as writePyramid picks them */
+    for (int i = 0; i < BENCH_RUNS; ++i) {
+        tiff_t tiff;
+
+        start = now();
+        if ((tiff = readFD(fds[0], &error)) == NULL) {
+            fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+            close(fds[0]), close(fds[1]);
+            return 1;
+        }
+
+        widths[0] = tiff->width, heights[0] = tiff->height;
+        free(levels[0]);
+        levels[0] = tiff->data;
+        tiff->data = NULL;
+        tiffFree(tiff);
+
+        for (count = 1; count < PYRAMID_BENCH_LEVELS && (widths[count - 1] > 256 || heights[count - 1] > 256); ++count) {
+            widths[count] = (widths[count - 1] + 1) / 2, heights[count] = (heights[count - 1] + 1) / 2;
+            free(levels[count]);
+            levels[count] = malloc((size_t) widths[count] * heights[count]);
+            halveReference(levels[count - 1], widths[count - 1], heights[count - 1], levels[count]);
+        }
+
+        if (memory < 0 || now() - start < memory)
+            memory = now() - start;
+    }
+
+    printf("pyramid of %ux%u in 256x256 tiles, %u levels, best of %d\n", widths[0], heights[0], count, BENCH_RUNS);
+    printf("%10s %10s %14s\n", "writer", "ms", "peak rss +KB");
+    printf("%10s %10.2f %14s\n", "in memory", memory * 1e3, "-");
+
+    for (int c = 0; c < 2; ++c) {
+        double best = -1;
+        long base = 0, peak = 0;
+
+        for (int i = 0; i < BENCH_RUNS; ++i) {
+            if (ftruncate(fds[1], 0) != 0) {
+                perror(paths[1]);
+                status = 1;
+                break;
+            }
+
+            resetPeak();
+            base = peakKB();
+            start = now();
+
+            if (writePyramid(fds[0], fds[1], 0, &tileOpts[c], &error)) {
+                fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+                status = 1;
+                break;
+            }
+
+            if (best < 0 || now() - start < best)
+                best = now() - start, peak = peakKB() - base;
+        }
+
+        printf("%10s %10.2f %14ld\n", names[c], best * 1e3, peak);
+
+        for (uint32_t l = 0; l < count && status == 0; ++l) {
+            tiff_t tiff = readLevel(fds[1], l, &error);
+
+            if (tiff == NULL) {
+                fprintf(stderr, "level %u: %s: %X\n", l, tiffErrorF(error), error.data);
+                status = 1;
+            } else if (tiff->width != widths[l] || tiff->height != heights[l] ||
+                       memcmp(tiff->data, levels[l], (size_t) widths[l] * heights[l]) != 0) {
+                fprintf(stderr, "level %u differs from the one made in memory\n", l);
+                status = 1;
+            }
+
+            tiffFree(tiff);
+        }
+
+        /* no level past the last */
+        if (status == 0) {
+            tiff_t tiff = readLevel(fds[1], count, &error);
+
+            if (tiff != NULL || error.error != OUT_OF_RANGE) {
+                fprintf(stderr, "level %u should not exist\n", count);
+                tiffFree(tiff);
+                status = 1;
+            }
+        }
+    }
+
+    for (uint32_t l = 0; l < PYRAMID_BENCH_LEVELS; ++l)
+        free(levels[l]);
+
+    close(fds[0]);
+    close(fds[1]);
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    const char *mode = argc > 1 ? argv[1] : "all";
+    uint32_t a = argc > 2 ? atoi(argv[2]) : 0;
+    uint32_t b = argc > 3 ? atoi(argv[3]) : 0;
+    uint32_t c = argc > 4 ? atoi(argv[4]) : 0;
+    int status = 0;
+
+    if (strcmp(mode, "threads") == 0)
+        return benchThreads(a ? a : 8192, b ? b : 8192, c ? c : 64);
+
+    if (strcmp(mode, "unpack") == 0)
+        return benchUnpack(a ? a : 8189, b ? b : 4096);
+
+    if (strcmp(mode, "swap") == 0)
+        return benchSwap(a ? a : 16 << 20);
+
+    if (strcmp(mode, "stream") == 0)
+        return benchStream(a ? a : 16384, b ? b : 16384, c ? c : 64);
+
+    if (strcmp(mode, "codec") == 0)
+        return benchCodecs(16 << 20, argc - 2, argv + 2);
+
+    if (strcmp(mode, "fax") == 0)
+        return benchFax(1728, 2200, argc - 2, argv + 2);
+
+    if (strcmp(mode, "pages") == 0)
+        return benchPages(a ? a : 5000);
+
+    if (strcmp(mode, "packed") == 0)
+        return benchPacked(a ? a : 8192, b ? b : 8192, c ? c : 64);
+
+    if (strcmp(mode, "write") == 0)
+        return benchWrite(a ? a : 4960, b ? b : 7016, c);
+
+    if (strcmp(mode, "thumb") == 0)
+        return benchThumb(a ? a : 8192, b ? b : 8192, c ? c : 64);
+
+    if (strcmp(mode, "render") == 0)
+        return benchRender(a ? a : 4096, b ? b : 4096);
+
+    if (strcmp(mode, "corpus") == 0)
+        return benchCorpus(a ? a : 4096, argc > 3 ? argv[3] : NULL);
+
+    if (strcmp(mode, "predict") == 0)
+        return benchPredict(a ? a : 4096);
+
+    if (strcmp(mode, "cold") == 0)
+        return benchCold(a ? a : 4096);
+
+    if (strcmp(mode, "cache") == 0)
+        return benchCache(a ? a : 1024, b ? b : 64);
+
+    if (strcmp(mode, "histogram") == 0)
+        return benchHistogram(a ? a : 4096);
+
+    if (strcmp(mode, "bilevel") == 0)
+        return benchBilevel(a ? a : 4096);
+
+    if (strcmp(mode, "orient") == 0)
+        return benchOrient(a ? a : 4096);
+
+    if (strcmp(mode, "pyramid") == 0)
+        return benchPyramid(a ? a : 8192);
+
+    if (strcmp(mode, "all") != 0) {
+        printf("Usage: %s [threads|stream [width] [height] [rowsPerStrip] | unpack [width] [rows] | swap [samples] | "
+               "codec [file...] | fax [file...] | pages [count] | packed [width] [height] [rowsPerStrip] |\n"
+               "write [width] [height] [rowsPerStrip] | thumb [width] [height] [rowsPerStrip] |\n"
+               "render [width] [height] | corpus [side] [dir] | predict [side] | cold [side] |\n"
+               "cache [side] [files] | histogram [side] | bilevel [side] | orient [side] |\n"
+               "pyramid [side]]\n", argv[0]);
+        return 1;
+    }
+
+    status |= benchThreads(8192, 8192, 64);
+    status |= benchUnpack(8189, 4096);
+    status |= benchSwap(16 << 20);
+    status |= benchStream(16384, 16384, 64);
+    status |= benchCodecs(16 << 20, 0, NULL);
+    status |= benchFax(1728, 2200, 0, NULL);
+    status |= benchPages(5000);
+    status |= benchPacked(8192, 8192, 64);
+    status |= benchWrite(4960, 7016, 0);
+    status |= benchThumb(8192, 8192, 64);
+    status |= benchRender(4096, 4096);
+    status |= benchCorpus(1024, NULL);
+    status |= benchPredict(4096);
+    status |= benchCold(4096);
+    status |= benchCache(1024, 64);
+    status |= benchHistogram(4096);
+    status |= benchBilevel(4096);
+    status |= benchOrient(4096);
+    status |= benchPyramid(8192);
+    return status;
+}
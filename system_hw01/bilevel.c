@@ -0,0 +1,421 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include "bilevel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/* rows a thresholding worker takes at once */
+#define THRESHOLD_BAND 64
+
+/* pixels of a row dithered between two looks at how far the row above has got */
+#define DITHER_CHUNK 256
+
+/* rows bilevelWrite converts before handing them to the writer */
+#define WRITE_BAND 256
+
+static thresholdFn kernel;
+static const char *kernelName;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+void thresholdRowScalar(const uint8_t *row, uint32_t width, uint8_t threshold, uint8_t *packed) {
+    size_t bytes = width / 8;
+
+    for (size_t i = 0; i < bytes; ++i) {
+        uint8_t b = 0;
+
+        for (int k = 0; k < 8; ++k)
+            b = b << 1 | (row[8 * i + k] < threshold);
+
+        packed[i] = b;
+    }
+
+    if (width % 8 != 0) {
+        uint8_t b = 0;
+
+        for (uint32_t k = 0; k < width % 8; ++k)
+            b |= (row[8 * bytes + k] < threshold) << (7 - k);
+
+        packed[bytes] = b;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+ * a vector of pixels at a time: flipping the top bit turns the unsigned compare into a signed one, and
+ * the bytes of every group of 8 are reversed so that movemask puts the first pixel in the top bit.
+ */
+__attribute__((target("ssse3")))
+void thresholdRowSSSE3(const uint8_t *row, uint32_t width, uint8_t threshold, uint8_t *packed) {
+    const __m128i flip = _mm_set1_epi8((char) 0x80);
+    const __m128i limit = _mm_set1_epi8((char) (threshold ^ 0x80));
+    const __m128i reverse = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    uint32_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (row + x)), flip);
+        uint16_t bits = _mm_movemask_epi8(_mm_shuffle_epi8(_mm_cmpgt_epi8(limit, v), reverse));
+
+        memcpy(packed + x / 8, &bits, sizeof(bits));
+    }
+
+    thresholdRowScalar(row + x, width - x, threshold, packed + x / 8);
+}
+
+__attribute__((target("avx2")))
+void thresholdRowAVX2(const uint8_t *row, uint32_t width, uint8_t threshold, uint8_t *packed) {
+    const __m256i flip = _mm256_set1_epi8((char) 0x80);
+    const __m256i limit = _mm256_set1_epi8((char) (threshold ^ 0x80));
+    const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                             7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    uint32_t x = 0;
+
+    for (; x + 32 <= width; x += 32) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (row + x)), flip);
+        uint32_t bits = _mm256_movemask_epi8(_mm256_shuffle_epi8(_mm256_cmpgt_epi8(limit, v), reverse));
+
+        memcpy(packed + x / 8, &bits, sizeof(bits));
+    }
+
+    /* the sse kernel finishes the row, its legacy encoded instructions would stall on dirty upper halves */
+    _mm256_zeroupper();
+    thresholdRowSSSE3(row + x, width - x, threshold, packed + x / 8);
+}
+
+#endif
+
+static void pickKernel(void) {
+    kernel = thresholdRowScalar;
+    kernelName = "scalar";
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = thresholdRowAVX2;
+        kernelName = "avx2";
+    } else if (__builtin_cpu_supports("ssse3")) {
+        kernel = thresholdRowSSSE3;
+        kernelName = "ssse3";
+    }
+#endif
+}
+
+void thresholdRow(const uint8_t *row, uint32_t width, uint8_t threshold, uint8_t *packed) {
+    pthread_once(&once, pickKernel);
+    kernel(row, width, threshold, packed);
+}
+
+const char *thresholdKernelName(void) {
+    pthread_once(&once, pickKernel);
+    return kernelName;
+}
+
+uint8_t bilevelOtsu(const struct tiffHistogram *histogram) {
+    double sum = 0, sumBelow = 0, best = 0;
+    uint64_t below = 0;
+    uint8_t threshold = 128;
+
+    for (int v = 0; v < 256; ++v)
+        sum += (double) v * histogram->bins[v];
+
+    /* levels up to k against the ones above, an image of one level keeps the middle gray */
+    for (int k = 0; k < 255; ++k) {
+        uint64_t above;
+        double diff, between;
+
+        below += histogram->bins[k];
+        sumBelow += (double) k * histogram->bins[k];
+        above = histogram->pixels - below;
+
+        if (below == 0 || above == 0)
+            continue;
+
+        diff = sumBelow / below - (sum - sumBelow) / above;
+        between = (double) below * above * diff * diff;
+
+        if (between > best) {
+            best = between;
+            threshold = k + 1;
+        }
+    }
+
+    return threshold;
+}
+
+/* the rows of one conversion, shared by its workers */
+struct convertJob {
+    tiff_t gray;
+    enum bilevelMethod method;
+    uint8_t threshold;
+    unsigned threads;
+    /* the rows being converted, to packed rows stride bytes apart at dst */
+    uint32_t first;
+    uint32_t count;
+    uint8_t *dst;
+    size_t stride;
+    atomic_uint next;
+    /*
+     * dithering keeps a row of errors for each of slots rows in a ring, every row reads the errors the row
+     * above left it and writes those of the row below. progress holds the row last started in a slot in
+     * its top half and the pixels it has done in the bottom one, width + 1 once its errors are all written.
+     */
+    uint32_t slots;
+    int32_t *errors;
+    atomic_uint_fast64_t *progress;
+};
+
+static void jobFree(struct convertJob *job) {
+    free(job->errors);
+    free(job->progress);
+}
+
+static void *thresholdWorker(void *arg) {
+    struct convertJob *job = arg;
+    uint32_t band;
+
+    while ((band = atomic_fetch_add(&job->next, 1)) < (job->count + THRESHOLD_BAND - 1) / THRESHOLD_BAND) {
+        uint32_t first = band * THRESHOLD_BAND;
+        uint32_t rows = job->count - first < THRESHOLD_BAND ? job->count - first : THRESHOLD_BAND;
+
+        for (uint32_t r = first; r < first + rows; ++r)
+            thresholdRow(tiffRow(job->gray, job->first + r), job->gray->width, job->threshold,
+                         job->dst + (size_t) r * job->stride);
+    }
+
+    return NULL;
+}
+
+static void waitFor(atomic_uint_fast64_t *progress, uint64_t value) {
+    while (atomic_load_explicit(progress, memory_order_acquire) < value)
+        sched_yield();
+}
+
+/*
+ * floyd-steinberg over row y, left to right, in sixteenths: 7 of the error of a pixel go right and 3, 5
+ * and 1 to the pixels below left, below and below right. a pixel takes everything the row above gives it
+ * once the row above is two pixels past it, so rows run as a wavefront, each a chunk behind the one above.
+ */
+static void ditherRow(struct convertJob *job, uint32_t y) {
+    uint32_t width = job->gray->width;
+    uint32_t slot = y % job->slots;
+    const uint8_t *row = tiffRow(job->gray, y);
+    const int32_t *in = job->errors + (size_t) slot * width;
+    int32_t *out = job->errors + (size_t) ((y + 1) % job->slots) * width;
+    atomic_uint_fast64_t *above = &job->progress[(y + job->slots - 1) % job->slots];
+    uint8_t *dst = job->dst + (size_t) (y - job->first) * job->stride;
+    /* what the pixel to the right and the ones below left and below have been given so far */
+    int32_t right = 0, belowLeft = 0, below = 0;
+    /* the pixels of the byte being filled, so that no pixel branches on its colour */
+    uint32_t bits = 0;
+
+    /* the first row has no row above it to wait for, and nothing passed down */
+    if (y == 0)
+        memset(job->errors + (size_t) slot * width, 0, sizeof(int32_t) * width);
+
+    atomic_store_explicit(&job->progress[slot], (uint64_t) y << 32, memory_order_release);
+
+    for (uint32_t x0 = 0; x0 < width; x0 += DITHER_CHUNK) {
+        uint32_t x1 = width - x0 < DITHER_CHUNK ? width : x0 + DITHER_CHUNK;
+
+        if (y != 0)
+            waitFor(above, (uint64_t) (y - 1) << 32 | (x1 + 1));
+
+        for (uint32_t x = x0; x < x1; ++x) {
+            int32_t v = row[x] + ((in[x] + right + 8) >> 4);
+            int32_t black = v < job->threshold;
+            int32_t e = v - 255 + 255 * black;
+
+            bits = bits << 1 | black;
+            if (x % 8 == 7)
+                dst[x / 8] = bits, bits = 0;
+
+            /* the pixel below left has had everything once its right neighbour is done */
+            right = 7 * e;
+            belowLeft += 3 * e;
+            if (x != 0)
+                out[x - 1] = belowLeft;
+            belowLeft = below + 5 * e;
+            below = e;
+        }
+
+        atomic_store_explicit(&job->progress[slot], (uint64_t) y << 32 | x1, memory_order_release);
+    }
+
+    if (width % 8 != 0)
+        dst[width / 8] = bits << (8 - width % 8);
+
+    out[width - 1] = belowLeft;
+    atomic_store_explicit(&job->progress[slot], (uint64_t) y << 32 | (width + 1), memory_order_release);
+}
+
+/* rows are taken in order, and every row only waits on the one above, so the rows in flight never outnumber the slots */
+static void *ditherWorker(void *arg) {
+    struct convertJob *job = arg;
+    uint32_t r;
+
+    while ((r = atomic_fetch_add(&job->next, 1)) < job->count)
+        ditherRow(job, job->first + r);
+
+    return NULL;
+}
+
+/* runs worker on the calling thread and threads - 1 more */
+static void runWorkers(struct convertJob *job, unsigned threads, void *(*worker)(void *)) {
+    pthread_t *workers;
+    unsigned started = 0;
+
+    workers = threads > 1 ? malloc(sizeof(pthread_t) * (threads - 1)) : NULL;
+
+    if (workers != NULL) {
+        for (; started < threads - 1; ++started) {
+            if (pthread_create(&workers[started], NULL, worker, job) != 0)
+                break;
+        }
+    }
+
+    worker(job);
+
+    for (unsigned i = 0; i < started; ++i)
+        pthread_join(workers[i], NULL);
+
+    free(workers);
+}
+
+static bool prepareJob(struct convertJob *job, tiff_t gray, const struct bilevelOptions *const opts,
+                       struct tiffError *const err) {
+    struct tiffHistogram histogram;
+
+    if (gray->format != GRAY8) {
+        err->data = pixelBits(gray->format);
+        err->error = UNSUPPORTED_SAMPLE_SIZE;
+        return true;
+    }
+
+    job->gray = gray;
+    job->method = opts != NULL ? opts->method : BILEVEL_THRESHOLD;
+    job->threshold = opts != NULL && opts->threshold != 0 ? opts->threshold : 128;
+    job->threads = opts != NULL && opts->threads > 1 ? opts->threads : 1;
+
+    if (job->method == BILEVEL_OTSU) {
+        if (opts->histogram == NULL)
+            tiffMeasure(gray, &histogram);
+
+        job->threshold = bilevelOtsu(opts->histogram != NULL ? opts->histogram : &histogram);
+    }
+
+    if (job->method != BILEVEL_DITHER || gray->width == 0)
+        return false;
+
+    /* a ring one row longer than the rows in flight, so that no row writes the errors one still reads */
+    job->slots = job->threads + 1;
+    job->errors = malloc(sizeof(int32_t) * job->slots * gray->width);
+    job->progress = calloc(job->slots, sizeof(atomic_uint_fast64_t));
+
+    if (job->errors == NULL || job->progress == NULL) {
+        err->error = MALLOC_ERROR;
+        return true;
+    }
+
+    return false;
+}
+
+/* converts count rows from row first on to dst, the rows of a dither must follow the ones converted before */
+static void convertRows(struct convertJob *job, uint32_t first, uint32_t count, uint8_t *dst) {
+    bool dither = job->method == BILEVEL_DITHER;
+    uint32_t units = dither ? count : (count + THRESHOLD_BAND - 1) / THRESHOLD_BAND;
+
+    if (job->gray->width == 0)
+        return;
+
+    job->first = first;
+    job->count = count;
+    job->dst = dst;
+    atomic_store(&job->next, 0);
+
+    runWorkers(job, job->threads < units ? job->threads : units, dither ? ditherWorker : thresholdWorker);
+}
+
+tiff_t const bilevelImage(tiff_t gray, const struct bilevelOptions *const opts, struct tiffError *const err) {
+    struct convertJob job __attribute__((__cleanup__(jobFree))) = {0};
+    tiff_t tiff;
+
+    if (prepareJob(&job, gray, opts, err))
+        return NULL;
+
+    tiff = malloc(sizeof(struct tiff));
+
+    if (tiff == NULL) {
+        err->error = MALLOC_ERROR;
+        return NULL;
+    }
+
+    tiff->byteOrder = gray->byteOrder;
+    tiff->width = gray->width;
+    tiff->height = gray->height;
+    tiff->format = PACKED1;
+    tiff->stride = (gray->width + 7) / 8;
+    tiff->capacity = tiff->stride * tiff->height;
+    tiff->data = malloc(tiff->capacity ? tiff->capacity : 1);
+    tiff->map = NULL;
+    tiff->mapSize = 0;
+    atomic_init(&tiff->refs, 1);
+
+    if (tiff->data == NULL) {
+        free(tiff);
+        err->error = MALLOC_ERROR;
+        return NULL;
+    }
+
+    job.stride = tiff->stride;
+    convertRows(&job, 0, gray->height, tiff->data);
+    return tiff;
+}
+
+bool bilevelWrite(int fd, tiff_t gray, const struct bilevelOptions *const opts,
+                  const struct tiffWriteOptions *const writeOpts, struct tiffError *const err) {
+    struct convertJob job __attribute__((__cleanup__(jobFree))) = {0};
+    uint8_t *band;
+    tiffWriter_t writer;
+
+    if (prepareJob(&job, gray, opts, err))
+        return true;
+
+    job.stride = (gray->width + 7) / 8;
+    band = malloc(job.stride * WRITE_BAND + 1);
+
+    if (band == NULL) {
+        err->error = MALLOC_ERROR;
+        return true;
+    }
+
+    writer = writerOpen(fd, gray->width, gray->height, PACKED1, writeOpts, err);
+
+    if (writer == NULL) {
+        free(band);
+        return true;
+    }
+
+    /* only a band of packed rows is ever held, the writer takes each as soon as it is converted */
+    for (uint32_t y = 0; y < gray->height; y += WRITE_BAND) {
+        uint32_t count = gray->height - y < WRITE_BAND ? gray->height - y : WRITE_BAND;
+
+        convertRows(&job, y, count, band);
+
+        if (writerRows(writer, band, count, err)) {
+            writerAbort(writer);
+            free(band);
+            return true;
+        }
+    }
+
+    free(band);
+    return writerClose(writer, err);
+}
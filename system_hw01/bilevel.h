@@ -0,0 +1,62 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include "tiff.h"
+
+#ifndef SYSTEM_HW01_BILEVEL_H
+#define SYSTEM_HW01_BILEVEL_H
+
+/* how gray levels become black and white */
+enum bilevelMethod {
+    /* levels below the threshold are black */
+    BILEVEL_THRESHOLD,
+    /* a threshold picked from the histogram by otsu's method */
+    BILEVEL_OTSU,
+    /* floyd-steinberg error diffusion around the threshold */
+    BILEVEL_DITHER
+};
+
+struct bilevelOptions {
+    enum bilevelMethod method;
+    /* 0 is the middle gray, 128. otsu picks its own */
+    uint8_t threshold;
+    /* rows are converted on this many threads, 0 or 1 converts serially. dithering them gives the same pixels */
+    unsigned threads;
+    /* the histogram of the image, counted while it was decoded, spares otsu a pass over it. may be NULL */
+    const struct tiffHistogram *histogram;
+};
+
+/*
+ * thresholds one row of 8 bit gray to packed bits, a set bit for every level below threshold, most
+ * significant bit first and the padding clear.
+ */
+typedef void (*thresholdFn)(const uint8_t *row, uint32_t width, uint8_t threshold, uint8_t *packed);
+
+void thresholdRowScalar(const uint8_t *row, uint32_t width, uint8_t threshold, uint8_t *packed);
+
+#if defined(__x86_64__) || defined(__i386__)
+
+void thresholdRowSSSE3(const uint8_t *row, uint32_t width, uint8_t threshold, uint8_t *packed);
+
+void thresholdRowAVX2(const uint8_t *row, uint32_t width, uint8_t threshold, uint8_t *packed);
+
+#endif
+
+/* the fastest kernel the running cpu supports, picked on first use */
+void thresholdRow(const uint8_t *row, uint32_t width, uint8_t threshold, uint8_t *packed);
+
+const char *thresholdKernelName(void);
+
+/* the threshold otsu's method picks, the one that best separates the levels below it from the rest */
+uint8_t bilevelOtsu(const struct tiffHistogram *histogram);
+
+/* converts a GRAY8 image to a new PACKED1 one */
+tiff_t const bilevelImage(tiff_t gray, const struct bilevelOptions *const opts, struct tiffError *const err)
+__attribute__((warn_unused_result));
+
+/* converts a GRAY8 image a band of rows at a time straight into a 1 bit tiff written to fd, see writerOpen */
+bool bilevelWrite(int fd, tiff_t gray, const struct bilevelOptions *const opts,
+                  const struct tiffWriteOptions *const writeOpts, struct tiffError *const err);
+
+#endif //SYSTEM_HW01_BILEVEL_H
@@ -0,0 +1,80 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <string.h>
+#include <endian.h>
+#include "bits.h"
+
+/* the bits of the last byte of a row that are pixels */
+static uint8_t tailMask(uint32_t width) {
+    return width % 8 == 0 ? 0xFF : (uint8_t) (0xFF << (8 - width % 8));
+}
+
+void bitsClearPadding(uint8_t *row, uint32_t width) {
+    if (width % 8 != 0)
+        row[width / 8] &= tailMask(width);
+}
+
+void bitsInvert(uint8_t *row, uint32_t width) {
+    size_t bytes = (width + 7) / 8;
+    size_t i = 0;
+
+    for (; i + 8 <= bytes; i += 8) {
+        uint64_t w;
+        memcpy(&w, row + i, sizeof(w));
+        w = ~w;
+        memcpy(row + i, &w, sizeof(w));
+    }
+
+    for (; i < bytes; ++i)
+        row[i] = ~row[i];
+
+    bitsClearPadding(row, width);
+}
+
+uint64_t bitsCount(const uint8_t *row, uint32_t width) {
+    size_t bytes = width / 8;
+    uint64_t count = 0;
+    size_t i = 0;
+
+    for (; i + 8 <= bytes; i += 8) {
+        uint64_t w;
+        memcpy(&w, row + i, sizeof(w));
+        count += __builtin_popcountll(w);
+    }
+
+    for (; i < bytes; ++i)
+        count += __builtin_popcount(row[i]);
+
+    if (width % 8 != 0)
+        count += __builtin_popcount(row[bytes] & tailMask(width));
+
+    return count;
+}
+
+uint32_t bitsCompare(const uint8_t *a, const uint8_t *b, uint32_t width) {
+    size_t bytes = (width + 7) / 8;
+    size_t i = 0;
+
+    /* words are loaded big endian so that the leading zeros of the xor count the equal pixels */
+    for (; i + 8 <= bytes; i += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+
+        if (x != y) {
+            uint64_t first = 8 * i + __builtin_clzll(be64toh(x) ^ be64toh(y));
+            return first < width ? (uint32_t) first : width;
+        }
+    }
+
+    for (; i < bytes; ++i) {
+        uint8_t d = (a[i] ^ b[i]) & (i == bytes - 1 ? tailMask(width) : 0xFF);
+
+        if (d != 0)
+            return 8 * i + __builtin_clz(d) - 24;
+    }
+
+    return width;
+}
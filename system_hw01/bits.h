@@ -0,0 +1,25 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef SYSTEM_HW01_BITS_H
+#define SYSTEM_HW01_BITS_H
+
+/*
+ * operations on packed 1 bit rows, most significant bit first, working on 64 bit words.
+ * width is the number of pixels in the row; the padding bits of its last byte are kept clear.
+ */
+
+void bitsClearPadding(uint8_t *row, uint32_t width);
+
+void bitsInvert(uint8_t *row, uint32_t width);
+
+uint64_t bitsCount(const uint8_t *row, uint32_t width);
+
+/* the first pixel at which the rows differ, or width when they are equal */
+uint32_t bitsCompare(const uint8_t *a, const uint8_t *b, uint32_t width);
+
+#endif //SYSTEM_HW01_BITS_H
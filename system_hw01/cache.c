@@ -0,0 +1,299 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <string.h>
+#include <pthread.h>
+#include "cache.h"
+
+/* buckets of the hash table to begin with, doubled whenever the entries outnumber them */
+#define CACHE_BUCKETS 256
+
+struct cacheKey {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+    bool packed;
+    unsigned scale;
+    bool orient;
+};
+
+struct cacheEntry {
+    struct cacheKey key;
+    tiff_t tiff;
+    size_t bytes;
+    /* the least recently used list, the most recent at its head */
+    struct cacheEntry *newer;
+    struct cacheEntry *older;
+    /* the next entry of the same bucket, every version and variant of a file shares one */
+    struct cacheEntry *chain;
+};
+
+/* everything below is guarded by lock, the images themselves are only ever read */
+static struct {
+    pthread_mutex_t lock;
+    size_t budget;
+    struct cacheEntry **buckets;
+    uint32_t bucketCount;
+    struct cacheEntry *newest;
+    struct cacheEntry *oldest;
+    struct cacheStats stats;
+} cache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static uint32_t hashFile(dev_t dev, ino_t ino) {
+    uint64_t h = (uint64_t) dev * 0x9E3779B97F4A7C15u ^ (uint64_t) ino;
+
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9u;
+    return (uint32_t) (h ^ h >> 32);
+}
+
+static struct cacheEntry **bucketOf(dev_t dev, ino_t ino) {
+    return &cache.buckets[hashFile(dev, ino) & (cache.bucketCount - 1)];
+}
+
+static bool sameVersion(const struct cacheKey *a, const struct cacheKey *b) {
+    return a->mtime.tv_sec == b->mtime.tv_sec && a->mtime.tv_nsec == b->mtime.tv_nsec && a->size == b->size;
+}
+
+static void unlinkEntry(struct cacheEntry *entry) {
+    struct cacheEntry **p = bucketOf(entry->key.dev, entry->key.ino);
+
+    while (*p != entry)
+        p = &(*p)->chain;
+    *p = entry->chain;
+
+    if (entry->newer != NULL)
+        entry->newer->older = entry->older;
+    else
+        cache.newest = entry->older;
+
+    if (entry->older != NULL)
+        entry->older->newer = entry->newer;
+    else
+        cache.oldest = entry->newer;
+
+    cache.stats.bytes -= entry->bytes;
+    --cache.stats.entries;
+}
+
+/* the image lives on while callers still hold references to it */
+static void dropEntry(struct cacheEntry *entry) {
+    unlinkEntry(entry);
+    tiffFree(entry->tiff);
+    free(entry);
+}
+
+static void makeNewest(struct cacheEntry *entry) {
+    entry->newer = NULL;
+    entry->older = cache.newest;
+
+    if (cache.newest != NULL)
+        cache.newest->newer = entry;
+    else
+        cache.oldest = entry;
+
+    cache.newest = entry;
+}
+
+static void touch(struct cacheEntry *entry) {
+    if (entry == cache.newest)
+        return;
+
+    /* out of the list, and back in at its head */
+    entry->newer->older = entry->older;
+    if (entry->older != NULL)
+        entry->older->newer = entry->newer;
+    else
+        cache.oldest = entry->newer;
+
+    makeNewest(entry);
+}
+
+/* the entry of key, dropping the ones of older versions of its file on the way */
+static struct cacheEntry *findEntry(const struct cacheKey *key) {
+    struct cacheEntry *entry, *next;
+
+    if (cache.buckets == NULL)
+        return NULL;
+
+    for (entry = *bucketOf(key->dev, key->ino); entry != NULL; entry = next) {
+        next = entry->chain;
+
+        if (entry->key.dev != key->dev || entry->key.ino != key->ino)
+            continue;
+
+        if (!sameVersion(&entry->key, key)) {
+            dropEntry(entry);
+            ++cache.stats.stale;
+            continue;
+        }
+
+        if (entry->key.packed == key->packed && entry->key.scale == key->scale &&
+            entry->key.orient == key->orient)
+            return entry;
+    }
+
+    return NULL;
+}
+
+/* doubles the buckets once the entries outnumber them, true when there is no memory for the first ones */
+static bool growBuckets(void) {
+    uint32_t count = cache.bucketCount ? 2 * cache.bucketCount : CACHE_BUCKETS;
+    struct cacheEntry **old = cache.buckets;
+    uint32_t oldCount = cache.bucketCount;
+    struct cacheEntry **buckets;
+
+    if (cache.buckets != NULL && cache.stats.entries < cache.bucketCount)
+        return false;
+
+    /* a table that cannot grow just gets longer chains */
+    if ((buckets = calloc(count, sizeof(struct cacheEntry *))) == NULL)
+        return cache.buckets == NULL;
+
+    cache.buckets = buckets;
+    cache.bucketCount = count;
+
+    for (uint32_t i = 0; i < oldCount; ++i) {
+        struct cacheEntry *entry, *next;
+
+        for (entry = old[i]; entry != NULL; entry = next) {
+            struct cacheEntry **bucket = bucketOf(entry->key.dev, entry->key.ino);
+
+            next = entry->chain;
+            entry->chain = *bucket;
+            *bucket = entry;
+        }
+    }
+
+    free(old);
+    return false;
+}
+
+static void evict(void) {
+    while (cache.stats.bytes > cache.budget && cache.oldest != NULL) {
+        dropEntry(cache.oldest);
+        ++cache.stats.evictions;
+    }
+}
+
+static void dropAll(void) {
+    while (cache.oldest != NULL)
+        dropEntry(cache.oldest);
+}
+
+void cacheSetBudget(size_t budget) {
+    pthread_mutex_lock(&cache.lock);
+    cache.budget = budget;
+    evict();
+    pthread_mutex_unlock(&cache.lock);
+}
+
+/* the entry of key if there is one, with a reference for the caller */
+static tiff_t lookup(const struct cacheKey *key) {
+    struct cacheEntry *entry = findEntry(key);
+
+    if (entry == NULL)
+        return NULL;
+
+    touch(entry);
+    tiffRetain(entry->tiff);
+    return entry->tiff;
+}
+
+tiff_t cacheReadFD(int fd, const struct tiffOptions *const opts, struct tiffError *const err) {
+    struct cacheKey key = {0};
+    struct cacheEntry *entry, **bucket;
+    struct stat st;
+    tiff_t tiff, other;
+
+    if (fstat(fd, &st) != 0) {
+        err->data = fd;
+        err->error = READ_ERROR;
+        return NULL;
+    }
+
+    key.dev = st.st_dev;
+    key.ino = st.st_ino;
+    key.mtime = st.st_mtim;
+    key.size = st.st_size;
+    key.packed = opts != NULL && opts->packed;
+    key.scale = opts != NULL && opts->scale > 1 ? opts->scale : 1;
+    key.orient = opts != NULL && opts->orient;
+
+    pthread_mutex_lock(&cache.lock);
+
+    if ((tiff = lookup(&key)) != NULL) {
+        ++cache.stats.hits;
+        pthread_mutex_unlock(&cache.lock);
+
+        /* a hit reads nothing, and there was no decode to count the pixels while it wrote them */
+        if (opts != NULL && opts->stats != NULL)
+            memset(opts->stats, 0, sizeof(*opts->stats));
+
+        if (opts != NULL && opts->histogram != NULL)
+            tiffMeasure(tiff, opts->histogram);
+
+        return tiff;
+    }
+
+    ++cache.stats.misses;
+    pthread_mutex_unlock(&cache.lock);
+
+    /* decoded without the lock, so that misses on other files go on in parallel */
+    tiff = readFDOptions(fd, opts, err);
+
+    if (tiff == NULL || (entry = malloc(sizeof(struct cacheEntry))) == NULL)
+        return tiff;
+
+    entry->key = key;
+    entry->tiff = tiff;
+    entry->bytes = sizeof(struct tiff) + tiff->capacity;
+
+    pthread_mutex_lock(&cache.lock);
+
+    /* another thread may have decoded the same file meanwhile, its image is kept */
+    other = lookup(&key);
+
+    if (other != NULL || entry->bytes > cache.budget || growBuckets()) {
+        pthread_mutex_unlock(&cache.lock);
+        free(entry);
+
+        if (other == NULL)
+            return tiff;
+
+        tiffFree(tiff);
+        return other;
+    }
+
+    /* one reference for the cache and one for the caller */
+    tiffRetain(tiff);
+    bucket = bucketOf(key.dev, key.ino);
+    entry->chain = *bucket;
+    *bucket = entry;
+    makeNewest(entry);
+    cache.stats.bytes += entry->bytes;
+    ++cache.stats.entries;
+    evict();
+
+    pthread_mutex_unlock(&cache.lock);
+    return tiff;
+}
+
+void cacheGetStats(struct cacheStats *stats) {
+    pthread_mutex_lock(&cache.lock);
+    *stats = cache.stats;
+    stats->budget = cache.budget;
+    pthread_mutex_unlock(&cache.lock);
+}
+
+void cacheClear(void) {
+    pthread_mutex_lock(&cache.lock);
+    dropAll();
+    free(cache.buckets);
+    cache.buckets = NULL;
+    cache.bucketCount = 0;
+    memset(&cache.stats, 0, sizeof(cache.stats));
+    pthread_mutex_unlock(&cache.lock);
+}
@@ -0,0 +1,44 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include "tiff.h"
+
+#ifndef SYSTEM_HW01_CACHE_H
+#define SYSTEM_HW01_CACHE_H
+
+/* counters of the process wide image cache since it was last cleared */
+struct cacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    /* images dropped to stay inside the budget */
+    uint64_t evictions;
+    /* images dropped because their file changed on disk */
+    uint64_t stale;
+    uint32_t entries;
+    size_t bytes;
+    size_t budget;
+};
+
+/*
+ * sets the bytes of decoded images the cache may hold, evicting the least recently used ones until it
+ * fits. 0, the default, turns caching off and empties it.
+ */
+void cacheSetBudget(size_t budget);
+
+/*
+ * readFDOptions through a cache shared by every thread. images are keyed by the device, inode,
+ * modification time and size of the file and by the packed, scale and orient options, so a file that
+ * changed on disk is decoded again. the image returned is shared: it must not be changed, and every
+ * reference is released with tiffFree. two threads missing on the same file at once both decode it,
+ * the second image is dropped for the first.
+ */
+tiff_t cacheReadFD(int fd, const struct tiffOptions *const opts, struct tiffError *const err)
+__attribute__((warn_unused_result));
+
+void cacheGetStats(struct cacheStats *stats);
+
+/* drops every image and resets the counters, images still referenced stay alive until released */
+void cacheClear(void);
+
+#endif //SYSTEM_HW01_CACHE_H
@@ -0,0 +1,189 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <string.h>
+#include "compress.h"
+#include "tiff.h"
+#include "fax.h"
+
+#define LZW_CLEAR 256
+#define LZW_EOI 257
+#define LZW_FIRST 258
+#define LZW_MAX_CODES 4096
+
+static bool copyDecode(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize,
+                       const struct codecParams *params) {
+    size_t n = srcSize < dstSize ? srcSize : dstSize;
+
+    memcpy(dst, src, n);
+    memset(dst + n, 0, dstSize - n);
+    return false;
+}
+
+static const struct codec codecs[] = {
+        {NO_COMPRESSION, "none",     copyDecode},
+        {CCITT_RLE,      "ccittrle", ccittRleDecode},
+        {CCITT_T4,       "g3",       ccittT4Decode},
+        {CCITT_T6,       "g4",       ccittT6Decode},
+        {LZW,            "lzw",      lzwDecode},
+        {PACKBITS,       "packbits", packBitsDecode},
+};
+
+const struct codec *findCodec(uint16_t compression) {
+    for (size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); ++i) {
+        if (codecs[i].compression == compression)
+            return &codecs[i];
+    }
+
+    return NULL;
+}
+
+bool packBitsDecode(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize,
+                    const struct codecParams *params) {
+    const uint8_t *end = src + srcSize;
+    size_t out = 0;
+
+    while (src < end && out < dstSize) {
+        int8_t n = (int8_t) *src++;
+
+        if (n >= 0) {
+            size_t count = (size_t) n + 1;
+
+            if (count > (size_t) (end - src) || count > dstSize - out)
+                return true;
+
+            memcpy(dst + out, src, count);
+            src += count;
+            out += count;
+        } else if (n != -128) {
+            size_t count = (size_t) 1 - n;
+
+            if (src == end || count > dstSize - out)
+                return true;
+
+            memset(dst + out, *src++, count);
+            out += count;
+        }
+    }
+
+    memset(dst + out, 0, dstSize - out);
+    return false;
+}
+
+/*
+ * every code is kept as the offset and length of its string in the output, since a new code is the
+ * previous string followed by the first byte written after it. nothing is allocated per code, and
+ * strings are copied straight out of dst.
+ */
+bool lzwDecode(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize, const struct codecParams *params) {
+    uint32_t offsets[LZW_MAX_CODES];
+    uint32_t lengths[LZW_MAX_CODES];
+    uint32_t next = LZW_FIRST;
+    uint32_t width = 9;
+    uint32_t previous = LZW_CLEAR;
+    uint32_t bits = 0;
+    uint32_t held = 0;
+    size_t in = 0;
+    size_t out = 0;
+
+    /* the old, lsb first variant starts with a clear code written backwards */
+    if (srcSize >= 2 && src[0] == 0x00 && (src[1] & 0x01))
+        return true;
+
+    while (out < dstSize) {
+        uint32_t code;
+        size_t start = out;
+
+        while (held < width) {
+            if (in == srcSize)
+                goto done;
+            bits = bits << 8 | src[in++];
+            held += 8;
+        }
+
+        held -= width;
+        code = bits >> held & ((1u << width) - 1);
+
+        if (code == LZW_EOI)
+            break;
+
+        if (code == LZW_CLEAR) {
+            next = LZW_FIRST;
+            width = 9;
+            previous = LZW_CLEAR;
+            continue;
+        }
+
+        if (code < 256) {
+            dst[out++] = (uint8_t) code;
+        } else if (code < next && previous != LZW_CLEAR) {
+            size_t n = lengths[code] < dstSize - out ? lengths[code] : dstSize - out;
+
+            memcpy(dst + out, dst + offsets[code], n);
+            out += n;
+        } else if (code == next && previous != LZW_CLEAR) {
+            /* the string being defined by this very code: previous string plus its own first byte */
+            uint32_t length = previous < 256 ? 1 : lengths[previous];
+            uint32_t from = previous < 256 ? (uint32_t) (start - 1) : offsets[previous];
+            size_t n = length + 1 < dstSize - out ? length + 1 : dstSize - out;
+
+            for (size_t i = 0; i < n; ++i)
+                dst[out + i] = i < length ? dst[from + i] : dst[from];
+            out += n;
+        } else {
+            return true;
+        }
+
+        if (previous != LZW_CLEAR && next < LZW_MAX_CODES) {
+            uint32_t length = previous < 256 ? 1 : lengths[previous];
+
+            offsets[next] = (uint32_t) (start - length);
+            lengths[next] = length + 1;
+            ++next;
+        }
+
+        /* tiff switches to wider codes one code early */
+        if (next + 1 >= 1u << width && width < 12)
+            ++width;
+
+        previous = code;
+    }
+
+done:
+    memset(dst + out, 0, dstSize - out);
+    return false;
+}
+
+size_t packBitsEncode(const uint8_t *src, size_t srcSize, uint8_t *dst) {
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < srcSize) {
+        size_t run = 1;
+
+        while (in + run < srcSize && run < 128 && src[in + run] == src[in])
+            ++run;
+
+        if (run > 1) {
+            dst[out++] = (uint8_t) (1 - (int) run);
+            dst[out++] = src[in];
+            in += run;
+            continue;
+        }
+
+        /* a literal stops where a run of three starts, shorter runs are cheaper inline */
+        run = 1;
+        while (in + run < srcSize && run < 128 &&
+               !(in + run + 2 < srcSize && src[in + run] == src[in + run + 1] &&
+                 src[in + run] == src[in + run + 2]))
+            ++run;
+
+        dst[out++] = (uint8_t) (run - 1);
+        memcpy(dst + out, src + in, run);
+        out += run;
+        in += run;
+    }
+
+    return out;
+}
@@ -0,0 +1,43 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifndef SYSTEM_HW01_COMPRESS_H
+#define SYSTEM_HW01_COMPRESS_H
+
+/* what a decoder may need to know about the block beyond its bytes */
+struct codecParams {
+    uint32_t width;
+    uint16_t fillOrder;
+    uint32_t t4Options;
+};
+
+/*
+ * decodes srcSize bytes of one strip or tile into exactly dstSize bytes, returns true on a malformed
+ * stream. output the stream does not cover is zero filled.
+ */
+typedef bool (*decodeFn)(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize,
+                         const struct codecParams *params);
+
+struct codec {
+    uint16_t compression;
+    const char *name;
+    decodeFn decode;
+};
+
+/* NULL for compressions without a decoder */
+const struct codec *findCodec(uint16_t compression);
+
+bool packBitsDecode(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize,
+                    const struct codecParams *params);
+
+bool lzwDecode(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize, const struct codecParams *params);
+
+/* worst case output is srcSize + srcSize / 128 + 1 bytes, returns the bytes written */
+size_t packBitsEncode(const uint8_t *src, size_t srcSize, uint8_t *dst);
+
+#endif //SYSTEM_HW01_COMPRESS_H
@@ -0,0 +1,16 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <stdio.h>
+
+#ifndef SYSTEM_HW01_DEBUG_H
+#define SYSTEM_HW01_DEBUG_H
+
+#ifdef DEBUG
+#define DERROR(fmt, args...) fprintf(stderr, "DEBUG: %s:%d:%s(): " fmt, __FILE__, __LINE__, __func__, ##args)
+#else
+#define DERROR(fmt, args...)
+#endif
+
+#endif //SYSTEM_HW01_DEBUG_H
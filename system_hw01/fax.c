@@ -0,0 +1,573 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <string.h>
+#include <pthread.h>
+#include "fax.h"
+#include "tiff.h"
+
+#define WHITE_BITS 12
+#define BLACK_BITS 13
+#define MODE_BITS 7
+#define EXTENDED_FIRST 1792
+#define MAX_RUN 2560
+
+enum mode {
+    MODE_INVALID,
+    MODE_PASS,
+    MODE_HORIZONTAL,
+    MODE_V0,
+    MODE_VR1,
+    MODE_VR2,
+    MODE_VR3,
+    MODE_VL1,
+    MODE_VL2,
+    MODE_VL3
+};
+
+struct code {
+    uint16_t bits;
+    uint8_t length;
+};
+
+/* a decoded code: the run it stands for and how many bits it takes, 0 for no code */
+struct entry {
+    uint16_t run;
+    uint8_t length;
+};
+
+/* terminating codes for runs 0 to 63 followed by the make up codes for 64 to 1728 */
+static const struct code whiteCodes[91] = {
+        {0x035, 8}, {0x007, 6}, {0x007, 4}, {0x008, 4}, {0x00B, 4}, {0x00C, 4},
+        {0x00E, 4}, {0x00F, 4}, {0x013, 5}, {0x014, 5}, {0x007, 5}, {0x008, 5},
+        {0x008, 6}, {0x003, 6}, {0x034, 6}, {0x035, 6}, {0x02A, 6}, {0x02B, 6},
+        {0x027, 7}, {0x00C, 7}, {0x008, 7}, {0x017, 7}, {0x003, 7}, {0x004, 7},
+        {0x028, 7}, {0x02B, 7}, {0x013, 7}, {0x024, 7}, {0x018, 7}, {0x002, 8},
+        {0x003, 8}, {0x01A, 8}, {0x01B, 8}, {0x012, 8}, {0x013, 8}, {0x014, 8},
+        {0x015, 8}, {0x016, 8}, {0x017, 8}, {0x028, 8}, {0x029, 8}, {0x02A, 8},
+        {0x02B, 8}, {0x02C, 8}, {0x02D, 8}, {0x004, 8}, {0x005, 8}, {0x00A, 8},
+        {0x00B, 8}, {0x052, 8}, {0x053, 8}, {0x054, 8}, {0x055, 8}, {0x024, 8},
+        {0x025, 8}, {0x058, 8}, {0x059, 8}, {0x05A, 8}, {0x05B, 8}, {0x04A, 8},
+        {0x04B, 8}, {0x032, 8}, {0x033, 8}, {0x034, 8}, {0x01B, 5}, {0x012, 5},
+        {0x017, 6}, {0x037, 7}, {0x036, 8}, {0x037, 8}, {0x064, 8}, {0x065, 8},
+        {0x068, 8}, {0x067, 8}, {0x0CC, 9}, {0x0CD, 9}, {0x0D2, 9}, {0x0D3, 9},
+        {0x0D4, 9}, {0x0D5, 9}, {0x0D6, 9}, {0x0D7, 9}, {0x0D8, 9}, {0x0D9, 9},
+        {0x0DA, 9}, {0x0DB, 9}, {0x098, 9}, {0x099, 9}, {0x09A, 9}, {0x018, 6},
+        {0x09B, 9},
+};
+
+static const struct code blackCodes[91] = {
+        {0x037, 10}, {0x002, 3}, {0x003, 2}, {0x002, 2}, {0x003, 3}, {0x003, 4},
+        {0x002, 4}, {0x003, 5}, {0x005, 6}, {0x004, 6}, {0x004, 7}, {0x005, 7},
+        {0x007, 7}, {0x004, 8}, {0x007, 8}, {0x018, 9}, {0x017, 10}, {0x018, 10},
+        {0x008, 10}, {0x067, 11}, {0x068, 11}, {0x06C, 11}, {0x037, 11}, {0x028, 11},
+        {0x017, 11}, {0x018, 11}, {0x0CA, 12}, {0x0CB, 12}, {0x0CC, 12}, {0x0CD, 12},
+        {0x068, 12}, {0x069, 12}, {0x06A, 12}, {0x06B, 12}, {0x0D2, 12}, {0x0D3, 12},
+        {0x0D4, 12}, {0x0D5, 12}, {0x0D6, 12}, {0x0D7, 12}, {0x06C, 12}, {0x06D, 12},
+        {0x0DA, 12}, {0x0DB, 12}, {0x054, 12}, {0x055, 12}, {0x056, 12}, {0x057, 12},
+        {0x064, 12}, {0x065, 12}, {0x052, 12}, {0x053, 12}, {0x024, 12}, {0x037, 12},
+        {0x038, 12}, {0x027, 12}, {0x028, 12}, {0x058, 12}, {0x059, 12}, {0x02B, 12},
+        {0x02C, 12}, {0x05A, 12}, {0x066, 12}, {0x067, 12}, {0x00F, 10}, {0x0C8, 12},
+        {0x0C9, 12}, {0x05B, 12}, {0x033, 12}, {0x034, 12}, {0x035, 12}, {0x06C, 13},
+        {0x06D, 13}, {0x04A, 13}, {0x04B, 13}, {0x04C, 13}, {0x04D, 13}, {0x072, 13},
+        {0x073, 13}, {0x074, 13}, {0x075, 13}, {0x076, 13}, {0x077, 13}, {0x052, 13},
+        {0x053, 13}, {0x054, 13}, {0x055, 13}, {0x05A, 13}, {0x05B, 13}, {0x064, 13},
+        {0x065, 13},
+};
+
+/* make up codes for 1792 to 2560, shared by both colours */
+static const struct code extendedCodes[13] = {
+        {0x008, 11}, {0x00C, 11}, {0x00D, 11}, {0x012, 12}, {0x013, 12}, {0x014, 12},
+        {0x015, 12}, {0x016, 12}, {0x017, 12}, {0x01C, 12}, {0x01D, 12}, {0x01E, 12},
+        {0x01F, 12},
+};
+
+/* indexed by the mode enum */
+static const struct code modeCodes[10] = {
+        {0, 0}, {0x1, 4}, {0x1, 3}, {0x1, 1}, {0x3, 3}, {0x3, 6}, {0x3, 7}, {0x2, 3}, {0x2, 6}, {0x2, 7},
+};
+
+static struct entry whiteTable[1 << WHITE_BITS];
+static struct entry blackTable[1 << BLACK_BITS];
+static struct entry modeTable[1 << MODE_BITS];
+static uint8_t reversed[256];
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+/* every index that starts with the code decodes to it */
+static void addCode(struct entry *table, unsigned bits, struct code code, uint16_t run) {
+    unsigned first = (unsigned) code.bits << (bits - code.length);
+
+    for (unsigned i = 0; i < 1u << (bits - code.length); ++i)
+        table[first + i] = (struct entry) {run, code.length};
+}
+
+static void buildTables(void) {
+    for (uint16_t i = 0; i < 91; ++i) {
+        uint16_t run = i < 64 ? i : (uint16_t) ((i - 63) * 64);
+
+        addCode(whiteTable, WHITE_BITS, whiteCodes[i], run);
+        addCode(blackTable, BLACK_BITS, blackCodes[i], run);
+    }
+
+    for (uint16_t i = 0; i < 13; ++i) {
+        addCode(whiteTable, WHITE_BITS, extendedCodes[i], (uint16_t) (EXTENDED_FIRST + i * 64));
+        addCode(blackTable, BLACK_BITS, extendedCodes[i], (uint16_t) (EXTENDED_FIRST + i * 64));
+    }
+
+    for (uint16_t m = MODE_PASS; m <= MODE_VL3; ++m)
+        addCode(modeTable, MODE_BITS, modeCodes[m], m);
+
+    for (int b = 0; b < 256; ++b) {
+        for (int i = 0; i < 8; ++i)
+            reversed[b] |= (b >> i & 1) << (7 - i);
+    }
+}
+
+/* most significant bit first, the next unread bit is the top bit of bits */
+struct bitReader {
+    const uint8_t *src;
+    size_t size;
+    size_t in;
+    uint64_t bits;
+    uint32_t held;
+    bool reverse;
+};
+
+static void refill(struct bitReader *r) {
+    if (!r->reverse && r->held <= 32 && r->in + 4 <= r->size) {
+        uint32_t v;
+        memcpy(&v, r->src + r->in, sizeof(v));
+        r->bits |= (uint64_t) be32toh(v) << (32 - r->held);
+        r->held += 32;
+        r->in += 4;
+    }
+
+    /* past the end the stream reads as zeros */
+    while (r->held <= 56) {
+        uint8_t b = r->in < r->size ? r->src[r->in] : 0;
+
+        r->bits |= (uint64_t) (r->reverse ? reversed[b] : b) << (56 - r->held);
+        r->held += 8;
+        ++r->in;
+    }
+}
+
+static uint32_t peek(const struct bitReader *r, unsigned n) {
+    return (uint32_t) (r->bits >> (64 - n));
+}
+
+static void skip(struct bitReader *r, unsigned n) {
+    r->bits <<= n;
+    r->held -= n;
+}
+
+static bool exhausted(const struct bitReader *r) {
+    return r->in * 8 - r->held > r->size * 8;
+}
+
+/* drops the fill bits up to the next byte boundary */
+static void align(struct bitReader *r) {
+    skip(r, r->held % 8);
+}
+
+/* a run is any number of make up codes closed by a terminating one, -1 on a bad code */
+static int32_t readRun(struct bitReader *r, const struct entry *table, unsigned bits) {
+    int32_t run = 0;
+
+    for (;;) {
+        struct entry e;
+
+        refill(r);
+        e = table[peek(r, bits)];
+
+        if (e.length == 0 || run > INT32_MAX - MAX_RUN)
+            return -1;
+
+        skip(r, e.length);
+        run += e.run;
+
+        if (e.run < 64)
+            return run;
+    }
+}
+
+/* sets bits from up to, but not including, to */
+static void fillBits(uint8_t *row, uint32_t from, uint32_t to) {
+    uint32_t a = from / 8;
+    uint32_t b = to / 8;
+    uint8_t head = (uint8_t) (0xFF >> from % 8);
+    uint8_t tail = (uint8_t) (0xFF00 >> to % 8);
+
+    if (from >= to)
+        return;
+
+    if (a == b) {
+        row[a] |= head & tail;
+        return;
+    }
+
+    row[a] |= head;
+    memset(row + a + 1, 0xFF, b - a - 1);
+    if (tail != 0)
+        row[b] |= tail;
+}
+
+/*
+ * a line is kept as the positions where its colour changes, starting with a change to black. the
+ * list ends with three copies of the width so that b1 and b2 always exist, which leaves room for
+ * at most width + 1 real changes.
+ */
+struct line {
+    int32_t *changes;
+    uint32_t count;
+};
+
+static bool lineFull(const struct line *line, int32_t width, uint32_t more) {
+    return line->count + more > (uint32_t) width + 1;
+}
+
+static void closeLine(struct line *line, int32_t width) {
+    for (int i = 0; i < 3; ++i)
+        line->changes[line->count + i] = width;
+}
+
+/* returns true on a bad code or a run past the end of the row */
+static bool decode1D(struct bitReader *r, uint8_t *row, int32_t width, struct line *cur) {
+    int32_t a0 = 0;
+    int color = 0;
+
+    cur->count = 0;
+
+    while (a0 < width) {
+        int32_t run = color ? readRun(r, blackTable, BLACK_BITS) : readRun(r, whiteTable, WHITE_BITS);
+
+        if (run < 0 || run > width - a0 || lineFull(cur, width, 1))
+            return true;
+
+        if (color)
+            fillBits(row, (uint32_t) a0, (uint32_t) (a0 + run));
+
+        a0 += run;
+        cur->changes[cur->count++] = a0;
+        color ^= 1;
+    }
+
+    closeLine(cur, width);
+    return false;
+}
+
+static bool decode2D(struct bitReader *r, uint8_t *row, int32_t width, const struct line *ref, struct line *cur) {
+    const int32_t *b = ref->changes;
+    int32_t a0 = -1;
+    int color = 0;
+    uint32_t i = 0;
+
+    cur->count = 0;
+
+    while (a0 < width) {
+        int32_t start = a0 < 0 ? 0 : a0;
+        int32_t b1, b2, a1, a2;
+        struct entry mode;
+
+        /* b1 is the first change right of a0 to the colour opposite a0's, b2 the one after it */
+        while (i > 0 && b[i - 1] > a0)
+            --i;
+        while (b[i] <= a0)
+            ++i;
+        if ((i & 1) != (uint32_t) color)
+            ++i;
+        b1 = b[i];
+        b2 = b[i + 1];
+
+        refill(r);
+        mode = modeTable[peek(r, MODE_BITS)];
+
+        if (mode.length == 0)
+            return true;
+
+        skip(r, mode.length);
+
+        switch (mode.run) {
+            case MODE_PASS:
+                if (color)
+                    fillBits(row, (uint32_t) start, (uint32_t) b2);
+                a0 = b2;
+                continue;
+            case MODE_HORIZONTAL:
+                a1 = color ? readRun(r, blackTable, BLACK_BITS) : readRun(r, whiteTable, WHITE_BITS);
+                a2 = color ? readRun(r, whiteTable, WHITE_BITS) : readRun(r, blackTable, BLACK_BITS);
+
+                if (a1 < 0 || a2 < 0 || a1 > width - start || a2 > width - start - a1 || lineFull(cur, width, 2))
+                    return true;
+
+                a1 += start;
+                a2 += a1;
+                fillBits(row, (uint32_t) (color ? start : a1), (uint32_t) (color ? a1 : a2));
+                cur->changes[cur->count++] = a1;
+                cur->changes[cur->count++] = a2;
+                a0 = a2;
+                continue;
+            case MODE_V0:
+            case MODE_VR1:
+            case MODE_VR2:
+            case MODE_VR3:
+                a1 = b1 + (int32_t) (mode.run - MODE_V0);
+                break;
+            default:
+                a1 = b1 - (int32_t) (mode.run - MODE_VR3);
+                break;
+        }
+
+        if (a1 < start || a1 > width || lineFull(cur, width, 1))
+            return true;
+
+        if (color)
+            fillBits(row, (uint32_t) start, (uint32_t) a1);
+
+        cur->changes[cur->count++] = a1;
+        a0 = a1;
+        color ^= 1;
+    }
+
+    closeLine(cur, width);
+    return false;
+}
+
+/* skips an end of line code and the fill before it, returns whether there was one */
+static bool skipEol(struct bitReader *r) {
+    refill(r);
+
+    if (peek(r, 11) != 0)
+        return false;
+
+    while (!exhausted(r)) {
+        uint32_t zeros = r->bits == 0 ? r->held : (uint32_t) __builtin_clzll(r->bits);
+
+        if (zeros < r->held) {
+            skip(r, zeros + 1);
+            return true;
+        }
+
+        skip(r, r->held);
+        refill(r);
+    }
+
+    return true;
+}
+
+static bool ccittDecode(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize,
+                        const struct codecParams *params, uint16_t compression) {
+    int32_t width = (int32_t) params->width;
+    size_t rowBytes = (params->width + 7) / 8;
+    size_t rows = dstSize / rowBytes;
+    struct bitReader r = {.src = src, .size = srcSize, .reverse = params->fillOrder == 2};
+    struct line lines[2];
+    struct line *ref = &lines[0];
+    struct line *cur = &lines[1];
+    int32_t *changes;
+    bool failed = false;
+
+    pthread_once(&once, buildTables);
+    memset(dst, 0, dstSize);
+
+    if (params->width == 0 || params->width > INT32_MAX - 4)
+        return true;
+
+    changes = malloc(sizeof(int32_t) * (params->width + 4) * 2);
+
+    if (changes == NULL)
+        return true;
+
+    ref->changes = changes;
+    cur->changes = changes + params->width + 4;
+
+    /* the line above the first one is all white */
+    ref->count = 0;
+    closeLine(ref, width);
+
+    for (size_t y = 0; y < rows && !failed && !exhausted(&r); ++y) {
+        uint8_t *row = dst + y * rowBytes;
+        bool twoD = compression == CCITT_T6;
+        struct line *swap;
+
+        if (compression == CCITT_RLE && y != 0)
+            align(&r);
+
+        if (compression == CCITT_T4) {
+            skipEol(&r);
+
+            /* a tag bit after the end of line says which coding follows */
+            if (params->t4Options & 1) {
+                refill(&r);
+                twoD = peek(&r, 1) == 0;
+                skip(&r, 1);
+            }
+        }
+
+        failed = twoD ? decode2D(&r, row, width, ref, cur) : decode1D(&r, row, width, cur);
+
+        swap = ref;
+        ref = cur;
+        cur = swap;
+    }
+
+    free(changes);
+
+    /* a row cut short by the end of the strip is kept, like the rows missing after it */
+    return failed && !exhausted(&r);
+}
+
+bool ccittRleDecode(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize,
+                    const struct codecParams *params) {
+    return ccittDecode(src, srcSize, dst, dstSize, params, CCITT_RLE);
+}
+
+bool ccittT4Decode(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize,
+                   const struct codecParams *params) {
+    return ccittDecode(src, srcSize, dst, dstSize, params, CCITT_T4);
+}
+
+bool ccittT6Decode(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize,
+                   const struct codecParams *params) {
+    return ccittDecode(src, srcSize, dst, dstSize, params, CCITT_T6);
+}
+
+struct bitWriter {
+    uint8_t *dst;
+    size_t size;
+    size_t out;
+    uint64_t bits;
+    uint32_t held;
+    bool overflow;
+};
+
+static void putBits(struct bitWriter *w, struct code code) {
+    w->bits = w->bits << code.length | code.bits;
+    w->held += code.length;
+
+    while (w->held >= 8) {
+        w->held -= 8;
+
+        if (w->out == w->size) {
+            w->overflow = true;
+            return;
+        }
+
+        w->dst[w->out++] = (uint8_t) (w->bits >> w->held);
+    }
+}
+
+static void putRun(struct bitWriter *w, const struct code *codes, uint32_t run) {
+    while (run >= MAX_RUN + 64) {
+        putBits(w, extendedCodes[12]);
+        run -= MAX_RUN;
+    }
+
+    if (run >= EXTENDED_FIRST)
+        putBits(w, extendedCodes[(run - EXTENDED_FIRST) / 64]);
+    else if (run >= 64)
+        putBits(w, codes[63 + run / 64]);
+
+    putBits(w, codes[run % 64]);
+}
+
+/* the changes of a packed row, in the same form the decoder keeps them */
+static void findChanges(const uint8_t *row, int32_t width, struct line *line) {
+    int color = 0;
+
+    line->count = 0;
+
+    for (int32_t x = 0; x < width; ++x) {
+        int bit = row[x / 8] >> (7 - x % 8) & 1;
+
+        if (bit != color) {
+            line->changes[line->count++] = x;
+            color = bit;
+        }
+    }
+
+    closeLine(line, width);
+}
+
+size_t ccittT6Encode(const uint8_t *packed, uint32_t width, uint32_t rows, uint8_t *dst, size_t dstSize) {
+    struct bitWriter w = {.dst = dst, .size = dstSize};
+    size_t rowBytes = (width + 7) / 8;
+    struct line lines[2];
+    struct line *ref = &lines[0];
+    struct line *cur = &lines[1];
+    int32_t *changes;
+
+    pthread_once(&once, buildTables);
+
+    if (width == 0 || width > INT32_MAX - 4)
+        return 0;
+
+    changes = malloc(sizeof(int32_t) * (width + 4) * 2);
+
+    if (changes == NULL)
+        return 0;
+
+    ref->changes = changes;
+    cur->changes = changes + width + 4;
+    ref->count = 0;
+    closeLine(ref, (int32_t) width);
+
+    for (uint32_t y = 0; y < rows && !w.overflow; ++y) {
+        const int32_t *a = cur->changes;
+        const int32_t *b = ref->changes;
+        int32_t a0 = -1;
+        int color = 0;
+        uint32_t i = 0;
+        uint32_t k = 0;
+        struct line *swap;
+
+        findChanges(packed + y * rowBytes, (int32_t) width, cur);
+
+        while (a0 < (int32_t) width) {
+            int32_t start = a0 < 0 ? 0 : a0;
+            int32_t a1, a2, b1, b2;
+
+            while (a[k] <= a0)
+                ++k;
+            a1 = a[k];
+            a2 = a[k + 1];
+
+            while (i > 0 && b[i - 1] > a0)
+                --i;
+            while (b[i] <= a0)
+                ++i;
+            if ((i & 1) != (uint32_t) color)
+                ++i;
+            b1 = b[i];
+            b2 = b[i + 1];
+
+            if (b2 < a1) {
+                putBits(&w, modeCodes[MODE_PASS]);
+                a0 = b2;
+            } else if (a1 - b1 >= -3 && a1 - b1 <= 3) {
+                putBits(&w, modeCodes[a1 >= b1 ? MODE_V0 + a1 - b1 : MODE_VR3 + b1 - a1]);
+                a0 = a1;
+                color ^= 1;
+            } else {
+                putBits(&w, modeCodes[MODE_HORIZONTAL]);
+                putRun(&w, color ? blackCodes : whiteCodes, (uint32_t) (a1 - start));
+                putRun(&w, color ? whiteCodes : blackCodes, (uint32_t) (a2 - a1));
+                a0 = a2;
+            }
+        }
+
+        swap = ref;
+        ref = cur;
+        cur = swap;
+    }
+
+    free(changes);
+
+    /* end of facsimile block: two end of line codes, then padding to a whole byte */
+    putBits(&w, (struct code) {1, 12});
+    putBits(&w, (struct code) {1, 12});
+    putBits(&w, (struct code) {0, (uint8_t) ((8 - w.held) % 8)});
+
+    return w.overflow ? 0 : w.out;
+}
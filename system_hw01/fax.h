@@ -0,0 +1,31 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include "compress.h"
+
+#ifndef SYSTEM_HW01_FAX_H
+#define SYSTEM_HW01_FAX_H
+
+/*
+ * ccitt decoders for bilevel strips and tiles. they write packed rows, most significant bit first,
+ * with black runs as set bits; the photometric interpretation is applied when the rows are expanded.
+ * run lengths and modes are decoded with lookup tables a whole code at a time.
+ */
+
+/* modified huffman: 1d rows, each starting on a byte boundary */
+bool ccittRleDecode(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize,
+                    const struct codecParams *params);
+
+/* group 3: rows behind end of line codes, 2d coded too when bit 0 of T4Options is set */
+bool ccittT4Decode(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize,
+                   const struct codecParams *params);
+
+/* group 4: every row 2d coded against the one above it */
+bool ccittT6Decode(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize,
+                   const struct codecParams *params);
+
+/* group 4 encodes packed rows, black as set bits, returns the bytes written or 0 when dst is too small */
+size_t ccittT6Encode(const uint8_t *packed, uint32_t width, uint32_t rows, uint8_t *dst, size_t dstSize);
+
+#endif //SYSTEM_HW01_FAX_H
@@ -0,0 +1,654 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+#include "ifd.h"
+#include "debug.h"
+
+struct header {
+    uint16_t byteOrder;
+    uint16_t version;
+    uint32_t ifdOffset;
+};
+
+/* bigtiff, version 43: the header grows to 16 bytes and the first ifd offset to 64 bits */
+struct bigHeader {
+    uint16_t byteOrder;
+    uint16_t version;
+    uint16_t offsetSize;
+    uint16_t reserved;
+    uint64_t ifdOffset;
+};
+
+/* most ifds fit in one read of this size, larger ones take a second */
+#define IFD_PREFETCH 1024
+
+bool readAll(int fd, void *buffer, size_t size) {
+    size_t total = 0;
+    ssize_t n;
+
+    do {
+        n = read(fd, (uint8_t *) buffer + total, size - total);
+
+        if (n <= 0) {
+            perror("readall");
+            return true;
+        }
+
+        total += n;
+    } while (total != size);
+
+    return false;
+}
+
+/* like readAll but leaves the file offset alone, so threads can share the descriptor */
+bool preadAll(int fd, void *buffer, size_t size, off_t offset) {
+    size_t total = 0;
+    ssize_t n;
+
+    do {
+        n = pread(fd, (uint8_t *) buffer + total, size - total, offset + total);
+
+        if (n <= 0) {
+            perror("preadall");
+            return true;
+        }
+
+        total += n;
+    } while (total != size);
+
+    return false;
+}
+
+void clean32(uint32_t **p) {
+    if (*p != NULL)
+        free(*p);
+    *p = NULL;
+}
+
+void clean64(uint64_t **p) {
+    if (*p != NULL)
+        free(*p);
+    *p = NULL;
+}
+
+void clean8(uint8_t **p) {
+    if (*p != NULL)
+        free(*p);
+    *p = NULL;
+}
+
+static uint16_t get16(enum byteOrder order, const void *p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return order == II ? le16toh(v) : be16toh(v);
+}
+
+static uint32_t get32(enum byteOrder order, const void *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return order == II ? le32toh(v) : be32toh(v);
+}
+
+static uint64_t get64(enum byteOrder order, const void *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return order == II ? le64toh(v) : be64toh(v);
+}
+
+static size_t typeSize(uint16_t dataType) {
+    switch (dataType) {
+        case BYTE:
+        case ASCIIZ:
+            return 1;
+        case WORD:
+            return 2;
+        case DWORD:
+        case IFD:
+            return 4;
+        case RATIONAL:
+        case LONG8:
+        case IFD8:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+static bool inWindow(const struct source *src, uint64_t offset, size_t size) {
+    return src->window != NULL && offset >= src->windowOffset && size <= src->windowSize &&
+           offset - src->windowOffset <= src->windowSize - size;
+}
+
+bool sourceHolds(const struct source *src, uint64_t offset, size_t size) {
+    return src->map != NULL || inWindow(src, offset, size);
+}
+
+/* returns size bytes at offset, pointing into the mapping or the window or read into scratch, NULL on error */
+const void *sourceFetch(struct source *src, uint64_t offset, void *scratch, size_t size) {
+    if (src->map != NULL) {
+        if (offset > src->size || size > src->size - offset)
+            return NULL;
+        return src->map + offset;
+    }
+
+    if (inWindow(src, offset, size))
+        return src->window + (offset - src->windowOffset);
+
+    if (preadAll(src->fd, scratch, size, offset))
+        return NULL;
+
+    src->bytesRead += size;
+    return scratch;
+}
+
+/* like sourceFetch, but settles for fewer than size bytes at the end of the file and reports how many */
+static const void *sourceFetchSome(struct source *src, uint64_t offset, void *scratch, size_t size, size_t *got) {
+    ssize_t n;
+
+    if (src->map != NULL) {
+        if (offset >= src->size)
+            return NULL;
+        *got = size < src->size - offset ? size : src->size - offset;
+        return src->map + offset;
+    }
+
+    n = pread(src->fd, scratch, size, offset);
+
+    if (n <= 0)
+        return NULL;
+
+    src->bytesRead += n;
+    *got = n;
+    return scratch;
+}
+
+/* splits a raw classic or bigtiff tag into its fields */
+static void parseTag(enum byteOrder order, bool big, const uint8_t *t, struct tag *tag) {
+    tag->tagId = get16(order, t);
+    tag->dataType = get16(order, t + 2);
+    tag->dataCount = big ? get64(order, t + 4) : get32(order, t + 4);
+    memset(tag->value, 0, sizeof(tag->value));
+    memcpy(tag->value, t + (big ? 12 : 8), big ? 8 : 4);
+}
+
+/* first value of a tag, stored in the value field itself */
+static uint32_t tagValue(enum byteOrder order, const struct tag *tag) {
+    if (tag->dataType == WORD)
+        return get16(order, tag->value);
+    if (tag->dataType == BYTE)
+        return tag->value[0];
+    if (tag->dataType == LONG8 || tag->dataType == IFD8)
+        return (uint32_t) get64(order, tag->value);
+    return get32(order, tag->value);
+}
+
+/* where the values of a tag are: in its value field, or at the offset stored there */
+static const uint8_t *tagData(struct source *src, const struct tagTable *table, const struct tag *tag,
+                              void *scratch, size_t size, struct tiffError *const err) {
+    enum byteOrder order = table->header.byteOrder;
+    uint64_t offset;
+    const uint8_t *p;
+
+    if (size <= (table->header.big ? 8 : 4))
+        return tag->value;
+
+    offset = table->header.big ? get64(order, tag->value) : get32(order, tag->value);
+    p = sourceFetch(src, offset, scratch, size);
+
+    if (p == NULL) {
+        err->data = offset;
+        err->error = READ_ERROR;
+    }
+
+    return p;
+}
+
+const struct tag *tagFind(const struct tagTable *table, uint16_t tagId) {
+    for (uint32_t i = 0; i < table->count; ++i) {
+        if (table->tags[i].tagId == tagId)
+            return &table->tags[i];
+    }
+
+    return NULL;
+}
+
+bool tagInteger(const struct tagTable *table, uint16_t tagId, uint64_t *value) {
+    const struct tag *tag = tagFind(table, tagId);
+    size_t size = tag != NULL ? typeSize(tag->dataType) : 0;
+
+    if (size == 0 || tag->dataType == ASCIIZ || tag->dataType == RATIONAL || tag->dataCount == 0 ||
+        tag->dataCount > (table->header.big ? 8 : 4) / size)
+        return true;
+
+    if (size == 8)
+        *value = get64(table->header.byteOrder, tag->value);
+    else
+        *value = tagValue(table->header.byteOrder, tag);
+
+    return false;
+}
+
+/* loads a WORD, DWORD, IFD, LONG8 or IFD8 array, inline or out of line, widened to 64 bits */
+bool tagIntegers(struct source *src, const struct tagTable *table, uint16_t tagId, uint64_t **values,
+                 uint32_t *count, struct tiffError *const err) {
+    const struct tag *tag = tagFind(table, tagId);
+    enum byteOrder order = table->header.byteOrder;
+    size_t size = tag != NULL ? typeSize(tag->dataType) : 0;
+    const uint8_t *p;
+    uint8_t *scratch __attribute__((__cleanup__(clean8))) = NULL;
+
+    if (size < 2 || tag->dataType == RATIONAL || tag->dataCount == 0 || tag->dataCount > UINT32_MAX) {
+        err->data = tagId;
+        err->error = CORRUPT_DATA;
+        return true;
+    }
+
+    if (src->map == NULL && tag->dataCount > (table->header.big ? 8 : 4) / size) {
+        scratch = malloc(size * tag->dataCount);
+
+        if (scratch == NULL) {
+            err->error = MALLOC_ERROR;
+            return true;
+        }
+    }
+
+    p = tagData(src, table, tag, scratch, size * tag->dataCount, err);
+
+    if (p == NULL)
+        return true;
+
+    *values = malloc(sizeof(uint64_t) * tag->dataCount);
+
+    if (*values == NULL) {
+        err->error = MALLOC_ERROR;
+        return true;
+    }
+
+    for (uint32_t i = 0; i < tag->dataCount; ++i) {
+        if (size == 2)
+            (*values)[i] = get16(order, p + 2 * i);
+        else if (size == 4)
+            (*values)[i] = get32(order, p + 4 * i);
+        else
+            (*values)[i] = get64(order, p + 8 * i);
+    }
+
+    *count = tag->dataCount;
+    return false;
+}
+
+bool tagRational(struct source *src, const struct tagTable *table, uint16_t tagId, uint32_t *numerator,
+                 uint32_t *denominator, struct tiffError *const err) {
+    const struct tag *tag = tagFind(table, tagId);
+    uint8_t scratch[8];
+    const uint8_t *p;
+
+    if (tag == NULL || tag->dataType != RATIONAL || tag->dataCount == 0) {
+        err->data = tagId;
+        err->error = CORRUPT_DATA;
+        return true;
+    }
+
+    p = tagData(src, table, tag, scratch, sizeof(scratch), err);
+
+    if (p == NULL)
+        return true;
+
+    *numerator = get32(table->header.byteOrder, p);
+    *denominator = get32(table->header.byteOrder, p + 4);
+    return false;
+}
+
+bool tagString(struct source *src, const struct tagTable *table, uint16_t tagId, char **string,
+               struct tiffError *const err) {
+    const struct tag *tag = tagFind(table, tagId);
+    const uint8_t *p;
+
+    if (tag == NULL || tag->dataType != ASCIIZ || tag->dataCount > UINT32_MAX) {
+        err->data = tagId;
+        err->error = CORRUPT_DATA;
+        return true;
+    }
+
+    *string = malloc(tag->dataCount + 1);
+
+    if (*string == NULL) {
+        err->error = MALLOC_ERROR;
+        return true;
+    }
+
+    p = tagData(src, table, tag, *string, tag->dataCount, err);
+
+    if (p == NULL) {
+        free(*string);
+        return true;
+    }
+
+    memmove(*string, p, tag->dataCount);
+    (*string)[tag->dataCount] = '\0';
+    return false;
+}
+
+bool readHeader(struct source *src, struct fileHeader *header, struct tiffError *const err) {
+    struct bigHeader raw;
+    const uint8_t *h = sourceFetch(src, 0, &raw, sizeof(struct header));
+
+    if (h == NULL) {
+        err->data = sizeof(struct header);
+        err->error = READ_ERROR;
+        return true;
+    }
+
+    header->byteOrder = (enum byteOrder) get16(II, h);
+
+    if (header->byteOrder != II && header->byteOrder != MM) {
+        err->data = header->byteOrder;
+        err->error = UNKNOWN_BYTE_ORDER;
+        return true;
+    }
+
+    header->big = get16(header->byteOrder, h + offsetof(struct header, version)) == 43;
+
+    if (header->big) {
+        h = sourceFetch(src, 0, &raw, sizeof(raw));
+
+        if (h == NULL || get16(header->byteOrder, h + offsetof(struct bigHeader, offsetSize)) != 8) {
+            err->data = 43;
+            err->error = CORRUPT_DATA;
+            return true;
+        }
+
+        header->first = get64(header->byteOrder, h + offsetof(struct bigHeader, ifdOffset));
+    } else {
+        header->first = get32(header->byteOrder, h + offsetof(struct header, ifdOffset));
+    }
+
+    DERROR("BYTE ORDER: %s%s\n", (header->byteOrder == II ? "II" : "MM"), header->big ? " BIGTIFF" : "");
+    return false;
+}
+
+bool readIfd(struct source *src, const struct fileHeader *header, uint64_t offset, struct directory *dir,
+             uint64_t *next, struct tiffError *const err) {
+    uint8_t prefetch[IFD_PREFETCH];
+    uint8_t *block __attribute__((__cleanup__(clean8))) = NULL;
+    uint64_t stripOffsets = 0;
+    uint64_t stripByteCounts = 0;
+    uint64_t tileOffsets = 0;
+    uint64_t tileByteCounts = 0;
+    uint64_t bitsCount = 1;
+    bool big = header->big;
+    size_t countSize = big ? 8 : 2;
+    size_t tagSize = big ? 20 : 12;
+    size_t got;
+    size_t size;
+    uint64_t count;
+    const uint8_t *p;
+
+    memset(dir, 0, sizeof(*dir));
+    dir->byteOrder = header->byteOrder;
+    dir->bitsPerSample = 1;
+    dir->samplesPerPixel = 1;
+    dir->planar = CHUNKY;
+    dir->compression = 1;
+    dir->predictor = NO_PREDICTOR;
+    dir->fillOrder = 1;
+    dir->orientation = TOP_LEFT;
+    dir->rowsPerStrip = UINT32_MAX;
+    dir->tags.header = *header;
+
+    DERROR("SEEK IFD: %" PRIX64 "\n", offset);
+
+    /* the count, every entry and the next offset usually come in with this one read */
+    p = sourceFetchSome(src, offset, prefetch, sizeof(prefetch), &got);
+
+    if (p == NULL || got < countSize) {
+        err->data = offset;
+        err->error = READ_ERROR;
+        return true;
+    }
+
+    count = big ? get64(dir->byteOrder, p) : get16(dir->byteOrder, p);
+
+    if (count > UINT16_MAX) {
+        err->data = offset;
+        err->error = CORRUPT_DATA;
+        return true;
+    }
+
+    size = countSize + count * tagSize + (big ? 8 : 4);
+
+    if (size > got) {
+        if (src->map == NULL && (block = malloc(size)) == NULL) {
+            err->error = MALLOC_ERROR;
+            return true;
+        }
+
+        p = sourceFetch(src, offset, block, size);
+
+        if (p == NULL) {
+            err->data = offset;
+            err->error = READ_ERROR;
+            return true;
+        }
+    }
+
+    DERROR("TAG COUNT: %" PRIu64 "\n", count);
+
+    dir->tags.tags = malloc(sizeof(struct tag) * (count ? count : 1));
+
+    if (dir->tags.tags == NULL) {
+        err->error = MALLOC_ERROR;
+        return true;
+    }
+
+    /* correct the endianess of every entry in one pass, values are kept raw until their type is known */
+    for (uint64_t i = 0; i < count; ++i)
+        parseTag(dir->byteOrder, big, p + countSize + i * tagSize, &dir->tags.tags[i]);
+
+    dir->tags.count = count;
+    p += countSize + count * tagSize;
+    *next = big ? get64(dir->byteOrder, p) : get32(dir->byteOrder, p);
+
+    for (uint64_t i = 0; i < count; ++i) {
+        const struct tag *tag = &dir->tags.tags[i];
+
+        switch (tag->tagId) {
+            case IMAGE_WIDTH:
+                dir->width = tagValue(dir->byteOrder, tag);
+                DERROR("WIDTH: %d\n", dir->width);
+                break;
+            case IMAGE_LENGTH:
+                dir->height = tagValue(dir->byteOrder, tag);
+                DERROR("HEIGHT: %d\n", dir->height);
+                break;
+            case STRIP_BYTE_COUNTS:
+                DERROR("SBCC: %" PRIu64 "\n", tag->dataCount);
+                stripByteCounts = tag->dataCount;
+                break;
+            case STRIP_OFFSETS:
+                DERROR("SOFFC: %" PRIu64 "\n", tag->dataCount);
+                DERROR("SOFFT: %d\n", tag->dataType);
+                stripOffsets = tag->dataCount;
+                break;
+            case SAMPLES_PER_PIXEL:
+                dir->samplesPerPixel = tagValue(dir->byteOrder, tag);
+                DERROR("SPP: %d\n", dir->samplesPerPixel);
+                break;
+            case BITS_PER_SAMPLE:
+                bitsCount = tag->dataCount;
+                dir->bitsPerSample = tagValue(dir->byteOrder, tag);
+                DERROR("BPS: %d\n", dir->bitsPerSample);
+                break;
+            case PLANAR_CONFIGURATION:
+                dir->planar = tagValue(dir->byteOrder, tag);
+                DERROR("PLANAR: %d\n", dir->planar);
+                break;
+            case PHOTOMETRIC_INTERPRETATION:
+                dir->photometric = tagValue(dir->byteOrder, tag);
+                DERROR("COLOR: %d\n", dir->photometric);
+                break;
+            case COMPRESSION:
+                dir->compression = tagValue(dir->byteOrder, tag);
+                DERROR("COMPRESSION: %d\n", dir->compression);
+                break;
+            case PREDICTOR:
+                dir->predictor = tagValue(dir->byteOrder, tag);
+                DERROR("PREDICTOR: %d\n", dir->predictor);
+                break;
+            case ROWS_PER_STRIP:
+                dir->rowsPerStrip = tagValue(dir->byteOrder, tag);
+                DERROR("RPS: %X\n", dir->rowsPerStrip);
+                break;
+            case FILL_ORDER:
+                dir->fillOrder = tagValue(dir->byteOrder, tag);
+                DERROR("FILL: %d\n", dir->fillOrder);
+                break;
+            case ORIENTATION:
+                dir->orientation = tagValue(dir->byteOrder, tag);
+                DERROR("ORIENTATION: %d\n", dir->orientation);
+                break;
+            case T4_OPTIONS:
+                dir->t4Options = tagValue(dir->byteOrder, tag);
+                DERROR("T4: %X\n", dir->t4Options);
+                break;
+            case TILE_WIDTH:
+                dir->tileWidth = tagValue(dir->byteOrder, tag);
+                DERROR("TW: %d\n", dir->tileWidth);
+                break;
+            case TILE_LENGTH:
+                dir->tileLength = tagValue(dir->byteOrder, tag);
+                DERROR("TL: %d\n", dir->tileLength);
+                break;
+            case TILE_OFFSETS:
+                DERROR("TOFFC: %" PRIu64 "\n", tag->dataCount);
+                tileOffsets = tag->dataCount;
+                break;
+            case TILE_BYTE_COUNTS:
+                DERROR("TBCC: %" PRIu64 "\n", tag->dataCount);
+                tileByteCounts = tag->dataCount;
+                break;
+            default:
+                DERROR("TAG %" PRIu64 "/%" PRIu64 "\n", i + 1, count);
+                DERROR("--> ID:      %d\n", tag->tagId);
+                DERROR("--> DTYPE:   %d\n", tag->dataType);
+                DERROR("--> DCOUNT:  %" PRIu64 "\n", tag->dataCount);
+                break;
+        }
+    }
+
+    if (dir->rowsPerStrip == 0 || dir->rowsPerStrip > dir->height)
+        dir->rowsPerStrip = dir->height;
+
+    /* one size per sample, usually out of line; only images whose samples all agree are decoded */
+    if (bitsCount > 1) {
+        uint64_t *bits;
+        uint32_t n;
+
+        if (tagIntegers(src, &dir->tags, BITS_PER_SAMPLE, &bits, &n, err)) {
+            directoryFree(dir);
+            return true;
+        }
+
+        dir->bitsPerSample = bits[0];
+        for (uint32_t i = 1; i < n; ++i) {
+            if (bits[i] != bits[0])
+                dir->bitsPerSample = 0;
+        }
+
+        free(bits);
+    }
+
+    /* the block tables themselves are only read by directoryLoad */
+    if (dir->tileWidth != 0) {
+        if (tileOffsets == 0 || tileOffsets != tileByteCounts || tileOffsets > UINT32_MAX) {
+            err->data = TILE_OFFSETS;
+            err->error = CORRUPT_DATA;
+            directoryFree(dir);
+            return true;
+        }
+
+        dir->tileCount = tileOffsets;
+        return false;
+    }
+
+    if (stripOffsets == 0 || stripOffsets != stripByteCounts || stripOffsets > UINT32_MAX) {
+        err->data = STRIP_OFFSETS;
+        err->error = CORRUPT_DATA;
+        directoryFree(dir);
+        return true;
+    }
+
+    dir->stripCount = stripOffsets;
+    return false;
+}
+
+bool directoryLoad(struct source *src, struct directory *dir, struct tiffError *const err) {
+    uint32_t count;
+
+    if (dir->stripOffsets != NULL || dir->tileOffsets != NULL)
+        return false;
+
+    if (dir->tileWidth != 0) {
+        if (tagIntegers(src, &dir->tags, TILE_OFFSETS, &dir->tileOffsets, &count, err) ||
+            tagIntegers(src, &dir->tags, TILE_BYTE_COUNTS, &dir->tileByteCounts, &count, err)) {
+            clean64(&dir->tileOffsets);
+            return true;
+        }
+
+        return false;
+    }
+
+    if (tagIntegers(src, &dir->tags, STRIP_OFFSETS, &dir->stripOffsets, &count, err) ||
+        tagIntegers(src, &dir->tags, STRIP_BYTE_COUNTS, &dir->stripByteCounts, &count, err)) {
+        clean64(&dir->stripOffsets);
+        return true;
+    }
+
+    return false;
+}
+
+/* the first page only, see pagesOpen for the rest of the chain */
+bool readDirectory(struct source *src, struct directory *dir, struct tiffError *const err) {
+    struct fileHeader header;
+    uint64_t next;
+
+    if (readHeader(src, &header, err) || readIfd(src, &header, header.first, dir, &next, err))
+        return true;
+
+    if (directoryLoad(src, dir, err)) {
+        directoryFree(dir);
+        return true;
+    }
+
+    return false;
+}
+
+void directoryFree(struct directory *dir) {
+    clean64(&dir->stripOffsets);
+    clean64(&dir->stripByteCounts);
+    clean64(&dir->tileOffsets);
+    clean64(&dir->tileByteCounts);
+    free(dir->tags.tags);
+    dir->tags.tags = NULL;
+    dir->tags.count = 0;
+}
+
+uint16_t directorySamples(const struct directory *dir) {
+    return dir->planar == PLANAR ? 1 : dir->samplesPerPixel;
+}
+
+uint16_t directoryPlanes(const struct directory *dir) {
+    return dir->planar == PLANAR ? dir->samplesPerPixel : 1;
+}
+
+size_t directoryRowBytes(const struct directory *dir) {
+    return ((size_t) dir->width * dir->bitsPerSample * directorySamples(dir) + 7) / 8;
+}
+
+size_t directoryPixelBytes(const struct directory *dir) {
+    return dir->bitsPerSample == 1 ? 1 : (size_t) dir->bitsPerSample / 8 * dir->samplesPerPixel;
+}
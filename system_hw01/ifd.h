@@ -0,0 +1,139 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include "tiff.h"
+
+#ifndef SYSTEM_HW01_IFD_H
+#define SYSTEM_HW01_IFD_H
+
+/* header and ifds are read either through a file descriptor or from a mapping of the whole file */
+struct source {
+    int fd;
+    const uint8_t *map;
+    size_t size;
+    uint64_t bytesRead;
+    /* windowSize bytes of the file from windowOffset on, already read, fetched from there instead of the fd */
+    const uint8_t *window;
+    uint64_t windowOffset;
+    size_t windowSize;
+};
+
+/* what the file header says about every ifd in the file */
+struct fileHeader {
+    enum byteOrder byteOrder;
+    bool big;
+    uint64_t first;
+};
+
+/*
+ * one ifd entry, id, type and count in host byte order. value is the raw field of the entry: the
+ * values themselves when they fit in it, their offset otherwise.
+ */
+struct tag {
+    uint16_t tagId;
+    uint16_t dataType;
+    uint64_t dataCount;
+    uint8_t value[8];
+};
+
+/* every entry of an ifd, out of line values are only read when one of the accessors asks for them */
+struct tagTable {
+    struct fileHeader header;
+    uint32_t count;
+    struct tag *tags;
+};
+
+/* the tags of an image directory the reader cares about, in host byte order */
+struct directory {
+    enum byteOrder byteOrder;
+    uint32_t width;
+    uint32_t height;
+    /* the same for every sample, 0 when the samples of a pixel differ */
+    uint16_t bitsPerSample;
+    uint16_t samplesPerPixel;
+    /* PLANAR stores every sample in strips or tiles of its own, plane after plane */
+    uint16_t planar;
+    uint16_t photometric;
+    uint16_t compression;
+    /* HORIZONTAL_DIFFERENCING when the samples of every row were stored as differences before compression */
+    uint16_t predictor;
+    uint32_t rowsPerStrip;
+    /* 2 when the bits of every byte are stored least significant first */
+    uint16_t fillOrder;
+    uint32_t t4Options;
+    /* TOP_LEFT unless the file says the rows are shown some other way, see orientImage */
+    uint16_t orientation;
+    uint32_t stripCount;
+    uint64_t *stripOffsets;
+    uint64_t *stripByteCounts;
+    /* tileWidth is 0 for stripped images */
+    uint32_t tileWidth;
+    uint32_t tileLength;
+    uint32_t tileCount;
+    uint64_t *tileOffsets;
+    uint64_t *tileByteCounts;
+    struct tagTable tags;
+};
+
+bool readAll(int fd, void *buffer, size_t size);
+
+bool preadAll(int fd, void *buffer, size_t size, off_t offset);
+
+void clean32(uint32_t **p);
+
+void clean64(uint64_t **p);
+
+void clean8(uint8_t **p);
+
+const void *sourceFetch(struct source *src, uint64_t offset, void *scratch, size_t size);
+
+/* true when sourceFetch returns the bytes in place, without reading them into scratch */
+bool sourceHolds(const struct source *src, uint64_t offset, size_t size);
+
+const struct tag *tagFind(const struct tagTable *table, uint16_t tagId);
+
+/* the single value of an integer tag, returns true when it is missing or not one inline integer */
+bool tagInteger(const struct tagTable *table, uint16_t tagId, uint64_t *value);
+
+/* every value of an integer tag, widened to 64 bits */
+bool tagIntegers(struct source *src, const struct tagTable *table, uint16_t tagId, uint64_t **values,
+                 uint32_t *count, struct tiffError *const err);
+
+bool tagRational(struct source *src, const struct tagTable *table, uint16_t tagId, uint32_t *numerator,
+                 uint32_t *denominator, struct tiffError *const err);
+
+/* an ASCIIZ tag as a string the caller frees */
+bool tagString(struct source *src, const struct tagTable *table, uint16_t tagId, char **string,
+               struct tiffError *const err);
+
+bool readHeader(struct source *src, struct fileHeader *header, struct tiffError *const err);
+
+/*
+ * reads the ifd at offset into dir and the offset of the one after it into next, 0 at the end of the
+ * chain. the strip or tile tables are left for directoryLoad.
+ */
+bool readIfd(struct source *src, const struct fileHeader *header, uint64_t offset, struct directory *dir,
+             uint64_t *next, struct tiffError *const err);
+
+/* reads the strip or tile tables of dir if they are not there yet */
+bool directoryLoad(struct source *src, struct directory *dir, struct tiffError *const err);
+
+/* the first ifd with its tables loaded */
+bool readDirectory(struct source *src, struct directory *dir, struct tiffError *const err);
+
+void directoryFree(struct directory *dir);
+
+/* samples of a pixel in one strip or tile, 1 for planar images */
+uint16_t directorySamples(const struct directory *dir);
+
+/* strips or tiles sets the image is stored in, samplesPerPixel for planar images and 1 otherwise */
+uint16_t directoryPlanes(const struct directory *dir);
+
+/* bytes of a row of one strip or tile as stored */
+size_t directoryRowBytes(const struct directory *dir);
+
+/* bytes of a decoded pixel, 1 bit images expand to a byte */
+size_t directoryPixelBytes(const struct directory *dir);
+
+#endif //SYSTEM_HW01_IFD_H
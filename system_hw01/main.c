@@ -1,44 +1,240 @@
 #include <stdio.h>
 #include <errno.h>
+#include <string.h>
 #include "tiff.h"
+#include "render.h"
+#include "batch.h"
+#include "cache.h"
+#include "bilevel.h"
+
+static int usage(const char *name) {
+    printf("Usage: %s [-m] [-s] [-a] [-t level|otsu|dither] [-o output] [-f text|pbm|pgm|ppm] filepath\n"
+           "       %s -p levels -o output filepath\n"
+           "       %s -b [-a] [-j threads] [-c megabytes] path...\n", name, name, name);
+    return 1;
+}
+
+/* decodes every file on a thread pool and prints the throughput instead of the pixels */
+static int batch(char *const paths[], int count, unsigned threads, bool async) {
+    struct batchReport report;
+    struct cacheStats cache;
+
+    if (batchRun(paths, count, threads, async, &report))
+        return 1;
+
+    printf("Files: %u decoded, %u failed\n", report.files - report.failed, report.failed);
+    printf("Time: %.3f s on %u threads\n", report.seconds, threads);
+    printf("Throughput: %.1f files/s, %.1f MB/s\n", report.files / report.seconds,
+           report.bytes / report.seconds / 1e6);
+    printf("Latency of decoded files: p50 %.3f ms, p99 %.3f ms\n", report.p50 * 1e3, report.p99 * 1e3);
+
+    cacheGetStats(&cache);
+    if (cache.budget != 0)
+        printf("Cache: %lu hits, %lu misses, %lu evicted, %lu stale, %u images in %.1f MB\n", cache.hits,
+               cache.misses, cache.evictions, cache.stale, cache.entries, cache.bytes / 1e6);
+    return report.failed != 0;
+}
+
+/* streams the image into a tiled file with its reductions, 0 levels halves until one fits in a tile */
+static int pyramid(int fd, const char *output, unsigned levels) {
+    struct tiffError error;
+    int outFd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (outFd < 0) {
+        perror("OUTPUT ERROR");
+        return 1;
+    }
+
+    if (writePyramid(fd, outFd, levels, NULL, &error)) {
+        fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+        close(outFd);
+        return 1;
+    }
+
+    close(outFd);
+    return 0;
+}
 
 int main(int argc, char *argv[]) {
     struct tiffError error;
+    struct tiffStats stats;
+    struct tiffHistogram histogram;
+    struct tiffOptions opts = {.threads = 1, .stats = &stats, .packed = true, .orient = true};
+    struct bilevelOptions bilevel = {0};
+    bool convert = false;
+    const char *output = NULL;
+    int outFd;
+    enum renderFormat format = RENDER_TEXT;
+    bool mapped = false;
+    bool showStats = false;
+    bool batchMode = false;
+    long levels = -1;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    long budget;
     int fd;
+    int opt;
 
-    if (argc != 2) {
-        printf("Usage: %s filepath\n", argv[0]);
-        return 1;
+    while ((opt = getopt(argc, argv, "msat:o:f:bj:c:p:")) != -1) {
+        switch (opt) {
+            case 'm':
+                mapped = true;
+                break;
+            case 's':
+                showStats = true;
+                break;
+            case 'a':
+                opts.async = true;
+                break;
+            case 't':
+                convert = true;
+                if (strcmp(optarg, "otsu") == 0) {
+                    bilevel.method = BILEVEL_OTSU;
+                } else if (strcmp(optarg, "dither") == 0) {
+                    bilevel.method = BILEVEL_DITHER;
+                } else {
+                    long level = strtol(optarg, NULL, 10);
+                    if (level <= 0 || level > 255)
+                        return usage(argv[0]);
+                    bilevel.threshold = level;
+                }
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'f':
+                if (strcmp(optarg, "pbm") == 0) {
+                    format = RENDER_PBM;
+                } else if (strcmp(optarg, "pgm") == 0) {
+                    format = RENDER_PGM;
+                } else if (strcmp(optarg, "ppm") == 0) {
+                    format = RENDER_PPM;
+                } else if (strcmp(optarg, "text") != 0) {
+                    return usage(argv[0]);
+                }
+                break;
+            case 'b':
+                batchMode = true;
+                break;
+            case 'j':
+                threads = strtol(optarg, NULL, 10);
+                if (threads <= 0)
+                    return usage(argv[0]);
+                break;
+            case 'c':
+                budget = strtol(optarg, NULL, 10);
+                if (budget <= 0)
+                    return usage(argv[0]);
+                cacheSetBudget((size_t) budget << 20);
+                break;
+            case 'p':
+                levels = strtol(optarg, NULL, 10);
+                if (levels < 0)
+                    return usage(argv[0]);
+                break;
+            default:
+                return usage(argv[0]);
+        }
     }
 
-    fd = open(argv[1], O_RDONLY);
+    if (batchMode && optind < argc)
+        return batch(argv + optind, argc - optind, threads > 0 ? threads : 1, opts.async);
+
+    if (batchMode || optind != argc - 1 || (levels >= 0 && (output == NULL || format != RENDER_TEXT)))
+        return usage(argv[0]);
+
+    /* the histogram is counted while the image is decoded, not in a pass of its own */
+    if (showStats || bilevel.method == BILEVEL_OTSU)
+        opts.histogram = &histogram;
+
+    fd = open(argv[optind], O_RDONLY);
     if (fd < 0) {
         perror("FILE ERROR");
         return 1;
     }
 
-    tiff_t tiff = readFD(fd, &error);
+    /* the image is never decoded whole, it goes through the reader a row of tiles at a time */
+    if (levels >= 0) {
+        int status = pyramid(fd, output, levels);
+
+        close(fd);
+        return status;
+    }
+
+    tiff_t tiff = mapped ? readMapped(fd, opts.orient, &stats, &error) : readFDOptions(fd, &opts, &error);
 
     if (tiff == NULL) {
         printf("%s: %X", tiffErrorF(error), error.data);
         return 1;
     }
 
-    printf("Width: %d pixels\n", tiff->width);
-    printf("Height: %d pixels\n", tiff->height);
-    printf("Byte order: %s\n", (tiff->byteOrder == II ? "Intel" : "Motorola"));
+    /* netpbm images go to stdout alone, so that they can be piped */
+    if (format == RENDER_TEXT) {
+        printf("Width: %d pixels\n", tiff->width);
+        printf("Height: %d pixels\n", tiff->height);
+        printf("Byte order: %s\n", (tiff->byteOrder == II ? "Intel" : "Motorola"));
+        fflush(stdout);
+    }
+
+    /* a mapped image may not have been decoded at all */
+    if (mapped && opts.histogram != NULL)
+        tiffMeasure(tiff, &histogram);
+
+    if (showStats) {
+        fprintf(stderr, "Bytes read: %lu\n", stats.bytesRead);
+        fprintf(stderr, "Bytes mapped: %lu\n", stats.bytesMapped);
+        fprintf(stderr, "Bytes copied: %lu\n", stats.bytesCopied);
+        fprintf(stderr, "Page faults: %ld minor, %ld major\n", stats.minorFaults, stats.majorFaults);
+        fprintf(stderr, "Levels: %u to %u, %.2f%% black\n", histogram.min, histogram.max, histogram.blackRatio * 100);
+    }
+
+    /* bilevel images are already packed, there is nothing to convert */
+    convert = convert && tiff->format != PACKED1;
+    bilevel.threads = threads;
+    bilevel.histogram = opts.histogram;
+
+    /* only a tiff output is written from the gray image, a band at a time */
+    if (convert && (output == NULL || format != RENDER_TEXT)) {
+        tiff_t converted = bilevelImage(tiff, &bilevel, &error);
 
-    for (int i = 0; i < tiff->width; ++i) {
-        for (int j = 0; j < tiff->height; ++j) {
-            fprintf(stdout, "%s",
-                    (tiff->data[i * tiff->width + j] == 0 ? "0" : (tiff->data[i * tiff->width + j] == 255 ? "1"
-                                                                                                          : "X")));
+        tiffFree(tiff);
+        tiff = converted;
+
+        if (tiff == NULL) {
+            fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+            close(fd);
+            return 1;
+        }
+    }
+
+    /* -f picks a netpbm output over tiff, a converted tiff goes to the writer without being held whole */
+    if (output != NULL) {
+        outFd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (outFd < 0) {
+            perror("OUTPUT ERROR");
+        } else if (format != RENDER_TEXT ? renderImage(outFd, tiff, format, &error)
+                   : convert ? bilevelWrite(outFd, tiff, &bilevel, NULL, &error)
+                   : writeFD(outFd, tiff, NULL, &error)) {
+            fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+            close(outFd);
+            outFd = -1;
+        } else {
+            close(outFd);
         }
-        fprintf(stdout, "\n");
+
+        close(fd);
+        tiffFree(tiff);
+        return outFd < 0;
+    }
+
+    if (renderImage(STDOUT_FILENO, tiff, format, &error)) {
+        fprintf(stderr, "%s: %X\n", tiffErrorF(error), error.data);
+        close(fd);
+        tiffFree(tiff);
+        return 1;
     }
 
     close(fd);
-    free(tiff->data);
-    free(tiff);
+    tiffFree(tiff);
     return 0;
 }
\ No newline at end of file
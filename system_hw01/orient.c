@@ -0,0 +1,560 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <string.h>
+#include <pthread.h>
+#include "orient.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/*
+ * pixels on a side of the square of the upright image a transposing worker takes at once, half as many for
+ * pixels of more than 2 bytes. the rows it reads and the ones it writes all stay in cache until it is done.
+ */
+#define ORIENT_TILE 64
+
+/* bytes of packed stored rows, and of packed upright rows, a transposing worker takes at once */
+#define ORIENT_BITS_BAND 64
+
+/* rows a flipping worker takes at once */
+#define FLIP_BAND 64
+
+/* bytes exchanged at once between two rows */
+#define SWAP_CHUNK 4096
+
+static transposeFn kernel;
+static transposeFn wordKernel;
+static const char *kernelName;
+/* rows of pixels of more than a byte are reversed a vector at a time */
+static bool shuffleMirror;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+struct orientJob {
+    const uint8_t *src;
+    uint8_t *dst;
+    enum pixelFormat format;
+    size_t pixelBytes;
+    /* of the image as stored */
+    uint32_t width;
+    uint32_t height;
+    size_t srcStride;
+    size_t dstStride;
+    /* the last stored row comes first, at the top or at the left */
+    bool reverseRows;
+    /* the last stored column comes first, at the left or at the top */
+    bool reverseColumns;
+    /* the pixels on a side of the blocks kernel transposes, 0 when there is no kernel for the format */
+    transposeFn kernel;
+    uint32_t blockSide;
+    uint32_t tile;
+    uint32_t tilesAcross;
+    uint32_t units;
+    atomic_uint next;
+};
+
+void transposeBlockScalar(const uint8_t *src, ptrdiff_t srcStep, uint8_t *dst, ptrdiff_t dstStep) {
+    for (int i = 0; i < 16; ++i) {
+        for (int j = 0; j < 16; ++j)
+            dst[j * dstStep + i] = src[i * srcStep + j];
+    }
+}
+
+void transposeWordsScalar(const uint8_t *src, ptrdiff_t srcStep, uint8_t *dst, ptrdiff_t dstStep) {
+    for (int i = 0; i < 8; ++i) {
+        for (int j = 0; j < 8; ++j)
+            memcpy(dst + j * dstStep + 2 * i, src + i * srcStep + 2 * j, 2);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+ * four rounds of interleaving, each one doubling the bytes of a column kept together: pairs of rows, then
+ * quads and octets, until every register holds a whole column of 16.
+ */
+__attribute__((target("sse2")))
+void transposeBlockSSE2(const uint8_t *src, ptrdiff_t srcStep, uint8_t *dst, ptrdiff_t dstStep) {
+    __m128i a[16], b[16];
+
+    for (int i = 0; i < 16; ++i)
+        a[i] = _mm_loadu_si128((const __m128i *) (src + i * srcStep));
+
+    /* b[8 * half + pair]: 8 columns, 2 rows each */
+    for (int g = 0; g < 8; ++g) {
+        b[g] = _mm_unpacklo_epi8(a[2 * g], a[2 * g + 1]);
+        b[8 + g] = _mm_unpackhi_epi8(a[2 * g], a[2 * g + 1]);
+    }
+
+    /* a[4 * quarter + quad]: 4 columns, 4 rows each */
+    for (int c = 0; c < 2; ++c) {
+        for (int h = 0; h < 4; ++h) {
+            a[8 * c + h] = _mm_unpacklo_epi16(b[8 * c + 2 * h], b[8 * c + 2 * h + 1]);
+            a[8 * c + 4 + h] = _mm_unpackhi_epi16(b[8 * c + 2 * h], b[8 * c + 2 * h + 1]);
+        }
+    }
+
+    /* b[2 * column pair + octet]: 2 columns, 8 rows each */
+    for (int q = 0; q < 4; ++q) {
+        for (int p = 0; p < 2; ++p) {
+            b[4 * q + p] = _mm_unpacklo_epi32(a[4 * q + 2 * p], a[4 * q + 2 * p + 1]);
+            b[4 * q + 2 + p] = _mm_unpackhi_epi32(a[4 * q + 2 * p], a[4 * q + 2 * p + 1]);
+        }
+    }
+
+    for (int e = 0; e < 8; ++e) {
+        _mm_storeu_si128((__m128i *) (dst + 2 * e * dstStep), _mm_unpacklo_epi64(b[2 * e], b[2 * e + 1]));
+        _mm_storeu_si128((__m128i *) (dst + (2 * e + 1) * dstStep), _mm_unpackhi_epi64(b[2 * e], b[2 * e + 1]));
+    }
+}
+
+/* the same three rounds on words, every register ends with a column of 8 */
+__attribute__((target("sse2")))
+void transposeWordsSSE2(const uint8_t *src, ptrdiff_t srcStep, uint8_t *dst, ptrdiff_t dstStep) {
+    __m128i a[8], b[8];
+
+    for (int i = 0; i < 8; ++i)
+        a[i] = _mm_loadu_si128((const __m128i *) (src + i * srcStep));
+
+    /* b[4 * half + pair]: 4 columns, 2 rows each */
+    for (int g = 0; g < 4; ++g) {
+        b[g] = _mm_unpacklo_epi16(a[2 * g], a[2 * g + 1]);
+        b[4 + g] = _mm_unpackhi_epi16(a[2 * g], a[2 * g + 1]);
+    }
+
+    /* a[4 * half + 2 * quad + column pair]: 2 columns, 4 rows each */
+    for (int h = 0; h < 2; ++h) {
+        for (int q = 0; q < 2; ++q) {
+            a[4 * h + 2 * q] = _mm_unpacklo_epi32(b[4 * h + 2 * q], b[4 * h + 2 * q + 1]);
+            a[4 * h + 2 * q + 1] = _mm_unpackhi_epi32(b[4 * h + 2 * q], b[4 * h + 2 * q + 1]);
+        }
+    }
+
+    for (int h = 0; h < 2; ++h) {
+        for (int p = 0; p < 2; ++p) {
+            uint8_t *column = dst + (4 * h + 2 * p) * dstStep;
+
+            _mm_storeu_si128((__m128i *) column, _mm_unpacklo_epi64(a[4 * h + p], a[4 * h + 2 + p]));
+            _mm_storeu_si128((__m128i *) (column + dstStep), _mm_unpackhi_epi64(a[4 * h + p], a[4 * h + 2 + p]));
+        }
+    }
+}
+
+#endif
+
+static void pickKernel(void) {
+    kernel = transposeBlockScalar;
+    wordKernel = transposeWordsScalar;
+    kernelName = "scalar";
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse2")) {
+        kernel = transposeBlockSSE2;
+        wordKernel = transposeWordsSSE2;
+        kernelName = "sse2";
+    }
+
+    if (__builtin_cpu_supports("ssse3"))
+        shuffleMirror = true;
+#endif
+}
+
+const char *transposeKernelName(void) {
+    pthread_once(&once, pickKernel);
+    return kernelName;
+}
+
+/* three rounds of exchanging the bits on either side of the diagonal, in 1, 2 and then 4 bit squares */
+uint64_t transposeBits(uint64_t x) {
+    uint64_t t;
+
+    t = (x ^ x >> 7) & 0x00AA00AA00AA00AAull;
+    x ^= t ^ t << 7;
+    t = (x ^ x >> 14) & 0x0000CCCC0000CCCCull;
+    x ^= t ^ t << 14;
+    t = (x ^ x >> 28) & 0x00000000F0F0F0F0ull;
+    x ^= t ^ t << 28;
+    return x;
+}
+
+/* the bits of every byte in reverse order */
+static uint64_t reverseBitsInBytes(uint64_t x) {
+    x = (x & 0xF0F0F0F0F0F0F0F0ull) >> 4 | (x & 0x0F0F0F0F0F0F0F0Full) << 4;
+    x = (x & 0xCCCCCCCCCCCCCCCCull) >> 2 | (x & 0x3333333333333333ull) << 2;
+    return (x & 0xAAAAAAAAAAAAAAAAull) >> 1 | (x & 0x5555555555555555ull) << 1;
+}
+
+/* reverses n bytes in place a word from each end at a time, and with bits the bits of every byte too */
+static void reverseBytes(uint8_t *row, size_t n, bool bits) {
+    size_t i = 0, j = n;
+
+    while (j - i >= 16) {
+        uint64_t a, b;
+
+        memcpy(&a, row + i, sizeof(a));
+        memcpy(&b, row + j - 8, sizeof(b));
+        a = __builtin_bswap64(a);
+        b = __builtin_bswap64(b);
+        if (bits)
+            a = reverseBitsInBytes(a), b = reverseBitsInBytes(b);
+        memcpy(row + i, &b, sizeof(b));
+        memcpy(row + j - 8, &a, sizeof(a));
+        i += 8, j -= 8;
+    }
+
+    for (; j - i >= 2; ++i, --j) {
+        uint8_t a = row[i], b = row[j - 1];
+
+        row[i] = bits ? reverseBitsInBytes(b) : b;
+        row[j - 1] = bits ? reverseBitsInBytes(a) : a;
+    }
+
+    if (j - i == 1 && bits)
+        row[i] = reverseBitsInBytes(row[i]);
+}
+
+static void copyPixel(uint8_t *dst, const uint8_t *src, size_t pixelBytes) {
+    /* constant sizes, so that every copy is a move or two */
+    switch (pixelBytes) {
+        case 1:
+            *dst = *src;
+            break;
+        case 2:
+            memcpy(dst, src, 2);
+            break;
+        case 3:
+            memcpy(dst, src, 3);
+            break;
+        default:
+            memcpy(dst, src, 6);
+            break;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+ * swaps the whole pixels of pb bytes that fit in 16, from each end of the row inwards, reversing their
+ * order as one shuffle each. the bytes past them in each vector are blended back as they were, and the two
+ * stores never reach each other's pixels. returns the pixels done from each end.
+ */
+__attribute__((target("ssse3")))
+static uint32_t mirrorPixelsSSSE3(uint8_t *row, uint32_t width, size_t pb) {
+    uint32_t per = 16 / pb;
+    size_t chunk = per * pb;
+    size_t i = 0, j = width * pb;
+    uint8_t toFront[16], toBack[16], front[16], back[16];
+    __m128i shuffleFront, shuffleBack, maskFront, maskBack;
+
+    for (size_t d = 0; d < 16; ++d) {
+        size_t e = d - (16 - chunk);
+
+        toFront[d] = d < chunk ? (uint8_t) (16 - chunk + (per - 1 - d / pb) * pb + d % pb) : 0x80;
+        front[d] = d < chunk ? 0xFF : 0;
+        toBack[d] = d >= 16 - chunk ? (uint8_t) ((per - 1 - e / pb) * pb + e % pb) : 0x80;
+        back[d] = d >= 16 - chunk ? 0xFF : 0;
+    }
+
+    shuffleFront = _mm_loadu_si128((const __m128i *) toFront);
+    shuffleBack = _mm_loadu_si128((const __m128i *) toBack);
+    maskFront = _mm_loadu_si128((const __m128i *) front);
+    maskBack = _mm_loadu_si128((const __m128i *) back);
+
+    while (j - i >= 16 + chunk) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (row + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (row + j - 16));
+
+        _mm_storeu_si128((__m128i *) (row + i),
+                         _mm_or_si128(_mm_shuffle_epi8(b, shuffleFront), _mm_andnot_si128(maskFront, a)));
+        _mm_storeu_si128((__m128i *) (row + j - 16),
+                         _mm_or_si128(_mm_shuffle_epi8(a, shuffleBack), _mm_andnot_si128(maskBack, b)));
+        i += chunk, j -= chunk;
+    }
+
+    return i / pb;
+}
+
+#endif
+
+/* the pixels of the row in reverse order, packed rows keep their padding at the end */
+static void mirrorRow(const struct orientJob *job, uint8_t *row) {
+    size_t pb = job->pixelBytes;
+    uint32_t x = 0;
+    uint32_t pad;
+
+    if (job->format == GRAY8) {
+        reverseBytes(row, job->width, false);
+        return;
+    }
+
+    if (job->format == PACKED1) {
+        reverseBytes(row, job->srcStride, true);
+
+        /* the padding came out in front, the row moves left over it */
+        if ((pad = 8 * job->srcStride - job->width) != 0) {
+            for (size_t i = 0; i + 1 < job->srcStride; ++i)
+                row[i] = (uint8_t) (row[i] << pad | row[i + 1] >> (8 - pad));
+            row[job->srcStride - 1] = (uint8_t) (row[job->srcStride - 1] << pad);
+        }
+        return;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (shuffleMirror)
+        x = mirrorPixelsSSSE3(row, job->width, pb);
+#endif
+
+    /* the few pixels in the middle the vectors left */
+    for (; x < job->width / 2; ++x) {
+        uint8_t t[8];
+
+        copyPixel(t, row + x * pb, pb);
+        copyPixel(row + x * pb, row + (job->width - 1 - x) * pb, pb);
+        copyPixel(row + (job->width - 1 - x) * pb, t, pb);
+    }
+}
+
+static void swapRows(uint8_t *a, uint8_t *b, size_t n) {
+    uint8_t t[SWAP_CHUNK];
+
+    for (size_t i = 0; i < n; i += SWAP_CHUNK) {
+        size_t chunk = n - i < SWAP_CHUNK ? n - i : SWAP_CHUNK;
+
+        memcpy(t, a + i, chunk);
+        memcpy(a + i, b + i, chunk);
+        memcpy(b + i, t, chunk);
+    }
+}
+
+/* orientations 2 to 4 in place, every row of the top half with its counterpart in the bottom one */
+static void *flipWorker(void *arg) {
+    struct orientJob *job = arg;
+    uint32_t height = job->height;
+    uint32_t u;
+
+    while ((u = atomic_fetch_add(&job->next, 1)) < job->units) {
+        uint32_t end = (u + 1) * FLIP_BAND;
+
+        for (uint32_t y = u * FLIP_BAND; y < end && y < height; ++y) {
+            uint32_t other = job->reverseRows ? height - 1 - y : y;
+            uint8_t *row = job->dst + y * job->srcStride;
+
+            if (other < y)
+                break;
+
+            if (job->reverseColumns) {
+                mirrorRow(job, row);
+                if (other != y)
+                    mirrorRow(job, job->dst + other * job->srcStride);
+            }
+
+            if (other != y)
+                swapRows(row, job->dst + other * job->srcStride, job->srcStride);
+        }
+    }
+
+    return NULL;
+}
+
+/* where the pixel at (x, y) of the upright image is stored */
+static const uint8_t *storedPixel(const struct orientJob *job, uint32_t x, uint32_t y) {
+    uint32_t sy = job->reverseRows ? job->height - 1 - x : x;
+    uint32_t sx = job->reverseColumns ? job->width - 1 - y : y;
+
+    return job->src + sy * job->srcStride + sx * job->pixelBytes;
+}
+
+/*
+ * the pixels of the upright image from (x0, y0) up to (x1, y1), rows of which are columns of the stored one.
+ * full blocks go through the kernel of the format, the edges of the square a pixel at a time.
+ */
+static void transposeTile(const struct orientJob *job, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+    uint32_t n = job->blockSide;
+    uint32_t fullX = n != 0 ? x0 + (x1 - x0) / n * n : x0;
+    uint32_t fullY = n != 0 ? y0 + (y1 - y0) / n * n : y0;
+    ptrdiff_t srcStep = job->reverseRows ? -(ptrdiff_t) job->srcStride : (ptrdiff_t) job->srcStride;
+    ptrdiff_t dstStep = job->reverseColumns ? -(ptrdiff_t) job->dstStride : (ptrdiff_t) job->dstStride;
+    size_t pb = job->pixelBytes;
+
+    for (uint32_t y = y0; y < fullY; y += n) {
+        for (uint32_t x = x0; x < fullX; x += n) {
+            uint32_t sy = job->reverseRows ? job->height - 1 - x : x;
+            uint32_t sx = job->reverseColumns ? job->width - n - y : y;
+            uint32_t dy = job->reverseColumns ? y + n - 1 : y;
+
+            job->kernel(job->src + sy * job->srcStride + sx * pb, srcStep, job->dst + dy * job->dstStride + x * pb,
+                        dstStep);
+        }
+    }
+
+    /* the rows below the last full block, and the columns right of them in every row */
+    for (uint32_t y = y0; y < y1; ++y) {
+        uint8_t *row = job->dst + y * job->dstStride;
+
+        for (uint32_t x = y < fullY ? fullX : x0; x < x1; ++x)
+            copyPixel(row + x * pb, storedPixel(job, x, y), pb);
+    }
+}
+
+/* a square of the upright image at a time, taken across its rows */
+static void *transposeWorker(void *arg) {
+    struct orientJob *job = arg;
+    uint32_t width = job->height;
+    uint32_t height = job->width;
+    uint32_t u;
+
+    while ((u = atomic_fetch_add(&job->next, 1)) < job->units) {
+        uint32_t x0 = u % job->tilesAcross * job->tile;
+        uint32_t y0 = u / job->tilesAcross * job->tile;
+
+        transposeTile(job, x0, y0, x0 + job->tile < width ? x0 + job->tile : width,
+                      y0 + job->tile < height ? y0 + job->tile : height);
+    }
+
+    return NULL;
+}
+
+/*
+ * a square of packed bytes, ORIENT_BITS_BAND bytes of stored rows by as many bytes of upright ones, 8 stored
+ * rows by 8 columns at a time: each byte of the 8 x 8 bit transpose is one byte of a row of the upright image.
+ */
+static void *transposeBitsWorker(void *arg) {
+    struct orientJob *job = arg;
+    uint32_t width = job->height;
+    uint32_t height = job->width;
+    uint32_t u;
+
+    while ((u = atomic_fetch_add(&job->next, 1)) < job->units) {
+        size_t c0 = (size_t) (u % job->tilesAcross) * ORIENT_BITS_BAND;
+        size_t c1 = c0 + ORIENT_BITS_BAND < job->srcStride ? c0 + ORIENT_BITS_BAND : job->srcStride;
+        size_t g0 = (size_t) (u / job->tilesAcross) * ORIENT_BITS_BAND;
+        size_t g1 = g0 + ORIENT_BITS_BAND < job->dstStride ? g0 + ORIENT_BITS_BAND : job->dstStride;
+
+        for (size_t g = g0; g < g1; ++g) {
+            const uint8_t *rows[8];
+
+            for (uint32_t k = 0; k < 8; ++k) {
+                uint32_t x = 8 * g + k;
+                uint32_t sy = job->reverseRows ? job->height - 1 - x : x;
+
+                rows[k] = x < width ? job->src + sy * job->srcStride : NULL;
+            }
+
+            for (size_t c = c0; c < c1; ++c) {
+                uint64_t bits = 0;
+
+                for (int k = 0; k < 8; ++k)
+                    bits = bits << 8 | (rows[k] != NULL ? rows[k][c] : 0);
+
+                bits = transposeBits(bits);
+
+                for (uint32_t i = 0; i < 8 && 8 * c + i < height; ++i) {
+                    uint32_t y = job->reverseColumns ? height - 1 - (8 * c + i) : 8 * c + i;
+
+                    job->dst[y * job->dstStride + g] = (uint8_t) (bits >> (56 - 8 * i));
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* runs worker on the calling thread and threads - 1 more */
+static void runWorkers(struct orientJob *job, unsigned threads, void *(*worker)(void *)) {
+    pthread_t *workers;
+    unsigned started = 0;
+
+    workers = threads > 1 ? malloc(sizeof(pthread_t) * (threads - 1)) : NULL;
+
+    if (workers != NULL) {
+        for (; started < threads - 1; ++started) {
+            if (pthread_create(&workers[started], NULL, worker, job) != 0)
+                break;
+        }
+    }
+
+    worker(job);
+
+    for (unsigned i = 0; i < started; ++i)
+        pthread_join(workers[i], NULL);
+
+    free(workers);
+}
+
+bool orientImage(tiff_t tiff, uint16_t orientation, unsigned threads, struct tiffError *const err) {
+    struct orientJob job = {0};
+    bool transpose = orientation >= LEFT_TOP && orientation <= LEFT_BOTTOM;
+    uint8_t *data;
+    size_t size;
+
+    if (orientation <= TOP_LEFT || orientation > LEFT_BOTTOM)
+        return false;
+
+    if (atomic_load(&tiff->refs) > 1) {
+        err->error = SHARED_IMAGE;
+        return true;
+    }
+
+    /* the pixels of a mapping cannot be handed back to free */
+    if (transpose && tiff->map != NULL) {
+        err->error = MAP_ERROR;
+        return true;
+    }
+
+    job.src = tiff->data;
+    job.dst = tiff->data;
+    job.format = tiff->format;
+    job.pixelBytes = tiff->format == PACKED1 ? 1 : pixelBits(tiff->format) / 8;
+    job.width = tiff->width;
+    job.height = tiff->height;
+    job.srcStride = tiff->stride;
+    job.reverseRows = orientation == BOTTOM_RIGHT || orientation == BOTTOM_LEFT || orientation == RIGHT_TOP ||
+                      orientation == RIGHT_BOTTOM;
+    job.reverseColumns = orientation == TOP_RIGHT || orientation == BOTTOM_RIGHT || orientation == RIGHT_BOTTOM ||
+                         orientation == LEFT_BOTTOM;
+    threads = threads > 1 ? threads : 1;
+
+    if (!transpose) {
+        pthread_once(&once, pickKernel);
+        job.units = (tiff->height + FLIP_BAND - 1) / FLIP_BAND;
+        runWorkers(&job, threads < job.units ? threads : job.units, flipWorker);
+        return false;
+    }
+
+    job.dstStride = tiff->format == PACKED1 ? (tiff->height + 7) / 8 : tiff->height * job.pixelBytes;
+    size = job.dstStride * tiff->width;
+
+    if ((data = malloc(size ? size : 1)) == NULL) {
+        err->error = MALLOC_ERROR;
+        return true;
+    }
+
+    job.dst = data;
+
+    if (tiff->format == PACKED1) {
+        job.tilesAcross = (tiff->stride + ORIENT_BITS_BAND - 1) / ORIENT_BITS_BAND;
+        job.units = job.tilesAcross * ((job.dstStride + ORIENT_BITS_BAND - 1) / ORIENT_BITS_BAND);
+        runWorkers(&job, threads < job.units ? threads : job.units, transposeBitsWorker);
+    } else {
+        pthread_once(&once, pickKernel);
+        job.kernel = job.pixelBytes == 1 ? kernel : job.pixelBytes == 2 ? wordKernel : NULL;
+        job.blockSide = job.pixelBytes == 1 ? 16 : job.pixelBytes == 2 ? 8 : 0;
+        job.tile = job.pixelBytes <= 2 ? ORIENT_TILE : ORIENT_TILE / 2;
+        job.tilesAcross = (tiff->height + job.tile - 1) / job.tile;
+        job.units = job.tilesAcross * ((tiff->width + job.tile - 1) / job.tile);
+        runWorkers(&job, threads < job.units ? threads : job.units, transposeWorker);
+    }
+
+    free(tiff->data);
+    tiff->data = data;
+    tiff->capacity = size;
+    tiff->width = job.height;
+    tiff->height = job.width;
+    tiff->stride = job.dstStride;
+    return false;
+}
@@ -0,0 +1,43 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <stddef.h>
+#include "tiff.h"
+
+#ifndef SYSTEM_HW01_ORIENT_H
+#define SYSTEM_HW01_ORIENT_H
+
+/*
+ * transposes a 16 x 16 block of bytes: byte j of source row i, 16 bytes at src + i * srcStep, becomes
+ * byte i of row j at dst + j * dstStep. negative steps walk the rows upwards.
+ */
+typedef void (*transposeFn)(const uint8_t *src, ptrdiff_t srcStep, uint8_t *dst, ptrdiff_t dstStep);
+
+void transposeBlockScalar(const uint8_t *src, ptrdiff_t srcStep, uint8_t *dst, ptrdiff_t dstStep);
+
+/* the same for an 8 x 8 block of 2 byte pixels, 16 bytes of each row */
+void transposeWordsScalar(const uint8_t *src, ptrdiff_t srcStep, uint8_t *dst, ptrdiff_t dstStep);
+
+#if defined(__x86_64__) || defined(__i386__)
+
+void transposeBlockSSE2(const uint8_t *src, ptrdiff_t srcStep, uint8_t *dst, ptrdiff_t dstStep);
+
+void transposeWordsSSE2(const uint8_t *src, ptrdiff_t srcStep, uint8_t *dst, ptrdiff_t dstStep);
+
+#endif
+
+const char *transposeKernelName(void);
+
+/* transposes an 8 x 8 bit matrix, row 0 in the most significant byte and column 0 in the top bit of each */
+uint64_t transposeBits(uint64_t x);
+
+/*
+ * turns a decoded image upright, as the ORIENTATION tag of its file says it is shown. the flips of
+ * orientations 2 to 4 are done in place. 5 to 8 swap width and height, the image is transposed a square
+ * of cache blocks at a time into a buffer of its own that replaces data. any other value leaves it as it is.
+ * the work is split over threads, 0 or 1 does it on the calling thread. a shared image is refused.
+ */
+bool orientImage(tiff_t tiff, uint16_t orientation, unsigned threads, struct tiffError *const err);
+
+#endif //SYSTEM_HW01_ORIENT_H
@@ -0,0 +1,438 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <string.h>
+#include <pthread.h>
+#include "pages.h"
+#include "strip.h"
+
+#define INDEX_MAGIC "TIFFIDX"
+#define INDEX_VERSION 4
+
+struct tiffPages {
+    uint32_t count;
+    uint32_t capacity;
+    struct directory *pages;
+    /* guards the strip and tile tables, which are read on the first readPage of each page */
+    pthread_mutex_t lock;
+    /* identity of the file the chain was walked in, checked when a saved index is loaded */
+    uint64_t size;
+    int64_t mtime;
+    int64_t mtimeNsec;
+};
+
+/* a saved index is this header, then a record and the block offsets and byte counts for every page */
+struct indexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t size;
+    int64_t mtime;
+    int64_t mtimeNsec;
+};
+
+struct pageRecord {
+    uint32_t byteOrder;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bitsPerSample;
+    uint32_t samplesPerPixel;
+    uint32_t planar;
+    uint32_t photometric;
+    uint32_t compression;
+    uint32_t predictor;
+    uint32_t rowsPerStrip;
+    uint32_t fillOrder;
+    uint32_t t4Options;
+    uint32_t tileWidth;
+    uint32_t tileLength;
+    uint32_t orientation;
+    uint32_t blocks;
+};
+
+/* ifd offsets seen so far, open addressing with 0 as the empty slot since no ifd starts there */
+struct offsetSet {
+    uint64_t *slots;
+    size_t capacity;
+    size_t used;
+};
+
+static size_t slotOf(const struct offsetSet *set, uint64_t offset) {
+    size_t i = (size_t) (offset * 0x9E3779B97F4A7C15ull) & (set->capacity - 1);
+
+    while (set->slots[i] != 0 && set->slots[i] != offset)
+        i = (i + 1) & (set->capacity - 1);
+
+    return i;
+}
+
+/* returns true when offset was already in the set, or when growing it failed */
+static bool offsetSeen(struct offsetSet *set, uint64_t offset) {
+    size_t i;
+
+    if (2 * (set->used + 1) > set->capacity) {
+        struct offsetSet bigger = {calloc(set->capacity ? 2 * set->capacity : 64, sizeof(uint64_t)),
+                                   set->capacity ? 2 * set->capacity : 64, set->used};
+
+        if (bigger.slots == NULL)
+            return true;
+
+        for (size_t j = 0; j < set->capacity; ++j) {
+            if (set->slots[j] != 0)
+                bigger.slots[slotOf(&bigger, set->slots[j])] = set->slots[j];
+        }
+
+        free(set->slots);
+        *set = bigger;
+    }
+
+    i = slotOf(set, offset);
+
+    if (set->slots[i] == offset)
+        return true;
+
+    set->slots[i] = offset;
+    ++set->used;
+    return false;
+}
+
+static tiffPages_t newPages(int fd, struct tiffError *const err) {
+    tiffPages_t pages = calloc(1, sizeof(struct tiffPages));
+    struct stat st;
+
+    if (pages == NULL) {
+        err->error = MALLOC_ERROR;
+        return NULL;
+    }
+
+    if (fstat(fd, &st) == -1) {
+        free(pages);
+        err->data = fd;
+        err->error = READ_ERROR;
+        return NULL;
+    }
+
+    pthread_mutex_init(&pages->lock, NULL);
+    pages->size = st.st_size;
+    pages->mtime = st.st_mtim.tv_sec;
+    pages->mtimeNsec = st.st_mtim.tv_nsec;
+    return pages;
+}
+
+static struct directory *addPage(tiffPages_t pages) {
+    if (pages->count == pages->capacity) {
+        uint32_t capacity = pages->capacity ? 2 * pages->capacity : 16;
+        struct directory *p = realloc(pages->pages, sizeof(struct directory) * capacity);
+
+        if (p == NULL)
+            return NULL;
+
+        pages->pages = p;
+        pages->capacity = capacity;
+    }
+
+    return &pages->pages[pages->count];
+}
+
+tiffPages_t const pagesOpen(int fd, struct tiffError *const err) {
+    struct source src = {.fd = fd};
+    struct fileHeader header;
+    struct offsetSet seen = {0};
+    tiffPages_t pages;
+    uint64_t offset;
+
+    if (readHeader(&src, &header, err))
+        return NULL;
+
+    pages = newPages(fd, err);
+
+    if (pages == NULL)
+        return NULL;
+
+    /* one pass over the chain, a loop in it is corrupt data rather than an endless document */
+    for (offset = header.first; offset != 0;) {
+        struct directory *dir = addPage(pages);
+
+        if (dir == NULL || offsetSeen(&seen, offset)) {
+            err->data = offset;
+            err->error = dir == NULL ? MALLOC_ERROR : CORRUPT_DATA;
+            goto fail;
+        }
+
+        if (readIfd(&src, &header, offset, dir, &offset, err))
+            goto fail;
+
+        ++pages->count;
+    }
+
+    free(seen.slots);
+    return pages;
+
+fail:
+    free(seen.slots);
+    pagesClose(pages);
+    return NULL;
+}
+
+uint32_t pagesCount(tiffPages_t pages) {
+    return pages->count;
+}
+
+const struct directory *pagesDirectory(tiffPages_t pages, uint32_t page, struct source *src,
+                                      struct tiffError *const err) {
+    bool failed;
+
+    if (page >= pages->count) {
+        err->data = page;
+        err->error = OUT_OF_RANGE;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pages->lock);
+    failed = directoryLoad(src, &pages->pages[page], err);
+    pthread_mutex_unlock(&pages->lock);
+
+    return failed ? NULL : &pages->pages[page];
+}
+
+bool pageInfo(tiffPages_t pages, uint32_t page, struct tiffPageInfo *info) {
+    const struct directory *dir = page < pages->count ? &pages->pages[page] : NULL;
+
+    if (dir == NULL)
+        return true;
+
+    info->width = dir->width;
+    info->height = dir->height;
+    info->bitsPerSample = dir->bitsPerSample;
+    info->samplesPerPixel = dir->samplesPerPixel;
+    info->compression = dir->compression;
+    info->orientation = dir->orientation;
+    return false;
+}
+
+static bool writeAll(int fd, const void *buffer, size_t size) {
+    size_t total = 0;
+    ssize_t n;
+
+    while (total != size) {
+        n = write(fd, (const uint8_t *) buffer + total, size - total);
+
+        if (n <= 0)
+            return true;
+
+        total += n;
+    }
+
+    return false;
+}
+
+bool pagesSave(int fd, tiffPages_t pages, int indexFd, struct tiffError *const err) {
+    struct indexHeader header = {INDEX_MAGIC, INDEX_VERSION, pages->count, pages->size, pages->mtime,
+                                 pages->mtimeNsec};
+    struct source src = {.fd = fd};
+    size_t size = sizeof(header);
+    uint8_t *buffer __attribute__((__cleanup__(clean8))) = NULL;
+    uint8_t *p;
+
+    for (uint32_t i = 0; i < pages->count; ++i) {
+        const struct directory *dir = pagesDirectory(pages, i, &src, err);
+
+        if (dir == NULL)
+            return true;
+
+        size += sizeof(struct pageRecord) +
+                2 * sizeof(uint64_t) * (dir->tileWidth ? dir->tileCount : dir->stripCount);
+    }
+
+    /* the whole index goes out in one write */
+    buffer = malloc(size);
+
+    if (buffer == NULL) {
+        err->error = MALLOC_ERROR;
+        return true;
+    }
+
+    memcpy(buffer, &header, sizeof(header));
+    p = buffer + sizeof(header);
+
+    for (uint32_t i = 0; i < pages->count; ++i) {
+        const struct directory *dir = &pages->pages[i];
+        struct pageRecord record = {dir->byteOrder, dir->width, dir->height, dir->bitsPerSample,
+                                    dir->samplesPerPixel, dir->planar, dir->photometric, dir->compression,
+                                    dir->predictor, dir->rowsPerStrip, dir->fillOrder, dir->t4Options,
+                                    dir->tileWidth, dir->tileLength, dir->orientation,
+                                    dir->tileWidth ? dir->tileCount : dir->stripCount};
+        size_t tables = sizeof(uint64_t) * record.blocks;
+
+        memcpy(p, &record, sizeof(record));
+        memcpy(p + sizeof(record), dir->tileWidth ? dir->tileOffsets : dir->stripOffsets, tables);
+        memcpy(p + sizeof(record) + tables, dir->tileWidth ? dir->tileByteCounts : dir->stripByteCounts, tables);
+        p += sizeof(record) + 2 * tables;
+    }
+
+    if (writeAll(indexFd, buffer, size)) {
+        err->data = indexFd;
+        err->error = WRITE_ERROR;
+        return true;
+    }
+
+    return false;
+}
+
+/* parses one page record at p, returns the bytes it took or 0 if it does not fit in size */
+static size_t loadPage(const uint8_t *p, size_t size, struct directory *dir) {
+    struct pageRecord record;
+    size_t tables;
+    uint64_t needed;
+    uint64_t *offsets;
+    uint64_t *byteCounts;
+
+    if (size < sizeof(record))
+        return 0;
+
+    memcpy(&record, p, sizeof(record));
+    tables = sizeof(uint64_t) * record.blocks;
+
+    if (record.blocks == 0 || (size - sizeof(record)) / 2 < tables)
+        return 0;
+
+    memset(dir, 0, sizeof(*dir));
+    dir->byteOrder = (enum byteOrder) record.byteOrder;
+    dir->width = record.width;
+    dir->height = record.height;
+    dir->bitsPerSample = record.bitsPerSample;
+    dir->samplesPerPixel = record.samplesPerPixel;
+    dir->planar = record.planar;
+    dir->photometric = record.photometric;
+    dir->compression = record.compression;
+    dir->predictor = record.predictor;
+    dir->rowsPerStrip = record.rowsPerStrip;
+    dir->fillOrder = record.fillOrder;
+    dir->t4Options = record.t4Options;
+    dir->orientation = record.orientation;
+    dir->tileWidth = record.tileWidth;
+    dir->tileLength = record.tileLength;
+
+    /* the index is only a file on disk, its records get the same clamp readDirectory gives the tags */
+    if (dir->rowsPerStrip == 0 || dir->rowsPerStrip > dir->height)
+        dir->rowsPerStrip = dir->height;
+
+    if (dir->width == 0 || dir->height == 0 || (dir->tileWidth != 0 && dir->tileLength == 0))
+        return 0;
+
+    /* a record with fewer blocks than its geometry needs would send reads past the offset tables */
+    if (dir->tileWidth != 0)
+        needed = (uint64_t) tilesAcross(dir) * tilesDown(dir) * directoryPlanes(dir);
+    else
+        needed = (uint64_t) stripsUsed(dir) * directoryPlanes(dir);
+
+    if (record.blocks < needed)
+        return 0;
+
+    offsets = malloc(tables);
+    byteCounts = malloc(tables);
+
+    if (offsets == NULL || byteCounts == NULL) {
+        free(offsets);
+        free(byteCounts);
+        return 0;
+    }
+
+    memcpy(offsets, p + sizeof(record), tables);
+    memcpy(byteCounts, p + sizeof(record) + tables, tables);
+
+    if (dir->tileWidth != 0) {
+        dir->tileCount = record.blocks;
+        dir->tileOffsets = offsets;
+        dir->tileByteCounts = byteCounts;
+    } else {
+        dir->stripCount = record.blocks;
+        dir->stripOffsets = offsets;
+        dir->stripByteCounts = byteCounts;
+    }
+
+    return sizeof(record) + 2 * tables;
+}
+
+tiffPages_t const pagesLoad(int fd, int indexFd, struct tiffError *const err) {
+    struct indexHeader header;
+    struct stat st;
+    uint8_t *buffer __attribute__((__cleanup__(clean8))) = NULL;
+    const uint8_t *p;
+    size_t left;
+    tiffPages_t pages;
+
+    if (fstat(indexFd, &st) == -1 || st.st_size < (off_t) sizeof(header)) {
+        err->data = indexFd;
+        err->error = CORRUPT_DATA;
+        return NULL;
+    }
+
+    buffer = malloc(st.st_size);
+
+    if (buffer == NULL) {
+        err->error = MALLOC_ERROR;
+        return NULL;
+    }
+
+    if (preadAll(indexFd, buffer, st.st_size, 0)) {
+        err->data = indexFd;
+        err->error = READ_ERROR;
+        return NULL;
+    }
+
+    memcpy(&header, buffer, sizeof(header));
+
+    if (memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) != 0 || header.version != INDEX_VERSION) {
+        err->data = header.version;
+        err->error = CORRUPT_DATA;
+        return NULL;
+    }
+
+    pages = newPages(fd, err);
+
+    if (pages == NULL)
+        return NULL;
+
+    /* an index of an older version of the file would point at the wrong bytes */
+    if (pages->size != header.size || pages->mtime != header.mtime || pages->mtimeNsec != header.mtimeNsec) {
+        pagesClose(pages);
+        err->data = fd;
+        err->error = STALE_INDEX;
+        return NULL;
+    }
+
+    p = buffer + sizeof(header);
+    left = st.st_size - sizeof(header);
+
+    for (uint32_t i = 0; i < header.count; ++i) {
+        struct directory *dir = addPage(pages);
+        size_t used = dir != NULL ? loadPage(p, left, dir) : 0;
+
+        if (used == 0) {
+            pagesClose(pages);
+            err->data = i;
+            err->error = dir == NULL ? MALLOC_ERROR : CORRUPT_DATA;
+            return NULL;
+        }
+
+        ++pages->count;
+        p += used;
+        left -= used;
+    }
+
+    return pages;
+}
+
+void pagesClose(tiffPages_t pages) {
+    if (pages == NULL)
+        return;
+
+    for (uint32_t i = 0; i < pages->count; ++i)
+        directoryFree(&pages->pages[i]);
+
+    pthread_mutex_destroy(&pages->lock);
+    free(pages->pages);
+    free(pages);
+}
@@ -0,0 +1,14 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include "ifd.h"
+
+#ifndef SYSTEM_HW01_PAGES_H
+#define SYSTEM_HW01_PAGES_H
+
+/* the directory of a page with its strip or tile tables loaded, NULL past the last page or on a read error */
+const struct directory *pagesDirectory(tiffPages_t pages, uint32_t page, struct source *src,
+                                      struct tiffError *const err);
+
+#endif //SYSTEM_HW01_PAGES_H
@@ -0,0 +1,144 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "predict.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/* pixels wider than a vector are summed by the scalar kernels */
+#define PREDICT_MAX_PIXEL 16
+
+static predictFn kernel8;
+static predictFn kernel16;
+static const char *kernelName;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+void predictRow8Scalar(uint8_t *row, uint32_t width, uint16_t samples) {
+    size_t size = (size_t) width * samples;
+
+    for (size_t i = samples; i < size; ++i)
+        row[i] += row[i - samples];
+}
+
+void predictRow16Scalar(uint8_t *row, uint32_t width, uint16_t samples) {
+    uint16_t *p = (uint16_t *) row;
+    size_t size = (size_t) width * samples;
+
+    for (size_t i = samples; i < size; ++i)
+        p[i] += p[i - samples];
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+ * byte shuffles for a pixel of k bytes: shifts[k][s] moves a vector up by k << s bytes, zero filling,
+ * and carry[k] repeats the last pixel of a vector over a whole one, channel for channel. byte i of a
+ * vector belongs to the channel of byte 16 - k + i % k of the vector before, whatever the row offset.
+ */
+static uint8_t shifts[PREDICT_MAX_PIXEL + 1][4][16] __attribute__((aligned(16)));
+static uint8_t carry[PREDICT_MAX_PIXEL + 1][16] __attribute__((aligned(16)));
+static pthread_once_t masksOnce = PTHREAD_ONCE_INIT;
+
+static void buildMasks(void) {
+    for (int k = 1; k <= PREDICT_MAX_PIXEL; ++k) {
+        for (int i = 0; i < 16; ++i) {
+            for (int s = 0; s < 4; ++s)
+                shifts[k][s][i] = i >= k << s ? i - (k << s) : 0x80;
+            carry[k][i] = 16 - k + i % k;
+        }
+    }
+}
+
+/*
+ * a vector at a time: a log step prefix sum over the pixels inside it, then the running sums of the
+ * vector before it added on. wide rows hold 16 bit samples, which are added lane for lane.
+ */
+__attribute__((target("ssse3")))
+static void predictSSSE3(uint8_t *row, size_t size, size_t k, bool wide) {
+    size_t blocks = size / 16;
+    __m128i last = _mm_setzero_si128();
+
+    pthread_once(&masksOnce, buildMasks);
+
+    for (size_t b = 0; b < blocks; ++b) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (row + 16 * b));
+        __m128i c = _mm_shuffle_epi8(last, _mm_load_si128((const __m128i *) carry[k]));
+
+        for (int s = 0; s < 4 && k << s < 16; ++s) {
+            __m128i shifted = _mm_shuffle_epi8(v, _mm_load_si128((const __m128i *) shifts[k][s]));
+            v = wide ? _mm_add_epi16(v, shifted) : _mm_add_epi8(v, shifted);
+        }
+
+        last = wide ? _mm_add_epi16(v, c) : _mm_add_epi8(v, c);
+        _mm_storeu_si128((__m128i *) (row + 16 * b), last);
+    }
+
+    /* the rest of the row, never less than a pixel in */
+    for (size_t i = blocks == 0 ? k : 16 * blocks; i < size; i += wide ? 2 : 1) {
+        if (wide) {
+            uint16_t v, before;
+
+            memcpy(&v, row + i, sizeof(v));
+            memcpy(&before, row + i - k, sizeof(before));
+            v += before;
+            memcpy(row + i, &v, sizeof(v));
+        } else {
+            row[i] += row[i - k];
+        }
+    }
+}
+
+__attribute__((target("ssse3")))
+void predictRow8SSSE3(uint8_t *row, uint32_t width, uint16_t samples) {
+    if (samples > PREDICT_MAX_PIXEL)
+        predictRow8Scalar(row, width, samples);
+    else
+        predictSSSE3(row, (size_t) width * samples, samples, false);
+}
+
+__attribute__((target("ssse3")))
+void predictRow16SSSE3(uint8_t *row, uint32_t width, uint16_t samples) {
+    if (2 * samples > PREDICT_MAX_PIXEL)
+        predictRow16Scalar(row, width, samples);
+    else
+        predictSSSE3(row, 2 * (size_t) width * samples, 2 * samples, true);
+}
+
+#endif
+
+static void pickKernel(void) {
+    kernel8 = predictRow8Scalar;
+    kernel16 = predictRow16Scalar;
+    kernelName = "scalar";
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("ssse3")) {
+        kernel8 = predictRow8SSSE3;
+        kernel16 = predictRow16SSSE3;
+        kernelName = "ssse3";
+    }
+#endif
+}
+
+void predictRow8(uint8_t *row, uint32_t width, uint16_t samples) {
+    pthread_once(&once, pickKernel);
+    kernel8(row, width, samples);
+}
+
+void predictRow16(uint8_t *row, uint32_t width, uint16_t samples) {
+    pthread_once(&once, pickKernel);
+    kernel16(row, width, samples);
+}
+
+const char *predictKernelName(void) {
+    pthread_once(&once, pickKernel);
+    return kernelName;
+}
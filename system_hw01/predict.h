@@ -0,0 +1,37 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef SYSTEM_HW01_PREDICT_H
+#define SYSTEM_HW01_PREDICT_H
+
+/*
+ * undoes horizontal differencing, predictor 2, over one row in place: every sample has the sample of
+ * the same channel in the pixel before it added, a prefix sum per channel. 16 bit rows hold samples in
+ * host byte order.
+ */
+typedef void (*predictFn)(uint8_t *row, uint32_t width, uint16_t samples);
+
+void predictRow8Scalar(uint8_t *row, uint32_t width, uint16_t samples);
+
+void predictRow16Scalar(uint8_t *row, uint32_t width, uint16_t samples);
+
+#if defined(__x86_64__) || defined(__i386__)
+
+void predictRow8SSSE3(uint8_t *row, uint32_t width, uint16_t samples);
+
+void predictRow16SSSE3(uint8_t *row, uint32_t width, uint16_t samples);
+
+#endif
+
+/* the fastest kernels the running cpu supports, picked on first use */
+void predictRow8(uint8_t *row, uint32_t width, uint16_t samples);
+
+void predictRow16(uint8_t *row, uint32_t width, uint16_t samples);
+
+const char *predictKernelName(void);
+
+#endif //SYSTEM_HW01_PREDICT_H
@@ -0,0 +1,345 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <string.h>
+#include <pthread.h>
+#include "stream.h"
+#include "shrink.h"
+#include "writer.h"
+
+/* a level fits in this tile when none is asked for */
+#define PYRAMID_TILE 256
+
+/* levels made when none are asked for stop once one fits in a tile, and never go past this many */
+#define PYRAMID_LEVELS 32
+
+/* rows handed down from a level to the one below it that wait to be taken */
+#define QUEUE_ROWS 8
+
+/* NewSubfileType of a reduced resolution version of another image */
+#define REDUCED_IMAGE 1
+
+/* a ring of rows from one thread to another, the producer copies into free slots outside of the lock */
+struct rowQueue {
+    uint8_t *rows;
+    size_t rowBytes;
+    uint32_t head;
+    uint32_t count;
+    bool done;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t space;
+};
+
+struct level {
+    struct pyramid *job;
+    /* of the level, and of the one above it that its rows come from */
+    uint32_t width;
+    uint32_t height;
+    uint32_t inHeight;
+    struct rowQueue queue;
+    struct shrink shrink;
+    uint8_t *out;
+    tiffWriter_t writer;
+    /* where its ifd went once finished */
+    uint32_t offset;
+    pthread_t thread;
+    struct tiffError err;
+    bool failed;
+};
+
+struct pyramid {
+    /* the base image and its reductions, the base read on the calling thread */
+    struct level *levels;
+    uint32_t count;
+    atomic_bool failed;
+};
+
+static bool queueInit(struct rowQueue *queue, size_t rowBytes) {
+    queue->rows = malloc(rowBytes * QUEUE_ROWS);
+    queue->rowBytes = rowBytes;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->ready, NULL);
+    pthread_cond_init(&queue->space, NULL);
+    return queue->rows == NULL;
+}
+
+static void queueFree(struct rowQueue *queue) {
+    if (queue->rowBytes == 0)
+        return;
+
+    free(queue->rows);
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->ready);
+    pthread_cond_destroy(&queue->space);
+}
+
+static void queuePush(struct rowQueue *queue, const uint8_t *row) {
+    uint32_t slot;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == QUEUE_ROWS)
+        pthread_cond_wait(&queue->space, &queue->lock);
+    slot = (queue->head + queue->count) % QUEUE_ROWS;
+    pthread_mutex_unlock(&queue->lock);
+
+    /* the one consumer never looks past count, so the slot is the producer's alone until it is counted */
+    memcpy(queue->rows + slot * queue->rowBytes, row, queue->rowBytes);
+
+    pthread_mutex_lock(&queue->lock);
+    ++queue->count;
+    pthread_cond_signal(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/* the oldest row, left in the queue until queuePop, or NULL once the queue is closed and empty */
+static const uint8_t *queuePeek(struct rowQueue *queue) {
+    const uint8_t *row = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && !queue->done)
+        pthread_cond_wait(&queue->ready, &queue->lock);
+    if (queue->count != 0)
+        row = queue->rows + queue->head * queue->rowBytes;
+    pthread_mutex_unlock(&queue->lock);
+    return row;
+}
+
+static void queuePop(struct rowQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->head = (queue->head + 1) % QUEUE_ROWS;
+    --queue->count;
+    pthread_cond_signal(&queue->space);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void queueClose(struct rowQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->done = true;
+    pthread_cond_broadcast(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/* the level the rows of this one are handed down to, NULL for the smallest */
+static struct level *nextLevel(struct level *level) {
+    return (uint32_t) (level - level->job->levels) + 1 < level->job->count ? level + 1 : NULL;
+}
+
+/* row y of the level above goes into the box row it belongs to, which goes out once whole */
+static bool shrinkRow(struct level *level, const uint8_t *row, uint32_t y) {
+    struct level *next = nextLevel(level);
+
+    /* rows are given to shrinkRows as if they were the first box row, so that it always emits to out */
+    shrinkRows(&level->shrink, row, false, y & 1, 1, y + 1 == level->inHeight ? (y & 1) + 1 : 2, level->out);
+
+    if ((y & 1) == 0 && y + 1 != level->inHeight)
+        return false;
+
+    if (writerRows(level->writer, level->out, 1, &level->err))
+        return true;
+
+    if (next != NULL)
+        queuePush(&next->queue, level->out);
+
+    return false;
+}
+
+/*
+ * halves the rows of the level above as they come. after a failure anywhere the rows are still taken,
+ * so that no level above waits on a full queue, but nothing more is done with them.
+ */
+static void *levelWorker(void *arg) {
+    struct level *level = arg;
+    struct pyramid *job = level->job;
+    struct level *next = nextLevel(level);
+    const uint8_t *row;
+    uint32_t y = 0;
+
+    while ((row = queuePeek(&level->queue)) != NULL) {
+        if (!atomic_load(&job->failed) && shrinkRow(level, row, y++)) {
+            level->failed = true;
+            atomic_store(&job->failed, true);
+        }
+
+        queuePop(&level->queue);
+    }
+
+    if (next != NULL)
+        queueClose(&next->queue);
+
+    /* levels are finished on their own threads too, the ifd of each goes wherever the end is then */
+    if (!atomic_load(&job->failed)) {
+        level->failed = writerFinish(level->writer, REDUCED_IMAGE, NULL, 0, &level->offset, &level->err);
+        level->writer = NULL;
+
+        if (level->failed)
+            atomic_store(&job->failed, true);
+    }
+
+    return NULL;
+}
+
+static void pyramidFree(struct pyramid *job) {
+    for (uint32_t i = 0; i < job->count; ++i) {
+        queueFree(&job->levels[i].queue);
+        shrinkFree(&job->levels[i].shrink);
+        free(job->levels[i].out);
+        writerAbort(job->levels[i].writer);
+    }
+
+    free(job->levels);
+}
+
+/* the levels below the base, halving until one fits in a tile when levels is 0, or until a single pixel */
+static uint32_t countLevels(uint32_t width, uint32_t height, unsigned levels, const struct tiffWriteOptions *tiles) {
+    uint32_t count = 0;
+
+    while ((width > 1 || height > 1) &&
+           (levels != 0 ? count < levels : count < PYRAMID_LEVELS &&
+                                           (width > tiles->tileWidth || height > tiles->tileLength))) {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        ++count;
+    }
+
+    return count;
+}
+
+/* opens the writer of every level and the queue and box filter of every one below the base */
+static bool pyramidInit(struct pyramid *job, tiffStream_t stream, int out, const struct tiffWriteOptions *tiles,
+                        atomic_uint_fast64_t *end, struct tiffError *const err) {
+    for (uint32_t i = 0; i < job->count; ++i) {
+        struct level *level = &job->levels[i];
+
+        level->job = job;
+        level->width = i == 0 ? stream->width : (level[-1].width + 1) / 2;
+        level->height = i == 0 ? stream->height : (level[-1].height + 1) / 2;
+        level->writer = writerOpenShared(out, level->width, level->height, GRAY8, tiles, end, err);
+
+        if (level->writer == NULL)
+            return true;
+
+        if (i == 0)
+            continue;
+
+        level->inHeight = level[-1].height;
+
+        if (queueInit(&level->queue, level[-1].width) || shrinkInit(&level->shrink, level[-1].width, 2) ||
+            (level->out = malloc(level->width)) == NULL) {
+            err->error = MALLOC_ERROR;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* streams the base to its writer and to the queue of the first reduction */
+static bool pyramidBase(struct pyramid *job, tiffStream_t stream, struct tiffError *const err) {
+    struct level *base = &job->levels[0];
+    const uint8_t *rows;
+    uint32_t first;
+    uint32_t count;
+
+    while (!atomic_load(&job->failed)) {
+        if (streamNextRows(stream, &rows, &first, &count, err))
+            return true;
+
+        if (count == 0)
+            break;
+
+        if (writerRows(base->writer, rows, count, err))
+            return true;
+
+        for (uint32_t i = 0; i < count && job->count > 1; ++i)
+            queuePush(&job->levels[1].queue, rows + i * (size_t) stream->width);
+    }
+
+    return false;
+}
+
+bool writePyramid(int in, int out, unsigned levels, const struct tiffWriteOptions *const opts,
+                  struct tiffError *const err) {
+    struct tiffWriteOptions tiles = opts != NULL ? *opts : (struct tiffWriteOptions) {0};
+    struct pyramid job = {0};
+    atomic_uint_fast64_t end = 8;
+    uint32_t *offsets __attribute__((__cleanup__(clean32))) = NULL;
+    uint32_t started = 1;
+    uint32_t base;
+    tiffStream_t stream;
+    bool failed;
+
+    if (tiles.tileWidth == 0 && tiles.tileLength == 0)
+        tiles.tileWidth = tiles.tileLength = PYRAMID_TILE;
+
+    /* a row of tiles at a time, or whole strips when they are compressed */
+    if ((stream = streamOpen(in, tiles.tileLength, err)) == NULL)
+        return true;
+
+    /* rows come from the stream as readFD decodes them, one byte a pixel for gray images of up to 8 bits */
+    if (directoryPixelBytes(&stream->dir) != 1 || stream->dir.photometric == RGB) {
+        err->data = stream->dir.bitsPerSample;
+        err->error = UNSUPPORTED_SAMPLE_SIZE;
+        streamClose(stream);
+        return true;
+    }
+
+    job.count = 1 + countLevels(stream->width, stream->height, levels, &tiles);
+    job.levels = calloc(job.count, sizeof(struct level));
+    offsets = malloc(sizeof(uint32_t) * job.count);
+
+    if (job.levels == NULL || offsets == NULL) {
+        err->error = MALLOC_ERROR;
+        free(job.levels);
+        streamClose(stream);
+        return true;
+    }
+
+    if (pyramidInit(&job, stream, out, &tiles, &end, err)) {
+        pyramidFree(&job);
+        streamClose(stream);
+        return true;
+    }
+
+    for (; started < job.count; ++started) {
+        if (pthread_create(&job.levels[started].thread, NULL, levelWorker, &job.levels[started]) != 0) {
+            err->error = MALLOC_ERROR;
+            atomic_store(&job.failed, true);
+            break;
+        }
+    }
+
+    failed = atomic_load(&job.failed) || pyramidBase(&job, stream, err);
+
+    if (failed)
+        atomic_store(&job.failed, true);
+
+    /* every level closes the queue of the next once its own is drained */
+    if (job.count > 1)
+        queueClose(&job.levels[1].queue);
+
+    for (uint32_t i = 1; i < started; ++i)
+        pthread_join(job.levels[i].thread, NULL);
+
+    streamClose(stream);
+
+    for (uint32_t i = 1; i < job.count && !failed; ++i) {
+        if (job.levels[i].failed) {
+            *err = job.levels[i].err;
+            failed = true;
+        }
+
+        offsets[i - 1] = job.levels[i].offset;
+    }
+
+    /* the base ifd last, once it knows where the ifds of the levels are */
+    if (!failed) {
+        failed = writerFinish(job.levels[0].writer, 0, offsets, job.count - 1, &base, err) ||
+                 writerHeader(out, base, err);
+        job.levels[0].writer = NULL;
+    }
+
+    pyramidFree(&job);
+    return failed;
+}
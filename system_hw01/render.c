@@ -0,0 +1,203 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <string.h>
+#include <pthread.h>
+#include "render.h"
+#include "ifd.h"
+#include "unpack.h"
+
+/* rows are gathered up to about this many bytes before every write */
+#define RENDER_BLOCK (1 << 20)
+
+/* the text of every gray level, and of the 8 pixels of a packed byte */
+static char grayText[256];
+static uint64_t packedText[256];
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static void buildTables(void) {
+    for (int v = 0; v < 256; ++v) {
+        char text[8];
+
+        grayText[v] = (char) (v == 0 ? '0' : v == 255 ? '1' : 'X');
+
+        for (int i = 0; i < 8; ++i)
+            text[i] = (char) (v & (0x80 >> i) ? '0' : '1');
+
+        memcpy(&packedText[v], text, sizeof(text));
+    }
+}
+
+struct output {
+    int fd;
+    uint8_t *buffer;
+    size_t size;
+    size_t used;
+};
+
+static bool flush(struct output *out) {
+    size_t total = 0;
+    ssize_t n;
+
+    while (total != out->used) {
+        n = write(out->fd, out->buffer + total, out->used - total);
+
+        if (n <= 0)
+            return true;
+
+        total += n;
+    }
+
+    out->used = 0;
+    return false;
+}
+
+/* room for size more bytes, flushing what is gathered first when they would not fit */
+static uint8_t *reserve(struct output *out, size_t size) {
+    if (out->used + size > out->size && flush(out))
+        return NULL;
+
+    out->used += size;
+    return out->buffer + out->used - size;
+}
+
+static void textRow(tiff_t tiff, uint32_t y, uint8_t *dst) {
+    const uint8_t *row = tiffRow(tiff, y);
+
+    if (tiff->format == PACKED1) {
+        uint32_t bytes = tiff->width / 8;
+
+        for (uint32_t i = 0; i < bytes; ++i)
+            memcpy(dst + 8 * i, &packedText[row[i]], 8);
+
+        for (uint32_t x = 8 * bytes; x < tiff->width; ++x)
+            dst[x] = row[x / 8] & (0x80 >> x % 8) ? '0' : '1';
+    } else if (tiff->format == GRAY8) {
+        for (uint32_t x = 0; x < tiff->width; ++x)
+            dst[x] = grayText[row[x]];
+    } else {
+        for (uint32_t x = 0; x < tiff->width; ++x)
+            dst[x] = grayText[tiffPixel(tiff, x, y)];
+    }
+
+    dst[tiff->width] = '\n';
+}
+
+/* pbm sets a bit for black, as packed rows already do */
+static void pbmRow(tiff_t tiff, uint32_t y, uint8_t *dst) {
+    const uint8_t *row = tiffRow(tiff, y);
+    size_t bytes = (tiff->width + 7) / 8;
+
+    if (tiff->format == PACKED1) {
+        memcpy(dst, row, bytes);
+        return;
+    }
+
+    memset(dst, 0, bytes);
+
+    for (uint32_t x = 0; x < tiff->width; ++x)
+        dst[x / 8] |= (tiff->format == GRAY8 ? row[x] : tiffPixel(tiff, x, y)) < 128 ? 0x80 >> x % 8 : 0;
+}
+
+/* netpbm samples wider than a byte are big endian */
+static void copyBigEndian(const uint8_t *row, size_t count, uint8_t *dst) {
+    if (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+        swapBytes16(row, dst, count);
+    else
+        memcpy(dst, row, 2 * count);
+}
+
+static void pgmRow(tiff_t tiff, uint32_t y, uint8_t *dst) {
+    const uint8_t *row = tiffRow(tiff, y);
+
+    if (tiff->format == PACKED1) {
+        unpackRow(row, tiff->width, dst, 0xFF);
+    } else if (tiff->format == GRAY8) {
+        memcpy(dst, row, tiff->width);
+    } else if (tiff->format == GRAY16) {
+        copyBigEndian(row, tiff->width, dst);
+    } else {
+        for (uint32_t x = 0; x < tiff->width; ++x)
+            dst[x] = tiffPixel(tiff, x, y);
+    }
+}
+
+/* gray images repeat their sample three times */
+static void ppmRow(tiff_t tiff, uint32_t y, uint8_t *dst) {
+    const uint8_t *row = tiffRow(tiff, y);
+    size_t sampleBytes = tiff->format == GRAY16 || tiff->format == RGB48 ? 2 : 1;
+
+    if (tiff->format == RGB24) {
+        memcpy(dst, row, 3 * (size_t) tiff->width);
+        return;
+    }
+
+    if (tiff->format == RGB48) {
+        copyBigEndian(row, 3 * (size_t) tiff->width, dst);
+        return;
+    }
+
+    /* the gray row goes to the last third of dst, where spreading it never overwrites what is still needed */
+    pgmRow(tiff, y, dst + 2 * sampleBytes * tiff->width);
+
+    for (uint32_t x = 0; x < tiff->width; ++x) {
+        const uint8_t *v = dst + (2 * (size_t) tiff->width + x) * sampleBytes;
+
+        for (int c = 0; c < 3; ++c)
+            memmove(dst + (3 * (size_t) x + c) * sampleBytes, v, sampleBytes);
+    }
+}
+
+bool renderImage(int fd, tiff_t tiff, enum renderFormat format, struct tiffError *const err) {
+    /* only 16 bit images keep their depth, in a pgm when gray and a ppm otherwise */
+    bool deep = tiff->format == GRAY16 || (format == RENDER_PPM && tiff->format == RGB48);
+    size_t rowSize = format == RENDER_TEXT ? tiff->width + 1
+                   : format == RENDER_PBM ? (tiff->width + 7) / 8
+                   : (size_t) tiff->width * (format == RENDER_PPM ? 3 : 1) * (deep ? 2 : 1);
+    struct output out = {fd, NULL, rowSize > RENDER_BLOCK ? rowSize : RENDER_BLOCK, 0};
+    static const char *const magic[] = {"", "P4", "P5", "P6"};
+    uint8_t *buffer __attribute__((__cleanup__(clean8))) = malloc(out.size);
+    int header;
+
+    pthread_once(&once, buildTables);
+    out.buffer = buffer;
+
+    if (buffer == NULL) {
+        err->error = MALLOC_ERROR;
+        return true;
+    }
+
+    if (format != RENDER_TEXT) {
+        header = snprintf((char *) buffer, out.size, "%s\n%u %u\n%s", magic[format], tiff->width, tiff->height,
+                          format == RENDER_PBM ? "" : deep ? "65535\n" : "255\n");
+        out.used = header;
+    }
+
+    for (uint32_t y = 0; y < tiff->height; ++y) {
+        uint8_t *dst = reserve(&out, rowSize);
+
+        if (dst == NULL) {
+            err->data = fd;
+            err->error = WRITE_ERROR;
+            return true;
+        }
+
+        if (format == RENDER_TEXT)
+            textRow(tiff, y, dst);
+        else if (format == RENDER_PBM)
+            pbmRow(tiff, y, dst);
+        else if (format == RENDER_PGM)
+            pgmRow(tiff, y, dst);
+        else
+            ppmRow(tiff, y, dst);
+    }
+
+    if (flush(&out)) {
+        err->data = fd;
+        err->error = WRITE_ERROR;
+        return true;
+    }
+
+    return false;
+}
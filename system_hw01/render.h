@@ -0,0 +1,26 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include "tiff.h"
+
+#ifndef SYSTEM_HW01_RENDER_H
+#define SYSTEM_HW01_RENDER_H
+
+/*
+ * writes the image to fd a block of formatted rows at a time, in any pixel format.
+ * text is a line of '0' for black, '1' for white and 'X' for gray pixels per row,
+ * pbm is a binary P4 bitmap thresholded at the middle gray, pgm a binary P5 graymap
+ * and ppm a binary P6 pixmap. 16 bit samples keep their depth in a pgm of a gray
+ * image and in a ppm, color goes to gray everywhere else.
+ */
+enum renderFormat {
+    RENDER_TEXT,
+    RENDER_PBM,
+    RENDER_PGM,
+    RENDER_PPM
+};
+
+bool renderImage(int fd, tiff_t tiff, enum renderFormat format, struct tiffError *const err);
+
+#endif //SYSTEM_HW01_RENDER_H
@@ -0,0 +1,210 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <string.h>
+#include <pthread.h>
+#include "shrink.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/* black pixels in each group of scale bits of a byte, one count per byte lane in memory order */
+static uint32_t lut2[256];
+static uint16_t lut4[256];
+static uint8_t lut8[256];
+static pthread_once_t lutOnce = PTHREAD_ONCE_INIT;
+
+static void buildLuts(void) {
+    for (int b = 0; b < 256; ++b) {
+        uint8_t counts[4] = {0};
+
+        for (int i = 0; i < 8; ++i)
+            counts[i / 2] += b >> (7 - i) & 1;
+        memcpy(&lut2[b], counts, sizeof(lut2[b]));
+
+        counts[0] = counts[0] + counts[1];
+        counts[1] = counts[2] + counts[3];
+        memcpy(&lut4[b], counts, sizeof(lut4[b]));
+
+        lut8[b] = counts[0] + counts[1];
+    }
+}
+
+bool shrinkInit(struct shrink *shrink, uint32_t width, uint32_t scale) {
+    pthread_once(&lutOnce, buildLuts);
+    memset(shrink, 0, sizeof(*shrink));
+    shrink->scale = scale;
+    shrink->width = width;
+    shrink->outWidth = (width + scale - 1) / scale;
+    shrink->columns = calloc(width, sizeof(uint16_t));
+    /* every byte of a packed row adds to 8 / scale boxes, the ones past the edge only ever get 0 */
+    shrink->boxes = calloc((width + 7) / 8 * 8 / scale, sizeof(uint8_t));
+
+    return shrink->columns == NULL || shrink->boxes == NULL;
+}
+
+void shrinkFree(struct shrink *shrink) {
+    free(shrink->columns);
+    free(shrink->boxes);
+    shrink->columns = NULL;
+    shrink->boxes = NULL;
+    clean8(&shrink->band);
+    shrink->bandSize = 0;
+}
+
+uint8_t *shrinkBand(struct shrink *shrink, size_t rowBytes, uint32_t rows) {
+    if (rowBytes * rows > shrink->bandSize) {
+        uint8_t *p = realloc(shrink->band, rowBytes * rows);
+
+        if (p == NULL)
+            return NULL;
+
+        shrink->band = p;
+        shrink->bandSize = rowBytes * rows;
+    }
+
+    return shrink->band;
+}
+
+/*
+ * a table lookup gives the counts of all the boxes a byte touches at once, added to them as one
+ * word. a box never holds more than 64, so the lanes of the word cannot carry into each other.
+ */
+static void addPacked(struct shrink *shrink, const uint8_t *row) {
+    size_t bytes = (shrink->width + 7) / 8;
+    uint8_t *boxes = shrink->boxes;
+
+    switch (shrink->scale) {
+        case 2:
+            for (size_t i = 0; i < bytes; ++i) {
+                uint32_t v;
+                memcpy(&v, boxes + 4 * i, sizeof(v));
+                v += lut2[row[i]];
+                memcpy(boxes + 4 * i, &v, sizeof(v));
+            }
+            break;
+        case 4:
+            for (size_t i = 0; i < bytes; ++i) {
+                uint16_t v;
+                memcpy(&v, boxes + 2 * i, sizeof(v));
+                v += lut4[row[i]];
+                memcpy(boxes + 2 * i, &v, sizeof(v));
+            }
+            break;
+        default:
+            for (size_t i = 0; i < bytes; ++i)
+                boxes[i] += lut8[row[i]];
+    }
+}
+
+/* rows are summed down the columns first, the boxes across are only added up once per box row */
+static void addGray(struct shrink *shrink, const uint8_t *row) {
+    uint32_t x = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; x + 16 <= shrink->width; x += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (row + x));
+        __m128i *columns = (__m128i *) (shrink->columns + x);
+
+        _mm_storeu_si128(columns, _mm_add_epi16(_mm_loadu_si128(columns), _mm_unpacklo_epi8(v, zero)));
+        _mm_storeu_si128(columns + 1, _mm_add_epi16(_mm_loadu_si128(columns + 1), _mm_unpackhi_epi8(v, zero)));
+    }
+#endif
+
+    for (; x < shrink->width; ++x)
+        shrink->columns[x] += row[x];
+}
+
+/* whole boxes of a full box row, scale is a constant at every call so the inner loop unrolls */
+static inline __attribute__((always_inline))
+void emitWhole(const uint16_t *columns, uint32_t boxes, uint32_t scale, uint8_t *out) {
+    uint32_t shift = 2 * __builtin_ctz(scale);
+
+    for (uint32_t x = 0; x < boxes; ++x) {
+        uint32_t sum = 0;
+
+        for (uint32_t c = 0; c < scale; ++c)
+            sum += columns[x * scale + c];
+
+        out[x] = (uint8_t) ((sum + (1u << shift >> 1)) >> shift);
+    }
+}
+
+/* averages the box row into out and clears the sums for the next one */
+static void emitRow(struct shrink *shrink, bool packed, uint8_t *out) {
+    uint32_t x = 0;
+
+    /* the gray of a whole packed box only depends on its count, at most 64 */
+    if (packed && shrink->rows == shrink->scale) {
+        uint32_t n = shrink->scale * shrink->scale;
+        uint8_t levels[65];
+
+        for (uint32_t b = 0; b <= n; ++b)
+            levels[b] = (uint8_t) ((255 * (n - b) + n / 2) / n);
+
+        for (; x < shrink->width / shrink->scale; ++x)
+            out[x] = levels[shrink->boxes[x]];
+    }
+
+    if (!packed && shrink->rows == shrink->scale) {
+        x = shrink->width / shrink->scale;
+
+        switch (shrink->scale) {
+            case 2:
+                emitWhole(shrink->columns, x, 2, out);
+                break;
+            case 4:
+                emitWhole(shrink->columns, x, 4, out);
+                break;
+            default:
+                emitWhole(shrink->columns, x, 8, out);
+        }
+    }
+
+    for (; x < shrink->outWidth; ++x) {
+        uint32_t left = x * shrink->scale;
+        uint32_t cols = shrink->width - left < shrink->scale ? shrink->width - left : shrink->scale;
+        uint32_t n = cols * shrink->rows;
+        uint32_t sum = 0;
+
+        if (packed) {
+            sum = 255 * (n - shrink->boxes[x]);
+        } else {
+            for (uint32_t c = left; c < left + cols; ++c)
+                sum += shrink->columns[c];
+        }
+
+        /* whole boxes hold a power of two pixels, a shift saves the division */
+        out[x] = (uint8_t) ((n & (n - 1)) == 0 ? (sum + n / 2) >> __builtin_ctz(n) : (sum + n / 2) / n);
+    }
+
+    if (packed)
+        memset(shrink->boxes, 0, (shrink->width + 7) / 8 * 8 / shrink->scale);
+    else
+        memset(shrink->columns, 0, sizeof(uint16_t) * shrink->width);
+
+    shrink->rows = 0;
+}
+
+void shrinkRows(struct shrink *shrink, const uint8_t *rows, bool packed, uint32_t first, uint32_t count,
+                uint32_t height, uint8_t *out) {
+    size_t rowBytes = packed ? (shrink->width + 7) / 8 : shrink->width;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t y = first + i;
+
+        if (packed)
+            addPacked(shrink, rows + i * rowBytes);
+        else
+            addGray(shrink, rows + i * rowBytes);
+
+        ++shrink->rows;
+
+        if (y % shrink->scale == shrink->scale - 1 || y == height - 1)
+            emitRow(shrink, packed, out + (size_t) (y / shrink->scale) * shrink->outWidth);
+    }
+}
@@ -0,0 +1,44 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include "strip.h"
+
+#ifndef SYSTEM_HW01_SHRINK_H
+#define SYSTEM_HW01_SHRINK_H
+
+/*
+ * box filters decoded rows down by scale in both directions, one output row at a time, so that only
+ * the rows of the current box and a row of sums are ever held. boxes on the right and bottom edges
+ * average the pixels they have.
+ */
+struct shrink {
+    uint32_t scale;
+    uint32_t width;
+    uint32_t outWidth;
+    /* rows added so far, of the box row being gathered */
+    uint32_t rows;
+    /* sums of every column, for rows of one byte per pixel */
+    uint16_t *columns;
+    /* black pixels of every box, for packed rows. a box holds at most 64 */
+    uint8_t *boxes;
+    /* decoded rows waiting to be added, see shrinkBand */
+    uint8_t *band;
+    size_t bandSize;
+};
+
+bool shrinkInit(struct shrink *shrink, uint32_t width, uint32_t scale);
+
+void shrinkFree(struct shrink *shrink);
+
+/* a buffer for rows of the given bytes each, reused from one call to the next */
+uint8_t *shrinkBand(struct shrink *shrink, size_t rowBytes, uint32_t rows);
+
+/*
+ * adds count rows starting at image row first, either packed 1 bit rows with a set bit black or one
+ * byte per pixel. every finished output row is written to its place in out, which is outWidth wide.
+ */
+void shrinkRows(struct shrink *shrink, const uint8_t *rows, bool packed, uint32_t first, uint32_t count,
+                uint32_t height, uint8_t *out);
+
+#endif //SYSTEM_HW01_SHRINK_H
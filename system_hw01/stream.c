@@ -0,0 +1,139 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include "stream.h"
+
+/* the largest folio the page cache may hold a file in, a huge page */
+#define DROP_FOLIO (2u << 20)
+
+tiffStream_t streamOpen(int fd, uint32_t maxRows, struct tiffError *const err) {
+    struct source src = {.fd = fd};
+    tiffStream_t stream = calloc(1, sizeof(struct tiffStream));
+
+    if (stream == NULL) {
+        err->error = MALLOC_ERROR;
+        return NULL;
+    }
+
+    if (readDirectory(&src, &stream->dir, err) || checkDirectory(&stream->dir, err)) {
+        streamClose(stream);
+        return NULL;
+    }
+
+    stream->fd = fd;
+    stream->width = stream->dir.width;
+    stream->height = stream->dir.height;
+    stream->block = maxRows != 0 && maxRows < stream->dir.rowsPerStrip ? maxRows : stream->dir.rowsPerStrip;
+
+    /* compressed strips can only be decoded whole */
+    if (stream->dir.compression != NO_COMPRESSION)
+        stream->block = stream->dir.rowsPerStrip;
+
+    /* a row of tiles is the smallest unit a tiled image can be read in */
+    if (stream->dir.tileWidth != 0)
+        stream->block = stream->dir.tileLength;
+
+    /* the kernel reads ahead of strips stored in order by itself */
+    stream->refill = storedInOrder(&stream->dir) ? UINT32_MAX : 0;
+    stream->dropped = (stream->dir.tileWidth != 0 ? stream->dir.tileOffsets[0] : stream->dir.stripOffsets[0]) &
+                      ~(uint64_t) 4095;
+
+    stream->rows = malloc(sizeof(uint8_t) * stream->width * directoryPixelBytes(&stream->dir) * stream->block);
+
+    if (stream->rows == NULL) {
+        streamClose(stream);
+        err->error = MALLOC_ERROR;
+        return NULL;
+    }
+
+    return stream;
+}
+
+/* asks for the next READAHEAD_BYTES of strips once the stream is halfway through the window before */
+static void readAhead(tiffStream_t stream, uint32_t strip) {
+    if (strip < stream->refill || stream->advised >= blockRows(&stream->dir))
+        return;
+
+    stream->advised = adviseBlocks(stream->fd, &stream->dir, stream->advised > strip + 1 ? stream->advised : strip + 1,
+                                   READAHEAD_BYTES, POSIX_FADV_WILLNEED);
+    stream->refill = strip + (stream->advised - strip + 1) / 2;
+}
+
+/*
+ * drops the pages of a strip or row of tiles that is done with. the kernel only drops the folios wholly
+ * inside a range, so an image stored in order is dropped in one sweep from where the last range could
+ * have cut through a folio, at most DROP_FOLIO before its end.
+ */
+static void dropBlocks(tiffStream_t stream, uint32_t strip) {
+    uint64_t end;
+
+    if (stream->refill != UINT32_MAX) {
+        adviseBlocks(stream->fd, &stream->dir, strip, 0, POSIX_FADV_DONTNEED);
+        return;
+    }
+
+    end = blockRowEnd(&stream->dir, strip);
+
+    /* small strips are dropped a folio at a time, not a call each */
+    if (end - stream->dropped < 2 * DROP_FOLIO && strip + 1 < blockRows(&stream->dir))
+        return;
+
+    posix_fadvise(stream->fd, stream->dropped, end - stream->dropped, POSIX_FADV_DONTNEED);
+    stream->dropped = end & ~(uint64_t) (DROP_FOLIO - 1);
+}
+
+bool streamNextRows(tiffStream_t stream, const uint8_t **rows, uint32_t *first, uint32_t *count,
+                    struct tiffError *const err) {
+    struct source src = {.fd = stream->fd};
+    bool tiled = stream->dir.tileWidth != 0;
+    /* the strip or row of tiles the block is in */
+    uint32_t strip = stream->row / (tiled ? stream->dir.tileLength : stream->dir.rowsPerStrip);
+    uint32_t left;
+
+    *rows = stream->rows;
+    *first = stream->row;
+    *count = 0;
+
+    if (stream->row >= stream->height)
+        return false;
+
+    readAhead(stream, strip);
+
+    if (tiled) {
+        left = stream->height - stream->row;
+        *count = left < stream->block ? left : stream->block;
+
+        if (decodeRegion(&src, &stream->dir, 0, stream->row, stream->width, *count, &stream->scratch, stream->rows, err)) {
+            *count = 0;
+            return true;
+        }
+    } else {
+        /* never cross into the next strip, its rows may live anywhere in the file */
+        left = strip * stream->dir.rowsPerStrip + stripRows(&stream->dir, strip) - stream->row;
+        *count = left < stream->block ? left : stream->block;
+
+        if (decodeRows(&src, &stream->dir, stream->row, *count, &stream->scratch, stream->rows, err)) {
+            *count = 0;
+            return true;
+        }
+    }
+
+    stream->row += *count;
+
+    /* a strip is never read again once its last rows are out, a row of tiles is always done with at once */
+    if (tiled || *count == left)
+        dropBlocks(stream, strip);
+
+    return false;
+}
+
+void streamClose(tiffStream_t stream) {
+    if (stream == NULL)
+        return;
+
+    directoryFree(&stream->dir);
+    scratchFree(&stream->scratch);
+    free(stream->rows);
+    free(stream);
+}
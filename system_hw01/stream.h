@@ -0,0 +1,45 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include "strip.h"
+
+#ifndef SYSTEM_HW01_STREAM_H
+#define SYSTEM_HW01_STREAM_H
+
+/*
+ * decodes an image a block of rows at a time, memory use is bounded by the block and not the image.
+ * strips stored out of order are read ahead by the kernel, and the pages of the ones done with are dropped
+ * from the page cache, so that streaming a large image does not push everything else out of it. rows come
+ * as stored, whatever the ORIENTATION tag says.
+ */
+typedef struct tiffStream {
+    int fd;
+    uint32_t width;
+    uint32_t height;
+    uint32_t row;
+    uint32_t block;
+    /* strips or rows of tiles up to advised are being read ahead, the next window is asked for at refill */
+    uint32_t advised;
+    uint32_t refill;
+    /* the pages of an image stored in order are dropped from here on */
+    uint64_t dropped;
+    struct directory dir;
+    struct scratch scratch;
+    uint8_t *rows;
+} *tiffStream_t;
+
+/* maxRows limits the rows returned per call, 0 returns whole strips */
+tiffStream_t streamOpen(int fd, uint32_t maxRows, struct tiffError *const err) __attribute__((warn_unused_result));
+
+/*
+ * decodes the next block, *rows points to *count rows of width pixels as readFD decodes them, starting
+ * at image row *first.
+ * the rows stay valid until the next call, *count is 0 once the image is exhausted.
+ */
+bool streamNextRows(tiffStream_t stream, const uint8_t **rows, uint32_t *first, uint32_t *count,
+                    struct tiffError *const err);
+
+void streamClose(tiffStream_t stream);
+
+#endif //SYSTEM_HW01_STREAM_H
@@ -0,0 +1,551 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <string.h>
+#include "strip.h"
+#include "unpack.h"
+#include "bits.h"
+#include "compress.h"
+#include "predict.h"
+
+/* how decodeBlock leaves its rows */
+enum decodeFlags {
+    /* 1 bit rows stay packed */
+    DECODE_PACKED = 1,
+    /* differences and inverted samples are left for finishRows */
+    DECODE_RAW = 2
+};
+
+bool checkDirectory(const struct directory *dir, struct tiffError *const err) {
+    bool gray = dir->photometric == BLACK_IS_ZERO || dir->photometric == WHITE_IS_ZERO;
+
+    if (!gray && dir->photometric != RGB) {
+        err->data = dir->photometric;
+        err->error = UNKNOWN_COLOR_SPACE;
+        return true;
+    }
+
+    if (dir->samplesPerPixel != (gray ? 1 : 3) || (dir->bitsPerSample != 8 && dir->bitsPerSample != 16 &&
+                                                   (dir->bitsPerSample != 1 || !gray))) {
+        err->data = dir->bitsPerSample;
+        err->error = UNSUPPORTED_SAMPLE_SIZE;
+        return true;
+    }
+
+    if (dir->planar != CHUNKY && dir->planar != PLANAR) {
+        err->data = dir->planar;
+        err->error = CORRUPT_DATA;
+        return true;
+    }
+
+    if (findCodec(dir->compression) == NULL) {
+        err->data = dir->compression;
+        err->error = UNSUPPORTED_COMPRESSION;
+        return true;
+    }
+
+    /*
+     * horizontal differencing is undone on the decoded rows whatever the codec, but only for whole byte
+     * samples. other predictors are refused rather than returning the stored samples as pixels.
+     */
+    if (dir->predictor != NO_PREDICTOR && (dir->predictor != HORIZONTAL_DIFFERENCING || dir->bitsPerSample == 1)) {
+        err->data = dir->predictor;
+        err->error = UNSUPPORTED_PREDICTOR;
+        return true;
+    }
+
+    /* the fax codings only describe bilevel images */
+    if (dir->compression >= CCITT_RLE && dir->compression <= CCITT_T6 && dir->bitsPerSample != 1) {
+        err->data = dir->bitsPerSample;
+        err->error = UNSUPPORTED_SAMPLE_SIZE;
+        return true;
+    }
+
+    if (dir->width == 0 || dir->height == 0) {
+        err->data = dir->width;
+        err->error = CORRUPT_DATA;
+        return true;
+    }
+
+    if (dir->tileWidth != 0) {
+        /*
+         * tiff wants both sides of a tile multiples of 16. only packed 1 bit rows rely on it, their tiles must
+         * start on a byte of the row, so other sample sizes are decoded whatever the sides are.
+         */
+        if (dir->bitsPerSample == 1 && (dir->tileWidth % 16 != 0 || dir->tileLength % 16 != 0)) {
+            err->data = dir->tileWidth % 16 != 0 ? dir->tileWidth : dir->tileLength;
+            err->error = CORRUPT_DATA;
+            return true;
+        }
+
+        if (dir->tileLength == 0 || dir->tileCount < tilesAcross(dir) * tilesDown(dir) * directoryPlanes(dir)) {
+            err->data = dir->tileCount;
+            err->error = CORRUPT_DATA;
+            return true;
+        }
+
+        for (uint32_t t = 0; t < dir->tileCount && dir->compression == NO_COMPRESSION; ++t) {
+            if (dir->tileByteCounts[t] < tileSize(dir)) {
+                err->data = dir->tileByteCounts[t];
+                err->error = CORRUPT_DATA;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    if (dir->stripCount < stripsUsed(dir) * directoryPlanes(dir)) {
+        err->data = dir->stripCount;
+        err->error = CORRUPT_DATA;
+        return true;
+    }
+
+    for (uint32_t j = 0; j < stripsUsed(dir) * directoryPlanes(dir) && dir->compression == NO_COMPRESSION; ++j) {
+        if (dir->stripByteCounts[j] < stripSize(dir, j % stripsUsed(dir))) {
+            err->data = dir->stripByteCounts[j];
+            err->error = CORRUPT_DATA;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* the last strip may hold fewer rows */
+uint32_t stripRows(const struct directory *dir, uint32_t j) {
+    uint32_t rows = dir->height - j * dir->rowsPerStrip;
+
+    return rows > dir->rowsPerStrip ? dir->rowsPerStrip : rows;
+}
+
+/* bytes of strip j as stored */
+size_t stripSize(const struct directory *dir, uint32_t j) {
+    return directoryRowBytes(dir) * stripRows(dir, j);
+}
+
+uint32_t stripsUsed(const struct directory *dir) {
+    return (dir->height + dir->rowsPerStrip - 1) / dir->rowsPerStrip;
+}
+
+uint32_t tilesAcross(const struct directory *dir) {
+    return (dir->width + dir->tileWidth - 1) / dir->tileWidth;
+}
+
+uint32_t tilesDown(const struct directory *dir) {
+    return (dir->height + dir->tileLength - 1) / dir->tileLength;
+}
+
+/* tiles are always stored whole, the ones on the right and bottom edges are padded */
+size_t tileSize(const struct directory *dir) {
+    return ((size_t) dir->tileWidth * dir->bitsPerSample * directorySamples(dir) + 7) / 8 * dir->tileLength;
+}
+
+bool differenced(const struct directory *dir) {
+    return dir->predictor == HORIZONTAL_DIFFERENCING;
+}
+
+void finishRows(const struct directory *dir, uint32_t width, uint32_t rows, uint8_t *data) {
+    uint16_t samples = directorySamples(dir);
+    size_t rowBytes = (size_t) width * samples * (dir->bitsPerSample / 8);
+
+    for (uint32_t i = 0; i < rows && differenced(dir); ++i) {
+        if (dir->bitsPerSample == 16)
+            predictRow16(data + i * rowBytes, width, samples);
+        else
+            predictRow8(data + i * rowBytes, width, samples);
+    }
+
+    if (dir->photometric == WHITE_IS_ZERO)
+        invertBytes(data, rowBytes * rows);
+}
+
+/* uncompressed strips that already hold the pixels readFD returns, so that a mapping can be used as is */
+bool storedAsDecoded(const struct directory *dir) {
+    if (dir->compression != NO_COMPRESSION || directoryPlanes(dir) != 1 || dir->bitsPerSample == 1 ||
+        dir->photometric == WHITE_IS_ZERO || differenced(dir))
+        return false;
+
+    return dir->bitsPerSample == 8 || (dir->byteOrder == II) == (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+}
+
+uint32_t blockRows(const struct directory *dir) {
+    return dir->tileWidth != 0 ? tilesDown(dir) : stripsUsed(dir);
+}
+
+bool storedInOrder(const struct directory *dir) {
+    uint32_t across = dir->tileWidth != 0 ? tilesAcross(dir) : 1;
+    uint32_t blocks = across * blockRows(dir);
+    const uint64_t *offsets = dir->tileWidth != 0 ? dir->tileOffsets : dir->stripOffsets;
+    const uint64_t *byteCounts = dir->tileWidth != 0 ? dir->tileByteCounts : dir->stripByteCounts;
+    uint64_t end = offsets[0];
+
+    /* decodeRows and decodeTile go through the planes of a block before the next block */
+    for (uint32_t i = 0; i < blocks; ++i) {
+        for (uint16_t p = 0; p < directoryPlanes(dir); ++p) {
+            uint64_t offset = offsets[p * blocks + i];
+
+            if (offset < end || offset - end > 4096)
+                return false;
+
+            end = offset + byteCounts[p * blocks + i];
+        }
+    }
+
+    return true;
+}
+
+uint64_t blockRowEnd(const struct directory *dir, uint32_t row) {
+    uint32_t across = dir->tileWidth != 0 ? tilesAcross(dir) : 1;
+    /* the last block of the row in the last plane, decoded after all the others */
+    uint32_t i = (directoryPlanes(dir) - 1) * across * blockRows(dir) + (row + 1) * across - 1;
+
+    if (dir->tileWidth != 0)
+        return dir->tileOffsets[i] + dir->tileByteCounts[i];
+
+    return dir->stripOffsets[i] + dir->stripByteCounts[i];
+}
+
+uint32_t adviseBlocks(int fd, const struct directory *dir, uint32_t first, size_t bytes, int advice) {
+    uint32_t across = dir->tileWidth != 0 ? tilesAcross(dir) : 1;
+    uint32_t blocks = across * blockRows(dir);
+    const uint64_t *offsets = dir->tileWidth != 0 ? dir->tileOffsets : dir->stripOffsets;
+    const uint64_t *byteCounts = dir->tileWidth != 0 ? dir->tileByteCounts : dir->stripByteCounts;
+    uint32_t last = first;
+    uint64_t covered = 0;
+
+    /* whole rows of blocks only, in every plane, so that a block is never read ahead in part */
+    while (last < blockRows(dir) && (last == first || covered < bytes)) {
+        for (uint16_t p = 0; p < directoryPlanes(dir); ++p) {
+            for (uint32_t i = last * across; i < (last + 1) * across; ++i)
+                covered += byteCounts[p * blocks + i];
+        }
+        ++last;
+    }
+
+    /* blocks that follow each other in the file go to the kernel as one range */
+    for (uint16_t p = 0; p < directoryPlanes(dir); ++p) {
+        uint64_t start = 0, end = 0;
+
+        for (uint32_t i = first * across; i < last * across; ++i) {
+            if (offsets[p * blocks + i] != end) {
+                if (end > start)
+                    posix_fadvise(fd, start, end - start, advice);
+                start = offsets[p * blocks + i];
+            }
+            end = offsets[p * blocks + i] + byteCounts[p * blocks + i];
+        }
+
+        if (end > start)
+            posix_fadvise(fd, start, end - start, advice);
+    }
+
+    return last;
+}
+
+/* expands packed 1 bit rows so that black is always 0 and white 255 */
+void expandRows(const struct directory *dir, const uint8_t *packed, uint32_t width, uint32_t rows, uint8_t *data) {
+    size_t rowBytes = (width + 7) / 8;
+    uint8_t flip = dir->photometric == WHITE_IS_ZERO ? 0xFF : 0x00;
+
+    for (uint32_t i = 0; i < rows; ++i)
+        unpackRow(packed + i * rowBytes, width, data + (size_t) i * width, flip);
+}
+
+static uint8_t *grow(uint8_t **buffer, size_t *capacity, size_t size) {
+    if (size > *capacity) {
+        uint8_t *p = realloc(*buffer, size);
+
+        if (p == NULL)
+            return NULL;
+
+        *buffer = p;
+        *capacity = size;
+    }
+
+    return *buffer;
+}
+
+void scratchFree(struct scratch *scratch) {
+    clean8(&scratch->packed);
+    clean8(&scratch->input);
+    clean8(&scratch->block);
+    clean8(&scratch->plane);
+    scratch->packedSize = scratch->inputSize = scratch->blockSize = scratch->planeSize = 0;
+}
+
+/* keeps packed rows as stored but with a set bit always black, the way fax images store them */
+static void normalizeRows(const struct directory *dir, uint8_t *packed, uint32_t width, uint32_t rows) {
+    size_t rowBytes = (width + 7) / 8;
+
+    for (uint32_t i = 0; i < rows; ++i) {
+        if (dir->photometric == BLACK_IS_ZERO)
+            bitsInvert(packed + i * rowBytes, width);
+        else
+            bitsClearPadding(packed + i * rowBytes, width);
+    }
+}
+
+/*
+ * fetches the rows of a strip or tile stored at offset and decodes them to the pixels readFD returns at
+ * dst, or with DECODE_PACKED to 1 bit rows of a 1 bit image. a block of a planar image holds one
+ * sample of every pixel. compressed data is inflated straight into dst, or into the packed scratch for
+ * 1 bit images that are expanded.
+ */
+static bool decodeBlock(struct source *src, const struct directory *dir, uint64_t offset, uint64_t byteCount,
+                        uint32_t width, uint32_t rows, unsigned flags, struct scratch *scratch, uint8_t *dst,
+                        struct tiffError *const err) {
+    bool packed = flags & DECODE_PACKED;
+    size_t size = ((size_t) width * dir->bitsPerSample * directorySamples(dir) + 7) / 8 * rows;
+    uint8_t *out = dir->bitsPerSample == 1 && !packed ? grow(&scratch->packed, &scratch->packedSize, size) : dst;
+    const uint8_t *p;
+
+    if (out == NULL) {
+        err->error = MALLOC_ERROR;
+        return true;
+    }
+
+    if (dir->compression == NO_COMPRESSION) {
+        p = sourceFetch(src, offset, out, size);
+    } else {
+        bool held = sourceHolds(src, offset, byteCount);
+        uint8_t *input = held ? NULL : grow(&scratch->input, &scratch->inputSize, byteCount);
+
+        if (input == NULL && !held) {
+            err->error = MALLOC_ERROR;
+            return true;
+        }
+
+        struct codecParams params = {width, dir->fillOrder, dir->t4Options};
+
+        p = sourceFetch(src, offset, input, byteCount);
+
+        if (p != NULL && findCodec(dir->compression)->decode(p, byteCount, out, size, &params)) {
+            err->data = offset;
+            err->error = DECODE_ERROR;
+            return true;
+        }
+
+        p = out;
+    }
+
+    if (p == NULL) {
+        err->data = offset;
+        err->error = READ_ERROR;
+        return true;
+    }
+
+    if (dir->bitsPerSample == 1 && !packed) {
+        expandRows(dir, p, width, rows, dst);
+        return false;
+    }
+
+    /* samples of the other byte order are swapped on their way out of the mapping or the read buffer */
+    if (dir->bitsPerSample == 16 && (dir->byteOrder == II) != (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__))
+        swapBytes16(p, dst, size / 2);
+    else if (p != dst)
+        memcpy(dst, p, size);
+
+    if (packed) {
+        normalizeRows(dir, dst, width, rows);
+        return false;
+    }
+
+    if (!(flags & DECODE_RAW))
+        finishRows(dir, width, rows, dst);
+
+    return false;
+}
+
+/* spreads the samples of one plane over the pixels at dst, sample plane of each */
+static void interleavePlane(const struct directory *dir, const uint8_t *samples, size_t pixels, uint16_t plane,
+                            uint8_t *dst) {
+    size_t sampleBytes = dir->bitsPerSample / 8;
+    size_t pixelBytes = directoryPixelBytes(dir);
+
+    dst += plane * sampleBytes;
+
+    if (sampleBytes == 1) {
+        for (size_t i = 0; i < pixels; ++i)
+            dst[i * pixelBytes] = samples[i];
+        return;
+    }
+
+    for (size_t i = 0; i < pixels; ++i)
+        memcpy(dst + i * pixelBytes, samples + 2 * i, 2);
+}
+
+/*
+ * decodes the block at index of every plane, planes blocks apart in the tables, into the plane scratch
+ * and interleaves them at dst. skip is the offset of the first wanted row in an uncompressed block.
+ */
+static bool decodePlanes(struct source *src, const struct directory *dir, const uint64_t *offsets,
+                         const uint64_t *byteCounts, uint32_t index, uint32_t blocks, uint64_t skip, uint32_t width,
+                         uint32_t rows, struct scratch *scratch, uint8_t *dst, struct tiffError *const err) {
+    size_t size = (size_t) width * rows * (dir->bitsPerSample / 8);
+    uint8_t *plane = grow(&scratch->plane, &scratch->planeSize, size);
+
+    if (plane == NULL) {
+        err->error = MALLOC_ERROR;
+        return true;
+    }
+
+    for (uint16_t p = 0; p < directoryPlanes(dir); ++p) {
+        uint32_t i = index + p * blocks;
+
+        if (decodeBlock(src, dir, offsets[i] + skip, byteCounts[i], width, rows, 0, scratch, plane, err))
+            return true;
+
+        interleavePlane(dir, plane, (size_t) width * rows, p, dst);
+    }
+
+    return false;
+}
+
+static bool decodeStripRows(struct source *src, const struct directory *dir, uint32_t first, uint32_t count,
+                            unsigned flags, struct scratch *scratch, uint8_t *dst, struct tiffError *const err) {
+    uint32_t j = first / dir->rowsPerStrip;
+    uint64_t skip = (first - j * dir->rowsPerStrip) * directoryRowBytes(dir);
+
+    if (directoryPlanes(dir) > 1)
+        return decodePlanes(src, dir, dir->stripOffsets, dir->stripByteCounts, j, stripsUsed(dir), skip, dir->width,
+                            count, scratch, dst, err);
+
+    return decodeBlock(src, dir, dir->stripOffsets[j] + skip, dir->stripByteCounts[j], dir->width, count, flags,
+                       scratch, dst, err);
+}
+
+bool decodeRows(struct source *src, const struct directory *dir, uint32_t first, uint32_t count,
+                struct scratch *scratch, uint8_t *dst, struct tiffError *const err) {
+    return decodeStripRows(src, dir, first, count, 0, scratch, dst, err);
+}
+
+bool decodeRowsRaw(struct source *src, const struct directory *dir, uint32_t first, uint32_t count,
+                   struct scratch *scratch, uint8_t *dst, struct tiffError *const err) {
+    return decodeStripRows(src, dir, first, count, DECODE_RAW, scratch, dst, err);
+}
+
+bool decodeRowsPacked(struct source *src, const struct directory *dir, uint32_t first, uint32_t count,
+                      struct scratch *scratch, uint8_t *dst, struct tiffError *const err) {
+    return decodeStripRows(src, dir, first, count, DECODE_PACKED, scratch, dst, err);
+}
+
+bool decodeTile(struct source *src, const struct directory *dir, uint32_t t, struct scratch *scratch, uint8_t *dst,
+                struct tiffError *const err) {
+    if (directoryPlanes(dir) > 1)
+        return decodePlanes(src, dir, dir->tileOffsets, dir->tileByteCounts, t, tilesAcross(dir) * tilesDown(dir), 0,
+                            dir->tileWidth, dir->tileLength, scratch, dst, err);
+
+    return decodeBlock(src, dir, dir->tileOffsets[t], dir->tileByteCounts[t], dir->tileWidth, dir->tileLength, 0,
+                       scratch, dst, err);
+}
+
+bool decodeTilesPacked(struct source *src, const struct directory *dir, struct scratch *scratch, uint8_t *dst,
+                       struct tiffError *const err) {
+    size_t tileBytes = dir->tileWidth / 8;
+    size_t rowBytes = (dir->width + 7) / 8;
+    uint8_t *block = grow(&scratch->block, &scratch->blockSize, tileSize(dir));
+
+    if (block == NULL) {
+        err->error = MALLOC_ERROR;
+        return true;
+    }
+
+    /* checkDirectory refuses 1 bit tile widths off a multiple of 16, so every tile starts on a byte of the row */
+    for (uint32_t ty = 0; ty < tilesDown(dir); ++ty) {
+        for (uint32_t tx = 0; tx < tilesAcross(dir); ++tx) {
+            uint32_t rows = dir->height - ty * dir->tileLength;
+            size_t bytes = rowBytes - tx * tileBytes < tileBytes ? rowBytes - tx * tileBytes : tileBytes;
+
+            if (decodeBlock(src, dir, dir->tileOffsets[ty * tilesAcross(dir) + tx],
+                            dir->tileByteCounts[ty * tilesAcross(dir) + tx], dir->tileWidth, dir->tileLength, DECODE_PACKED,
+                            scratch, block, err))
+                return true;
+
+            for (uint32_t r = 0; r < dir->tileLength && r < rows; ++r)
+                memcpy(dst + (ty * dir->tileLength + r) * rowBytes + tx * tileBytes, block + r * tileBytes, bytes);
+        }
+    }
+
+    for (uint32_t r = 0; r < dir->height; ++r)
+        bitsClearPadding(dst + r * rowBytes, dir->width);
+
+    return false;
+}
+
+/* copies the part of a decoded block of bw x bh pixels at (bx, by) that overlaps the region */
+static void copyOverlap(const uint8_t *block, size_t pixelBytes, uint32_t bx, uint32_t by, uint32_t bw, uint32_t bh,
+                        uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t *dst) {
+    uint32_t left = bx > x ? bx : x;
+    uint32_t top = by > y ? by : y;
+    uint32_t right = bx + bw < x + w ? bx + bw : x + w;
+    uint32_t bottom = by + bh < y + h ? by + bh : y + h;
+
+    for (uint32_t r = top; r < bottom; ++r)
+        memcpy(dst + ((size_t) (r - y) * w + (left - x)) * pixelBytes,
+               block + ((size_t) (r - by) * bw + (left - bx)) * pixelBytes, (right - left) * pixelBytes);
+}
+
+bool decodeRegion(struct source *src, const struct directory *dir, uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+                  struct scratch *scratch, uint8_t *dst, struct tiffError *const err) {
+    size_t pixelBytes = directoryPixelBytes(dir);
+    uint32_t bw = dir->tileWidth != 0 ? dir->tileWidth : dir->width;
+    uint32_t bh = dir->tileWidth != 0 ? dir->tileLength : dir->rowsPerStrip;
+    uint8_t *block;
+
+    /*
+     * only the strips or tiles overlapping the region are read, into a block buffer first unless
+     * the rows go straight to their place in dst. the buffer is only grown for the strips that need
+     * it, so a whole image read this way never holds a second copy. compressed strips are always
+     * decoded whole.
+     */
+    if (dir->tileWidth == 0) {
+        for (uint32_t j = y / bh; j <= (y + h - 1) / bh; ++j) {
+            uint32_t first = j * bh > y ? j * bh : y;
+            uint32_t last = (j + 1) * bh < y + h ? (j + 1) * bh : y + h;
+            bool direct;
+
+            if (dir->compression != NO_COMPRESSION) {
+                first = j * bh;
+                last = first + stripRows(dir, j);
+            }
+
+            direct = x == 0 && w == dir->width && first >= y && last <= y + h;
+            block = direct ? NULL
+                           : grow(&scratch->block, &scratch->blockSize, (size_t) bw * (last - first) * pixelBytes);
+
+            if (!direct && block == NULL) {
+                err->error = MALLOC_ERROR;
+                return true;
+            }
+
+            if (decodeRows(src, dir, first, last - first, scratch,
+                           direct ? dst + (size_t) (first - y) * w * pixelBytes : block, err))
+                return true;
+
+            if (!direct)
+                copyOverlap(block, pixelBytes, 0, first, bw, last - first, x, y, w, h, dst);
+        }
+
+        return false;
+    }
+
+    block = grow(&scratch->block, &scratch->blockSize, (size_t) bw * bh * pixelBytes);
+
+    if (block == NULL) {
+        err->error = MALLOC_ERROR;
+        return true;
+    }
+
+    for (uint32_t ty = y / bh; ty <= (y + h - 1) / bh; ++ty) {
+        for (uint32_t tx = x / bw; tx <= (x + w - 1) / bw; ++tx) {
+            if (decodeTile(src, dir, ty * tilesAcross(dir) + tx, scratch, block, err))
+                return true;
+
+            copyOverlap(block, pixelBytes, tx * bw, ty * bh, bw, bh, x, y, w, h, dst);
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,100 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include "ifd.h"
+
+#ifndef SYSTEM_HW01_STRIP_H
+#define SYSTEM_HW01_STRIP_H
+
+/* buffers a decoder reuses from one strip or tile to the next, grown on demand */
+struct scratch {
+    uint8_t *packed;
+    size_t packedSize;
+    uint8_t *input;
+    size_t inputSize;
+    uint8_t *block;
+    size_t blockSize;
+    /* one plane of a planar block, before its samples are interleaved */
+    uint8_t *plane;
+    size_t planeSize;
+};
+
+void scratchFree(struct scratch *scratch);
+
+bool checkDirectory(const struct directory *dir, struct tiffError *const err);
+
+uint32_t stripsUsed(const struct directory *dir);
+
+uint32_t stripRows(const struct directory *dir, uint32_t j);
+
+size_t stripSize(const struct directory *dir, uint32_t j);
+
+uint32_t tilesAcross(const struct directory *dir);
+
+uint32_t tilesDown(const struct directory *dir);
+
+size_t tileSize(const struct directory *dir);
+
+bool storedAsDecoded(const struct directory *dir);
+
+/* stored bytes a reader asks the kernel to read ahead of the strip it decodes */
+#define READAHEAD_BYTES (8u << 20)
+
+/* strips, or rows of tiles, in every plane of the image */
+uint32_t blockRows(const struct directory *dir);
+
+/*
+ * true when every strip or tile starts at most a page after the one decoded before it ends, the order
+ * the kernel already reads ahead in by itself. readers only ask for read ahead when it is false.
+ */
+bool storedInOrder(const struct directory *dir);
+
+/* where the stored bytes of a strip or row of tiles end in an image stored in order */
+uint64_t blockRowEnd(const struct directory *dir, uint32_t row);
+
+/*
+ * passes advice, one of the POSIX_FADV values, for the stored bytes of the strips or rows of tiles from
+ * first on until bytes are covered, at least one. returns the strip or row of tiles after the last one.
+ */
+uint32_t adviseBlocks(int fd, const struct directory *dir, uint32_t first, size_t bytes, int advice);
+
+/* rows that have their samples stored as horizontal differences */
+bool differenced(const struct directory *dir);
+
+/* undoes the predictor and inverts WhiteIsZero samples of rows decoded by decodeRowsRaw */
+void finishRows(const struct directory *dir, uint32_t width, uint32_t rows, uint8_t *data);
+
+void expandRows(const struct directory *dir, const uint8_t *packed, uint32_t width, uint32_t rows, uint8_t *data);
+
+/*
+ * reads count rows starting at image row first, all inside one strip, and decodes them at dst to
+ * directoryPixelBytes per pixel, 1 bit images to a byte. compressed strips can only be decoded whole.
+ */
+bool decodeRows(struct source *src, const struct directory *dir, uint32_t first, uint32_t count,
+                struct scratch *scratch, uint8_t *dst, struct tiffError *const err);
+
+/*
+ * like decodeRows, but the samples are left as stored for finishRows, so that the rows of one strip
+ * can be finished on several threads. chunky images of 8 and 16 bits only.
+ */
+bool decodeRowsRaw(struct source *src, const struct directory *dir, uint32_t first, uint32_t count,
+                   struct scratch *scratch, uint8_t *dst, struct tiffError *const err);
+
+/* like decodeRows, but 1 bit rows stay packed as stored with a set bit black and the padding clear */
+bool decodeRowsPacked(struct source *src, const struct directory *dir, uint32_t first, uint32_t count,
+                      struct scratch *scratch, uint8_t *dst, struct tiffError *const err);
+
+/* decodes tile t to tileWidth x tileLength pixels at dst, t counts the tiles of the first plane */
+bool decodeTile(struct source *src, const struct directory *dir, uint32_t t, struct scratch *scratch, uint8_t *dst,
+                struct tiffError *const err);
+
+/* decodes every tile of a 1 bit image to packed rows of the whole image at dst */
+bool decodeTilesPacked(struct source *src, const struct directory *dir, struct scratch *scratch, uint8_t *dst,
+                       struct tiffError *const err);
+
+/* decodes the w x h pixels at (x, y) to dst, touching only the strips or tiles that overlap them */
+bool decodeRegion(struct source *src, const struct directory *dir, uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+                  struct scratch *scratch, uint8_t *dst, struct tiffError *const err);
+
+#endif //SYSTEM_HW01_STRIP_H
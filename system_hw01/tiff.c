@@ -3,66 +3,32 @@
 //
 
 #include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include "tiff.h"
+#include "ifd.h"
+#include "strip.h"
+#include "pages.h"
+#include "shrink.h"
+#include "unpack.h"
+#include "bits.h"
+#include "uring.h"
+#include "orient.h"
+#include "debug.h"
 
-#ifdef DEBUG
-#define DERROR(fmt, args...) fprintf(stderr, "DEBUG: %s:%d:%s(): " fmt, __FILE__, __LINE__, __func__, ##args)
-#else
-#define DERROR(fmt, args...)
-#endif
-struct header {
-    uint16_t byteOrder;
-    uint16_t version;
-    uint32_t ifdOffset;
-};
-
-struct tag {
-    uint16_t tagId;
-    uint16_t dataType;
-    uint32_t dataCount;
-    uint32_t dataOffset;
-};
-
-struct ifd {
-    uint16_t count;
-    uint32_t nextIFDOffset;
-    struct tag tags[];
-};
-
-struct _tiff {
-    struct header header;
-    struct ifd ifds[];
-};
+/* rows of an uncompressed strip decoded at once when shrinking, a multiple of every scale */
+#define SHRINK_BAND 64
 
-bool readAll(int fd, void *buffer, size_t size) {
-    size_t total = 0;
-    int n;
+/* rows finished at once by a worker when strips are decoded raw */
+#define FINISH_BAND 64
 
-    do {
-        n = read(fd, (uint8_t *) buffer + total, size - total);
+/* strip reads in flight at once on the ring */
+#define URING_DEPTH 64
 
-        if (n <= 0) {
-            perror("readall");
-            return true;
-        }
-
-        total += n;
-    } while (total != size);
-
-    return false;
-}
-
-void clean32(uint32_t **p) {
-    if (*p != NULL)
-        free(*p);
-    *p = NULL;
-}
-
-void clean8(uint8_t **p) {
-    if (*p != NULL)
-        free(*p);
-    *p = NULL;
-}
+/* the longest read queued at once, longer strips are read in several */
+#define URING_READ (1u << 30)
 
 /*
 uint16_t swapEndianness16(uint16_t val){
@@ -89,299 +55,1131 @@ const char *const tiffErrorF(struct tiffError const error) {
             return "UNKNOWN COLOR SPACE";
         case MALLOC_ERROR:
             return "MALLOC ERROR";
+        case MAP_ERROR:
+            return "FILE MAP ERROR";
+        case UNSUPPORTED_SAMPLE_SIZE:
+            return "UNSUPPORTED SAMPLE SIZE";
+        case CORRUPT_DATA:
+            return "CORRUPT DATA";
+        case OUT_OF_RANGE:
+            return "REGION OUT OF RANGE";
+        case UNSUPPORTED_COMPRESSION:
+            return "UNSUPPORTED COMPRESSION";
+        case DECODE_ERROR:
+            return "DECOMPRESSION ERROR";
+        case WRITE_ERROR:
+            return "FILE WRITE ERROR";
+        case STALE_INDEX:
+            return "INDEX DOES NOT MATCH FILE";
+        case UNSUPPORTED_PREDICTOR:
+            return "UNSUPPORTED PREDICTOR";
+        case SHARED_IMAGE:
+            return "IMAGE IS SHARED";
     }
+
+    return "UNKNOWN ERROR";
 }
 
-tiff_t const readFD(int fd, struct tiffError *const err) {
-    tiff_t tiff;
+static void statsBegin(struct tiffStats *const stats) {
+    struct rusage usage;
 
-    struct header header;
-    size_t headerSize = sizeof(struct header);
-    struct ifd ifd;
-    size_t ifdSize = sizeof(struct ifd);
-    struct tag tag;
-    size_t tagSize = sizeof(struct tag);
-    struct tag width;
-    struct tag height;
-    struct tag bitsPerSample;
-    struct tag photometricInterpretation;
-    struct tag stripOffset;
-    struct tag samplesPerPixel;
-    struct tag stripByteCounts;
-    struct tag rowsPerStrip;
-
-    bool error;
-
-    /* read header */
-    error = readAll(fd, &header, sizeof(header));
-
-    if (error) {
-        err->data = sizeof(header);
-        err->error = READ_ERROR;
-        return NULL;
+    if (stats == NULL)
+        return;
+
+    getrusage(RUSAGE_SELF, &usage);
+    memset(stats, 0, sizeof(*stats));
+    stats->minorFaults = -usage.ru_minflt;
+    stats->majorFaults = -usage.ru_majflt;
+}
+
+static void statsEnd(struct tiffStats *const stats, const struct source *src) {
+    struct rusage usage;
+
+    if (stats == NULL)
+        return;
+
+    getrusage(RUSAGE_SELF, &usage);
+    stats->minorFaults += usage.ru_minflt;
+    stats->majorFaults += usage.ru_majflt;
+    stats->bytesRead += src->bytesRead;
+}
+
+/* the high byte of a 16 bit sample in host order */
+static uint8_t high8(const uint8_t *p) {
+    uint16_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v >> 8;
+}
+
+/* rec. 601 weights in 8 bit fixed point */
+static uint8_t luma(uint8_t r, uint8_t g, uint8_t b) {
+    return (77 * r + 150 * g + 29 * b + 128) >> 8;
+}
+
+static uint16_t sample16(const uint8_t *p) {
+    uint16_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* counts of tiffPixel values, kept in four tables so that runs of one value do not wait on their own increments */
+struct histogram {
+    uint64_t counts[4][256];
+    /* pixels with every sample 0, only counted for formats where that is not value 0 of GRAY8 */
+    uint64_t black;
+};
+
+static void histogram8(struct histogram *h, const uint8_t *p, size_t n) {
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+
+        memcpy(&w, p + i, sizeof(w));
+        ++h->counts[0][w & 0xFF];
+        ++h->counts[1][w >> 8 & 0xFF];
+        ++h->counts[2][w >> 16 & 0xFF];
+        ++h->counts[3][w >> 24 & 0xFF];
+        ++h->counts[0][w >> 32 & 0xFF];
+        ++h->counts[1][w >> 40 & 0xFF];
+        ++h->counts[2][w >> 48 & 0xFF];
+        ++h->counts[3][w >> 56];
+    }
+
+    for (; i < n; ++i)
+        ++h->counts[i & 3][p[i]];
+}
+
+/* adds count rows of the format, stride bytes apart, to the histogram */
+static void histogramRows(struct histogram *h, enum pixelFormat format, uint32_t width, const uint8_t *rows,
+                          size_t stride, uint32_t count) {
+    if (format == GRAY8 && stride == width) {
+        histogram8(h, rows, (size_t) width * count);
+        return;
     }
 
-    if (header.byteOrder == II)
-        header.ifdOffset = le32toh(header.ifdOffset);
-    else if (header.byteOrder == MM)
-        header.ifdOffset = be32toh(header.ifdOffset);
-    else {
-        err->data = header.byteOrder;
-        err->error = UNKNOWN_BYTE_ORDER;
+    for (uint32_t y = 0; y < count; ++y) {
+        const uint8_t *row = rows + (size_t) y * stride;
+        uint64_t black;
+
+        switch (format) {
+            case PACKED1:
+                black = bitsCount(row, width);
+                h->black += black;
+                h->counts[0][0] += black;
+                h->counts[0][255] += width - black;
+                break;
+            case GRAY16:
+                for (uint32_t x = 0; x < width; ++x) {
+                    uint16_t v = sample16(row + 2 * (size_t) x);
+
+                    ++h->counts[x & 3][v >> 8];
+                    h->black += v == 0;
+                }
+                break;
+            case RGB24:
+                for (uint32_t x = 0; x < width; ++x) {
+                    const uint8_t *p = row + 3 * (size_t) x;
+
+                    ++h->counts[x & 3][luma(p[0], p[1], p[2])];
+                    h->black += (p[0] | p[1] | p[2]) == 0;
+                }
+                break;
+            case RGB48:
+                for (uint32_t x = 0; x < width; ++x) {
+                    const uint8_t *p = row + 6 * (size_t) x;
+
+                    ++h->counts[x & 3][luma(high8(p), high8(p + 2), high8(p + 4))];
+                    h->black += (sample16(p) | sample16(p + 2) | sample16(p + 4)) == 0;
+                }
+                break;
+            default:
+                histogram8(h, row, width);
+        }
+    }
+}
+
+static void histogramMerge(struct histogram *dst, const struct histogram *src) {
+    for (int t = 0; t < 4; ++t) {
+        for (int v = 0; v < 256; ++v)
+            dst->counts[t][v] += src->counts[t][v];
+    }
+
+    dst->black += src->black;
+}
+
+static void histogramFinish(const struct histogram *h, enum pixelFormat format, struct tiffHistogram *out) {
+    memset(out, 0, sizeof(*out));
+    out->min = 255;
+
+    for (int v = 0; v < 256; ++v) {
+        out->bins[v] = h->counts[0][v] + h->counts[1][v] + h->counts[2][v] + h->counts[3][v];
+        out->pixels += out->bins[v];
+
+        if (out->bins[v] != 0) {
+            out->min = v < out->min ? v : out->min;
+            out->max = v;
+        }
+    }
+
+    out->black = format == GRAY8 ? out->bins[0] : h->black;
+    out->blackRatio = out->pixels != 0 ? (double) out->black / out->pixels : 0;
+}
+
+/* what readFD decodes the samples of dir to, 1 bit images are expanded to GRAY8 */
+static enum pixelFormat directoryFormat(const struct directory *dir) {
+    if (dir->photometric == RGB)
+        return dir->bitsPerSample == 16 ? RGB48 : RGB24;
+
+    return dir->bitsPerSample == 16 ? GRAY16 : GRAY8;
+}
+
+static tiff_t newTiff(const struct directory *dir, struct tiffError *const err) {
+    tiff_t tiff = malloc(sizeof(struct tiff));
+
+    if (tiff == NULL) {
+        err->error = MALLOC_ERROR;
         return NULL;
     }
 
-    DERROR("BYTE ORDER: %s\n", (header.byteOrder == II ? "II" : "MM"));
+    tiff->byteOrder = dir->byteOrder;
+    tiff->width = dir->width;
+    tiff->height = dir->height;
+    tiff->format = directoryFormat(dir);
+    tiff->stride = dir->width * directoryPixelBytes(dir);
+    tiff->data = NULL;
+    tiff->capacity = 0;
+    tiff->map = NULL;
+    tiff->mapSize = 0;
+    atomic_init(&tiff->refs, 1);
+    return tiff;
+}
 
-    /* read ifds */
-    ifd.nextIFDOffset = header.ifdOffset;
+/* shared by the strip workers of one readFDOptions call */
+struct stripJob {
+    int fd;
+    const struct directory *dir;
+    tiff_t tiff;
+    /* 2, 4 or 8 when tiff is a thumbnail, 1 otherwise */
+    unsigned scale;
+    /* strips are decoded by decodeRowsRaw and their rows finished afterwards, a band at a time */
+    bool raw;
+    /* strips are read through io_uring by readStripsAsync */
+    bool async;
+    /*
+     * strips up to advised are being read ahead, the next window is asked for once a worker reaches refill.
+     * strips stored in order never are, the kernel follows those preads by itself.
+     */
+    atomic_uint advised;
+    atomic_uint refill;
+    atomic_uint next;
+    atomic_uint nextBand;
+    /* the workers add what they counted to it once done, NULL when the options ask for no histogram */
+    struct histogram *histogram;
+    atomic_bool failed;
+    atomic_uint_fast64_t bytesRead;
+    pthread_mutex_t lock;
+    struct tiffError err;
+};
 
-    do {
-        error = lseek(fd, ifd.nextIFDOffset, SEEK_SET);
+/* decodes strip j a band of rows at a time and adds them to the thumbnail, the strip is never whole */
+static bool shrinkStrip(struct stripJob *job, struct source *src, uint32_t j, struct scratch *scratch,
+                        struct shrink *shrink, struct tiffError *const err) {
+    const struct directory *dir = job->dir;
+    bool packed = dir->bitsPerSample == 1;
+    size_t rowBytes = packed ? (dir->width + 7) / 8 : dir->width;
+    uint32_t first = j * dir->rowsPerStrip;
+    uint32_t left = stripRows(dir, j);
+    /* compressed strips can only be decoded whole */
+    uint32_t band = dir->compression == NO_COMPRESSION && left > SHRINK_BAND ? SHRINK_BAND : left;
+    uint8_t *rows = shrinkBand(shrink, rowBytes, band);
 
-        if (error == -1) {
-            err->data = ifd.nextIFDOffset;
-            err->error = SEEK_ERROR;
-            return NULL;
+    if (rows == NULL) {
+        err->error = MALLOC_ERROR;
+        return true;
+    }
+
+    while (left != 0) {
+        uint32_t count = left < band ? left : band;
+
+        if (packed ? decodeRowsPacked(src, dir, first, count, scratch, rows, err)
+                   : decodeRows(src, dir, first, count, scratch, rows, err))
+            return true;
+
+        shrinkRows(shrink, rows, packed, first, count, dir->height, job->tiff->data);
+        first += count;
+        left -= count;
+    }
+
+    return false;
+}
+
+/* reads strip j into its rows of tiff->data */
+static bool readStrip(struct stripJob *job, struct source *src, uint32_t j, struct scratch *scratch,
+                      struct shrink *shrink, struct tiffError *const err) {
+    const struct directory *dir = job->dir;
+    uint8_t *dst = job->tiff->data + (size_t) j * dir->rowsPerStrip * job->tiff->stride;
+
+    if (job->scale > 1)
+        return shrinkStrip(job, src, j, scratch, shrink, err);
+
+    if (job->tiff->format == PACKED1)
+        return decodeRowsPacked(src, dir, j * dir->rowsPerStrip, stripRows(dir, j), scratch, dst, err);
+
+    if (job->raw)
+        return decodeRowsRaw(src, dir, j * dir->rowsPerStrip, stripRows(dir, j), scratch, dst, err);
+
+    return decodeRows(src, dir, j * dir->rowsPerStrip, stripRows(dir, j), scratch, dst, err);
+}
+
+/* counts the rows of strip j right after they were decoded, while they are still in cache */
+static void measureStrip(struct stripJob *job, struct histogram *h, uint32_t j) {
+    const struct directory *dir = job->dir;
+
+    /* raw rows are counted once finished, and the rows of a thumbnail are only whole at the end */
+    if (job->histogram == NULL || job->raw || job->scale > 1)
+        return;
+
+    histogramRows(h, job->tiff->format, job->tiff->width, tiffRow(job->tiff, j * dir->rowsPerStrip),
+                  job->tiff->stride, stripRows(dir, j));
+}
+
+/* adds what a worker counted to the histogram of the job */
+static void mergeHistogram(struct stripJob *job, const struct histogram *h) {
+    if (job->histogram == NULL)
+        return;
+
+    pthread_mutex_lock(&job->lock);
+    histogramMerge(job->histogram, h);
+    pthread_mutex_unlock(&job->lock);
+}
+
+/* keeps READAHEAD_BYTES of strips ahead of j being read by the kernel while the workers decode */
+static void readAhead(struct stripJob *job, uint32_t j) {
+    uint32_t from;
+
+    if (j < atomic_load(&job->refill))
+        return;
+
+    pthread_mutex_lock(&job->lock);
+
+    if (j >= job->refill && job->advised < stripsUsed(job->dir)) {
+        from = job->advised > j + 1 ? job->advised : j + 1;
+        job->advised = adviseBlocks(job->fd, job->dir, from, READAHEAD_BYTES, POSIX_FADV_WILLNEED);
+        /* the window is topped up halfway through, before the workers catch up with its end */
+        job->refill = job->advised < stripsUsed(job->dir) ? j + (job->advised - j + 1) / 2 : UINT32_MAX;
+    }
+
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void *stripWorker(void *arg) {
+    struct stripJob *job = arg;
+    struct source src = {.fd = job->fd};
+    struct scratch scratch __attribute__((__cleanup__(scratchFree))) = {0};
+    struct shrink shrink __attribute__((__cleanup__(shrinkFree))) = {0};
+    struct histogram histogram;
+    struct tiffError err;
+    uint32_t j;
+
+    if (job->histogram != NULL)
+        memset(&histogram, 0, sizeof(histogram));
+
+    if (job->scale > 1 && shrinkInit(&shrink, job->dir->width, job->scale)) {
+        err.error = MALLOC_ERROR;
+        goto fail;
+    }
+
+    while (!atomic_load(&job->failed) && (j = atomic_fetch_add(&job->next, 1)) < stripsUsed(job->dir)) {
+        readAhead(job, j);
+
+        if (readStrip(job, &src, j, &scratch, &shrink, &err))
+            goto fail;
+
+        measureStrip(job, &histogram, j);
+    }
+
+    atomic_fetch_add(&job->bytesRead, src.bytesRead);
+    mergeHistogram(job, &histogram);
+    return NULL;
+
+fail:
+    pthread_mutex_lock(&job->lock);
+    if (!atomic_exchange(&job->failed, true))
+        job->err = err;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+/* rows are independent once their strips are inflated, every worker finishes the next band until none are left */
+static void *finishWorker(void *arg) {
+    struct stripJob *job = arg;
+    tiff_t tiff = job->tiff;
+    struct histogram histogram;
+    uint32_t band;
+
+    if (job->histogram != NULL)
+        memset(&histogram, 0, sizeof(histogram));
+
+    while ((band = atomic_fetch_add(&job->nextBand, 1)) < (tiff->height + FINISH_BAND - 1) / FINISH_BAND) {
+        uint32_t first = band * FINISH_BAND;
+        uint32_t rows = tiff->height - first < FINISH_BAND ? tiff->height - first : FINISH_BAND;
+
+        finishRows(job->dir, tiff->width, rows, tiffRow(tiff, first));
+
+        if (job->histogram != NULL)
+            histogramRows(&histogram, tiff->format, tiff->width, tiffRow(tiff, first), tiff->stride, rows);
+    }
+
+    mergeHistogram(job, &histogram);
+    return NULL;
+}
+
+/* runs worker on the calling thread and threads - 1 more, the work is handed out by the job counters */
+static void runWorkers(struct stripJob *job, unsigned threads, void *(*worker)(void *)) {
+    pthread_t *workers;
+    unsigned started = 0;
+
+    workers = threads > 1 ? malloc(sizeof(pthread_t) * (threads - 1)) : NULL;
+
+    if (workers != NULL) {
+        for (; started < threads - 1; ++started) {
+            if (pthread_create(&workers[started], NULL, worker, job) != 0)
+                break;
         }
+    }
 
-        DERROR("SEEK IFD: %X\n", ifd.nextIFDOffset);
+    worker(job);
 
-        error = readAll(fd, &(ifd.count), sizeof(ifd.count));
+    for (unsigned i = 0; i < started; ++i)
+        pthread_join(workers[i], NULL);
 
-        if (error) {
-            err->data = ifd.count;
-            err->error = READ_ERROR;
-            return NULL;
+    free(workers);
+}
+
+/* one strip read on the ring, into the rows of the image or a buffer of the slot */
+struct asyncRead {
+    uint32_t strip;
+    uint8_t *data;
+    size_t size;
+    size_t done;
+    uint8_t *buffer;
+    size_t capacity;
+};
+
+/* queues the part of read that is still missing, tagged with its slot */
+/*
+ * the ring is never full here: a slot has at most one read queued or in flight and is only queued when it
+ * has none, and there are no more slots than ring entries. the result is left to the callers unchecked.
+ */
+static bool queueRead(struct stripJob *job, struct ring *ring, struct asyncRead *read, uint64_t slot) {
+    size_t left = read->size - read->done;
+
+    return ringRead(ring, job->fd, read->data + read->done, left < URING_READ ? left : URING_READ,
+                    job->dir->stripOffsets[read->strip] + read->done, slot);
+}
+
+/* points read at strip j: uncompressed strips stored as decoded are read straight into their rows */
+static bool startRead(struct stripJob *job, struct asyncRead *read, uint32_t j, bool direct) {
+    const struct directory *dir = job->dir;
+
+    read->strip = j;
+    read->size = dir->compression == NO_COMPRESSION ? stripSize(dir, j) : dir->stripByteCounts[j];
+    read->done = 0;
+
+    if (direct) {
+        read->data = job->tiff->data + (size_t) j * dir->rowsPerStrip * job->tiff->stride;
+        return false;
+    }
+
+    if (read->size > read->capacity) {
+        uint8_t *p = realloc(read->buffer, read->size);
+
+        if (p == NULL)
+            return true;
+
+        read->buffer = p;
+        read->capacity = read->size;
+    }
+
+    read->data = read->buffer;
+    return false;
+}
+
+/* gives the image a new buffer for its rows and leaves the old one to reads still in flight, true when none */
+static bool abandonRows(tiff_t tiff) {
+    uint8_t *data = malloc(tiff->capacity);
+
+    tiff->data = data;
+    tiff->capacity = data != NULL ? tiff->capacity : 0;
+    return data == NULL;
+}
+
+/*
+ * reads every strip through io_uring: the ring is kept full with the reads of the next strips, and every
+ * strip is decoded from its buffer as its read completes, in whatever order, while the others are in
+ * flight. returns true only when there is no ring, before anything is read, so that pread can take over.
+ */
+static bool readStripsAsync(struct stripJob *job) {
+    const struct directory *dir = job->dir;
+    struct ring ring __attribute__((__cleanup__(ringFree)));
+    struct scratch scratch __attribute__((__cleanup__(scratchFree))) = {0};
+    struct shrink shrink __attribute__((__cleanup__(shrinkFree))) = {0};
+    bool direct = job->scale == 1 && job->tiff->format != PACKED1 && storedAsDecoded(dir);
+    struct asyncRead *reads;
+    uint32_t slots, next = 0;
+    struct tiffError err;
+
+    if (ringInit(&ring, URING_DEPTH))
+        return true;
+
+    slots = ring.entries < stripsUsed(dir) ? ring.entries : stripsUsed(dir);
+    reads = calloc(slots, sizeof(struct asyncRead));
+
+    if (reads == NULL || (job->scale > 1 && shrinkInit(&shrink, dir->width, job->scale))) {
+        err.error = MALLOC_ERROR;
+        goto fail;
+    }
+
+    for (; next < slots; ++next) {
+        if (startRead(job, &reads[next], next, direct)) {
+            err.error = MALLOC_ERROR;
+            goto fail;
         }
 
-        if (header.byteOrder == II) {
-            ifd.count = le16toh(ifd.count);
-        } else {
-            ifd.count = be16toh(ifd.count);
+        queueRead(job, &ring, &reads[next], next);
+    }
+
+    if (ringSubmit(&ring))
+        goto fallback;
+
+    while (ring.inFlight != 0) {
+        struct asyncRead *read;
+        uint64_t slot;
+        int32_t result;
+
+        if (ringWait(&ring, &slot, &result))
+            goto fallback;
+
+        read = &reads[slot];
+
+        /* a failed read gets a second chance through pread, a short one has its rest queued */
+        if ((result < 0 && preadAll(job->fd, read->data + read->done, read->size - read->done,
+                                    dir->stripOffsets[read->strip] + read->done)) || result == 0) {
+            err.data = dir->stripOffsets[read->strip];
+            err.error = READ_ERROR;
+            goto fail;
         }
 
-        DERROR("TAG COUNT: %d\n", ifd.count);
+        read->done = result < 0 ? read->size : read->done + result;
 
-        /* read tags one by one */
-        for (int i = 0; i < ifd.count; ++i) {
-            error = readAll(fd, &tag, sizeof(tag));
+        if (read->done < read->size) {
+            queueRead(job, &ring, read, slot);
+        } else {
+            struct source src = {.fd = job->fd, .window = read->data, .windowOffset = dir->stripOffsets[read->strip],
+                                 .windowSize = read->size};
 
-            if (error) {
-                err->data = sizeof(tag);
-                err->error = READ_ERROR;
-                return NULL;
-            }
+            atomic_fetch_add(&job->bytesRead, read->size);
 
-            /* correct the endianess */
-            if (header.byteOrder == II) {
-                tag.tagId = le16toh(tag.tagId);
-                tag.dataType = le16toh(tag.dataType);
-                tag.dataCount = le32toh(tag.dataCount);
-                if (tag.dataType == WORD)
-                    tag.dataOffset = le16toh(tag.dataOffset);
-                else if (tag.dataType == DWORD || tag.dataType == RATIONAL)
-                    tag.dataOffset = le32toh(tag.dataOffset);
-            } else {
-                tag.tagId = be16toh(tag.tagId);
-                tag.dataType = be16toh(tag.dataType);
-                tag.dataCount = be32toh(tag.dataCount);
-                if (tag.dataType == WORD)
-                    tag.dataOffset = be16toh(tag.dataOffset);
-                else if (tag.dataType == DWORD || tag.dataType == RATIONAL)
-                    tag.dataOffset = be32toh(tag.dataOffset);
-            }
+            if (!direct && readStrip(job, &src, read->strip, &scratch, &shrink, &err))
+                goto fail;
 
-            switch (tag.tagId) {
-                case IMAGE_WIDTH:
-                    DERROR("WIDTH: %d\n", (uint16_t) tag.dataOffset);
-                    memcpy(&width, &tag, sizeof(tag));
-                    break;
-                case IMAGE_LENGTH:
-                    DERROR("HEIGHT: %d\n", (uint16_t) tag.dataOffset);
-                    memcpy(&height, &tag, sizeof(tag));
-                    break;
-                case STRIP_BYTE_COUNTS:
-                    DERROR("SBC: %X\n", (uint16_t) tag.dataOffset);
-                    DERROR("SBCC: %d\n", (uint16_t) tag.dataCount);
-                    memcpy(&stripByteCounts, &tag, sizeof(tag));
-                    break;
-                case STRIP_OFFSETS:
-                    DERROR("SOFF: %X\n", tag.dataOffset);
-                    DERROR("SOFFC: %d\n", tag.dataCount);
-                    DERROR("SOFFT: %d\n", tag.dataType);
-                    memcpy(&stripOffset, &tag, sizeof(tag));
-                    break;
-                case SAMPLES_PER_PIXEL:
-                    DERROR("SPP: %d\n", tag.dataOffset);
-                    memcpy(&samplesPerPixel, &tag, sizeof(tag));
-                    break;
-                case BITS_PER_SAMPLE:
-                    DERROR("BPS: %d\n", tag.dataOffset);
-                    memcpy(&bitsPerSample, &tag, sizeof(tag));
-                    break;
-                case PHOTOMETRIC_INTERPRETATION:
-                    DERROR("COLOR: %d\n", tag.dataOffset);
-                    memcpy(&photometricInterpretation, &tag, sizeof(tag));
-                    break;
-                case ROWS_PER_STRIP:
-                    DERROR("RPS: %X\n", tag.dataOffset);
-                    memcpy(&rowsPerStrip, &tag, sizeof(tag));
-                default:
-                    DERROR("TAG %d/%d\n", i + 1, ifd.count);
-                    DERROR("--> ID:      %d\n", tag.tagId);
-                    DERROR("--> DTYPE:   %d\n", tag.dataType);
-                    DERROR("--> DCOUNT:  %d\n", tag.dataCount);
-                    DERROR("--> DOFFSET: %d\n", tag.dataOffset);
-                    break;
+            /* only this thread decodes, it counts straight into the histogram of the job */
+            measureStrip(job, job->histogram, read->strip);
+
+            if (next < stripsUsed(dir)) {
+                if (startRead(job, read, next++, direct)) {
+                    err.error = MALLOC_ERROR;
+                    goto fail;
+                }
+
+                queueRead(job, &ring, read, slot);
             }
         }
 
-        error = readAll(fd, &(ifd.nextIFDOffset), sizeof(ifd.nextIFDOffset));
+        if (ringSubmit(&ring))
+            goto fallback;
+    }
 
-        if (error) {
-            err->data = sizeof(ifd.nextIFDOffset);
-            err->data = READ_ERROR;
-            return NULL;
-        }
-    } while (ifd.nextIFDOffset != (uint32_t) 0);
+    for (uint32_t i = 0; i < slots; ++i)
+        free(reads[i].buffer);
+    free(reads);
+    return false;
 
-    if (photometricInterpretation.dataOffset != BLACK_IS_ZERO &&
-        photometricInterpretation.dataOffset != WHITE_IS_ZERO && photometricInterpretation.dataOffset) {
-        err->data = photometricInterpretation.dataOffset;
-        err->error = UNKNOWN_COLOR_SPACE;
-        return NULL;
+fallback:
+    /* the ring broke down under the reads, the strips are read again with pread */
+    err.data = job->fd;
+    err.error = READ_ERROR;
+    job->async = false;
+    atomic_store(&job->bytesRead, 0);
+
+    if (job->histogram != NULL)
+        memset(job->histogram, 0, sizeof(*job->histogram));
+
+fail:
+    /* the kernel may still be writing into the buffers, they are only freed once it is done with them */
+    while (ring.inFlight != 0) {
+        uint64_t slot;
+        int32_t result;
+
+        if (ringWait(&ring, &slot, &result))
+            break;
     }
 
-    /* add tiff data to struct */
-    tiff = malloc(sizeof(struct tiff));
+    /*
+     * reads whose completions could not be reaped are left to the kernel: their buffers are never freed, and
+     * direct rows move to a buffer of their own so that neither pread nor the caller freeing the image
+     * writes under it.
+     */
+    if (ring.inFlight == 0) {
+        for (uint32_t i = 0; reads != NULL && i < slots; ++i)
+            free(reads[i].buffer);
+        free(reads);
+    } else if (direct && abandonRows(job->tiff) && !job->async) {
+        err.error = MALLOC_ERROR;
+        job->async = true;
+    }
 
-    if (tiff == NULL) {
+    ringFree(&ring);
+
+    if (!job->async)
+        return true;
+
+    job->failed = true;
+    job->err = err;
+    return false;
+}
+
+/* strips are independent, every worker pulls the next unread one until none are left */
+static bool readStrips(struct stripJob *job, unsigned threads) {
+    if (!job->async || readStripsAsync(job))
+        runWorkers(job, threads < stripsUsed(job->dir) ? threads : stripsUsed(job->dir), stripWorker);
+
+    if (!job->failed && job->raw)
+        runWorkers(job, threads, finishWorker);
+
+    return job->failed;
+}
+
+tiff_t const readFD(int fd, struct tiffError *const err) {
+    return readFDOptions(fd, NULL, err);
+}
+
+tiff_t const readFDStats(int fd, struct tiffStats *const stats, struct tiffError *const err) {
+    struct tiffOptions opts = {.threads = 1, .stats = stats};
+
+    return readFDOptions(fd, &opts, err);
+}
+
+/* shrinks a tiled image a row of tiles at a time */
+static bool shrinkTiles(struct source *src, const struct directory *dir, unsigned scale, struct scratch *scratch,
+                        tiff_t tiff, struct tiffError *const err) {
+    struct shrink shrink __attribute__((__cleanup__(shrinkFree))) = {0};
+    uint8_t *rows;
+
+    if (shrinkInit(&shrink, dir->width, scale) || (rows = shrinkBand(&shrink, dir->width, dir->tileLength)) == NULL) {
         err->error = MALLOC_ERROR;
+        return true;
+    }
+
+    for (uint32_t y = 0; y < dir->height; y += dir->tileLength) {
+        uint32_t count = dir->height - y < dir->tileLength ? dir->height - y : dir->tileLength;
+
+        if (decodeRegion(src, dir, 0, y, dir->width, count, scratch, rows, err))
+            return true;
+
+        shrinkRows(&shrink, rows, false, y, count, dir->height, tiff->data);
+    }
+
+    return false;
+}
+
+/* decodes a tiled image a row of tiles at a time when it is measured, so that each is counted while in cache */
+static bool decodeTiles(struct source *src, const struct directory *dir, struct scratch *scratch, tiff_t tiff,
+                        struct histogram *h, struct tiffError *const err) {
+    if (h == NULL)
+        return decodeRegion(src, dir, 0, 0, dir->width, dir->height, scratch, tiff->data, err);
+
+    for (uint32_t y = 0; y < dir->height; y += dir->tileLength) {
+        uint32_t count = dir->height - y < dir->tileLength ? dir->height - y : dir->tileLength;
+
+        if (decodeRegion(src, dir, 0, y, dir->width, count, scratch, tiffRow(tiff, y), err))
+            return true;
+
+        histogramRows(h, tiff->format, tiff->width, tiffRow(tiff, y), tiff->stride, count);
+    }
+
+    return false;
+}
+
+/* the image newTiff would make for dir, in the buffers of reuse */
+static void resetTiff(tiff_t reuse, const struct directory *dir) {
+    reuse->byteOrder = dir->byteOrder;
+    reuse->width = dir->width;
+    reuse->height = dir->height;
+    reuse->format = directoryFormat(dir);
+    reuse->stride = dir->width * directoryPixelBytes(dir);
+}
+
+/*
+ * decodes the whole image described by dir, src has already been used to read it.
+ * with reuse the pixels go to its buffer, grown when too small, and it is returned.
+ */
+static tiff_t decodeImage(struct source *src, const struct directory *dir, const struct tiffOptions *const opts,
+                          tiff_t reuse, struct tiffError *const err) {
+    tiff_t tiff;
+    struct tiffStats *stats = opts != NULL ? opts->stats : NULL;
+    unsigned threads = opts != NULL && opts->threads > 1 ? opts->threads : 1;
+    unsigned scale = opts != NULL && opts->scale > 1 ? opts->scale : 1;
+    struct stripJob job = {.fd = src->fd, .dir = dir, .scale = scale, .lock = PTHREAD_MUTEX_INITIALIZER};
+    struct scratch scratch __attribute__((__cleanup__(scratchFree))) = {0};
+    struct histogram histogram;
+    size_t size;
+    bool failed;
+
+    if (checkDirectory(dir, err))
+        return NULL;
+
+    if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+        err->data = scale;
+        err->error = OUT_OF_RANGE;
         return NULL;
     }
 
-    tiff->byteOrder = header.byteOrder;
-    tiff->width = width.dataOffset;
-    tiff->height = height.dataOffset;
+    /* the box filters only add up 1 and 8 bit gray */
+    if (scale > 1 && directoryFormat(dir) != GRAY8) {
+        err->data = dir->bitsPerSample;
+        err->error = UNSUPPORTED_SAMPLE_SIZE;
+        return NULL;
+    }
 
-    uint8_t *buff __attribute__((__cleanup__(clean8)));
-    uint32_t buffSize = 0;
-    if (stripOffset.dataCount == 1) {
-        error = lseek(fd, stripOffset.dataOffset, SEEK_SET);
-        if (error == -1) {
-            err->data = stripOffset.dataOffset;
-            err->error = SEEK_ERROR;
-            return NULL;
-        }
+    /* a box split between two strips needs both in order, so only aligned strips shrink in parallel */
+    if (scale > 1 && dir->rowsPerStrip % scale != 0)
+        threads = 1;
 
-        buff = malloc(sizeof(uint8_t) * stripByteCounts.dataOffset);
-        buffSize = sizeof(uint8_t) * stripByteCounts.dataOffset;
-        sleep(100);
+    if (reuse != NULL)
+        resetTiff(reuse, dir);
 
-        if (buff == NULL) {
-            err->error = MALLOC_ERROR;
-            return NULL;
-        }
+    tiff = reuse != NULL ? reuse : newTiff(dir, err);
 
-        error = readAll(fd, buff, sizeof(uint8_t) * stripByteCounts.dataOffset);
-        if (error) {
-            // todo cleanup
-            err->data = sizeof(uint8_t) * stripByteCounts.dataOffset;
-            err->error = READ_ERROR;
-            return NULL;
-        }
-    } else {
-        uint32_t *offsets __attribute__((__cleanup__(clean32))) = malloc(sizeof(uint32_t) * stripOffset.dataCount);
-        uint32_t *byteCounts __attribute__((__cleanup__(clean32))) = malloc(
-                sizeof(uint32_t) * stripByteCounts.dataCount);
+    if (tiff == NULL)
+        return NULL;
+
+    /* packed rows are kept as the file stores them, 8 times smaller than expanded ones */
+    if (opts != NULL && opts->packed && dir->bitsPerSample == 1 && scale == 1) {
+        tiff->format = PACKED1;
+        tiff->stride = (tiff->width + 7) / 8;
+    }
+
+    /* a thumbnail is decoded straight from the strips, the full size image is never allocated */
+    if (scale > 1) {
+        tiff->width = (dir->width + scale - 1) / scale;
+        tiff->height = (dir->height + scale - 1) / scale;
+        tiff->stride = tiff->width;
+    }
+
+    size = sizeof(uint8_t) * tiff->stride * tiff->height;
+
+    if (size > tiff->capacity) {
+        uint8_t *data = realloc(tiff->data, size);
 
-        if (offsets == NULL || byteCounts == NULL) {
+        if (data == NULL) {
+            if (tiff != reuse)
+                free(tiff);
             err->error = MALLOC_ERROR;
             return NULL;
         }
 
-        /* read offsets */
-        error = lseek(fd, stripOffset.dataOffset, SEEK_SET);
-        if (error == -1) {
-            // todo cleanup
-            err->data = stripOffset.dataOffset;
-            err->error = SEEK_ERROR;
+        tiff->data = data;
+        tiff->capacity = size;
+    }
+
+    job.tiff = tiff;
+
+    if (opts != NULL && opts->histogram != NULL) {
+        memset(&histogram, 0, sizeof(histogram));
+        job.histogram = &histogram;
+    }
+
+    job.refill = dir->tileWidth == 0 && storedInOrder(dir) ? UINT32_MAX : 0;
+
+    /* with fewer strips than threads only some of them inflate, so the predictor runs on all of them after */
+    job.raw = differenced(dir) && threads > stripsUsed(dir) && directoryPlanes(dir) == 1 && scale == 1;
+
+    /* strips are decoded as their reads complete, out of order, which the boxes of a thumbnail only allow when aligned */
+    job.async = opts != NULL && opts->async && directoryPlanes(dir) == 1 && dir->rowsPerStrip % scale == 0;
+
+    if (dir->tileWidth != 0 && scale > 1) {
+        failed = shrinkTiles(src, dir, scale, &scratch, tiff, err);
+    } else if (dir->tileWidth != 0 && tiff->format == PACKED1) {
+        failed = decodeTilesPacked(src, dir, &scratch, tiff->data, err);
+    } else if (dir->tileWidth != 0) {
+        /* tiled images are decoded serially */
+        failed = decodeTiles(src, dir, &scratch, tiff, job.histogram, err);
+    } else if ((failed = readStrips(&job, threads))) {
+        *err = job.err;
+    }
+
+    if (failed) {
+        /* a reused image stays with the caller, its pixels are undefined */
+        if (tiff != reuse)
+            tiffFree(tiff);
+        return NULL;
+    }
+
+    if (job.histogram != NULL) {
+        /* thumbnails and packed tiles are only whole now, and a fraction of the size of the image */
+        if (scale > 1 || (dir->tileWidth != 0 && tiff->format == PACKED1))
+            histogramRows(&histogram, tiff->format, tiff->width, tiff->data, tiff->stride, tiff->height);
+
+        histogramFinish(&histogram, tiff->format, opts->histogram);
+    }
+
+    /* turned upright once whole, a thumbnail after it has shrunk */
+    if (opts != NULL && opts->orient && orientImage(tiff, dir->orientation, threads, err)) {
+        if (tiff != reuse)
+            tiffFree(tiff);
+        return NULL;
+    }
+
+    src->bytesRead += job.bytesRead;
+    statsEnd(stats, src);
+
+    if (stats != NULL)
+        stats->bytesCopied = (uint64_t) tiff->stride * tiff->height;
+
+    return tiff;
+}
+
+tiff_t const readFDOptions(int fd, const struct tiffOptions *const opts, struct tiffError *const err) {
+    struct source src = {.fd = fd};
+    struct directory dir __attribute__((__cleanup__(directoryFree))) = {0};
+
+    statsBegin(opts != NULL ? opts->stats : NULL);
+
+    if (readDirectory(&src, &dir, err))
+        return NULL;
+
+    return decodeImage(&src, &dir, opts, NULL, err);
+}
+
+tiff_t const readFDReuse(int fd, tiff_t reuse, const struct tiffOptions *const opts, struct tiffError *const err) {
+    struct source src = {.fd = fd};
+    struct directory dir __attribute__((__cleanup__(directoryFree))) = {0};
+
+    statsBegin(opts != NULL ? opts->stats : NULL);
+
+    if (reuse != NULL && reuse->map != NULL) {
+        err->data = fd;
+        err->error = MAP_ERROR;
+        return NULL;
+    }
+
+    /* the pixels of a shared image are still read by its other holders */
+    if (reuse != NULL && atomic_load(&reuse->refs) > 1) {
+        err->data = fd;
+        err->error = SHARED_IMAGE;
+        return NULL;
+    }
+
+    if (readDirectory(&src, &dir, err))
+        return NULL;
+
+    return decodeImage(&src, &dir, opts, reuse, err);
+}
+
+tiff_t const readPage(int fd, tiffPages_t pages, uint32_t page, struct tiffError *const err) {
+    struct source src = {.fd = fd};
+    const struct directory *dir = pagesDirectory(pages, page, &src, err);
+
+    if (dir == NULL)
+        return NULL;
+
+    return decodeImage(&src, dir, NULL, NULL, err);
+}
+
+tiff_t const readLevel(int fd, uint32_t level, struct tiffError *const err) {
+    struct source src = {.fd = fd};
+    struct fileHeader header;
+    struct directory dir __attribute__((__cleanup__(directoryFree))) = {0};
+    uint64_t *subIfds __attribute__((__cleanup__(clean64))) = NULL;
+    uint32_t count;
+    uint64_t next;
+
+    if (readHeader(&src, &header, err) || readIfd(&src, &header, header.first, &dir, &next, err))
+        return NULL;
+
+    if (level != 0) {
+        if (tagFind(&dir.tags, SUB_IFDS) == NULL) {
+            err->data = level;
+            err->error = OUT_OF_RANGE;
             return NULL;
         }
-        error = readAll(fd, offsets, sizeof(uint32_t) * stripOffset.dataCount);
-        if (error) {
-            // todo cleanup
-            err->data = sizeof(uint32_t) * stripOffset.dataCount;
-            err->error = READ_ERROR;
+
+        if (tagIntegers(&src, &dir.tags, SUB_IFDS, &subIfds, &count, err))
             return NULL;
-        }
 
-        /* read byte counts */
-        error = lseek(fd, stripByteCounts.dataOffset, SEEK_SET);
-        if (error == -1) {
-            // todo cleanup
-            err->data = stripByteCounts.dataOffset;
-            err->error = SEEK_ERROR;
+        if (level > count) {
+            err->data = level;
+            err->error = OUT_OF_RANGE;
             return NULL;
         }
-        error = readAll(fd, byteCounts, sizeof(uint32_t) * stripByteCounts.dataCount);
-        if (error) {
-            // todo cleanup
-            err->data = sizeof(uint32_t) * stripByteCounts.dataCount;
-            err->error = READ_ERROR;
+
+        directoryFree(&dir);
+
+        if (readIfd(&src, &header, subIfds[level - 1], &dir, &next, err))
             return NULL;
-        }
+    }
 
-        /* find total required buffer size */
-        for (int i = 0; i < stripByteCounts.dataCount; ++i) {
-            buffSize += byteCounts[i];
-        }
+    if (directoryLoad(&src, &dir, err))
+        return NULL;
 
-        buff = malloc(sizeof(uint8_t) * buffSize);
+    return decodeImage(&src, &dir, NULL, NULL, err);
+}
 
-        if (buff == NULL) {
-            err->error = MALLOC_ERROR;
-            return NULL;
+tiff_t const readMapped(int fd, bool orient, struct tiffStats *const stats, struct tiffError *const err) {
+    tiff_t tiff;
+    struct stat st;
+    struct source src = {.fd = fd};
+    struct directory dir __attribute__((__cleanup__(directoryFree))) = {0};
+    struct scratch scratch __attribute__((__cleanup__(scratchFree))) = {0};
+    uint8_t *map;
+    bool contiguous = true;
+    size_t rowBytes;
+
+    statsBegin(stats);
+
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        err->data = fd;
+        err->error = MAP_ERROR;
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+    if (map == MAP_FAILED) {
+        err->data = fd;
+        err->error = MAP_ERROR;
+        return NULL;
+    }
+
+    src.map = map;
+    src.size = st.st_size;
+
+    if (readDirectory(&src, &dir, err) || checkDirectory(&dir, err)) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    rowBytes = directoryRowBytes(&dir);
+
+    for (uint32_t j = 0; j < stripsUsed(&dir) && dir.tileWidth == 0; ++j) {
+        if (dir.stripOffsets[j] != dir.stripOffsets[0] + (size_t) j * dir.rowsPerStrip * rowBytes)
+            contiguous = false;
+    }
+
+    tiff = newTiff(&dir, err);
+
+    if (tiff == NULL) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    if (stats != NULL)
+        stats->bytesMapped = st.st_size;
+
+    /* an image to be turned upright is turned in a copy of its own */
+    if (dir.tileWidth == 0 && storedAsDecoded(&dir) && contiguous && (!orient || dir.orientation == TOP_LEFT) &&
+        sourceFetch(&src, dir.stripOffsets[0], NULL, rowBytes * dir.height) != NULL) {
+        /* the mapping is private, so callers writing to data never reach the file */
+        tiff->data = map + dir.stripOffsets[0];
+        tiff->map = map;
+        tiff->mapSize = st.st_size;
+        statsEnd(stats, &src);
+        return tiff;
+    }
+
+    tiff->data = malloc(sizeof(uint8_t) * tiff->stride * tiff->height);
+    tiff->capacity = sizeof(uint8_t) * tiff->stride * tiff->height;
+
+    if (tiff->data == NULL) {
+        munmap(map, st.st_size);
+        free(tiff);
+        err->error = MALLOC_ERROR;
+        return NULL;
+    }
+
+    if (decodeRegion(&src, &dir, 0, 0, dir.width, dir.height, &scratch, tiff->data, err) ||
+        (orient && orientImage(tiff, dir.orientation, 1, err))) {
+        munmap(map, st.st_size);
+        tiffFree(tiff);
+        return NULL;
+    }
+
+    munmap(map, st.st_size);
+    statsEnd(stats, &src);
+
+    if (stats != NULL)
+        stats->bytesCopied = (uint64_t) tiff->stride * tiff->height;
+
+    return tiff;
+}
+
+tiff_t const readRegion(int fd, uint32_t x, uint32_t y, uint32_t w, uint32_t h, struct tiffError *const err) {
+    tiff_t tiff;
+    struct source src = {.fd = fd};
+    struct directory dir __attribute__((__cleanup__(directoryFree))) = {0};
+    struct scratch scratch __attribute__((__cleanup__(scratchFree))) = {0};
+
+    if (readDirectory(&src, &dir, err) || checkDirectory(&dir, err))
+        return NULL;
+
+    if (w == 0 || h == 0 || x >= dir.width || y >= dir.height || w > dir.width - x || h > dir.height - y) {
+        err->data = x >= dir.width || w > dir.width - x ? x : y;
+        err->error = OUT_OF_RANGE;
+        return NULL;
+    }
+
+    tiff = newTiff(&dir, err);
+
+    if (tiff == NULL)
+        return NULL;
+
+    tiff->width = w;
+    tiff->height = h;
+    tiff->stride = w * directoryPixelBytes(&dir);
+    tiff->data = malloc(sizeof(uint8_t) * tiff->stride * h);
+    tiff->capacity = sizeof(uint8_t) * tiff->stride * h;
+
+    if (tiff->data == NULL) {
+        free(tiff);
+        err->error = MALLOC_ERROR;
+        return NULL;
+    }
+
+    if (decodeRegion(&src, &dir, x, y, w, h, &scratch, tiff->data, err)) {
+        tiffFree(tiff);
+        return NULL;
+    }
+
+    return tiff;
+}
+
+void tiffFree(tiff_t tiff) {
+    if (tiff == NULL || atomic_fetch_sub(&tiff->refs, 1) > 1)
+        return;
+
+    if (tiff->map != NULL)
+        munmap(tiff->map, tiff->mapSize);
+    else
+        free(tiff->data);
+
+    free(tiff);
+}
+
+tiff_t tiffRetain(tiff_t tiff) {
+    atomic_fetch_add(&tiff->refs, 1);
+    return tiff;
+}
+
+uint32_t pixelBits(enum pixelFormat format) {
+    switch (format) {
+        case PACKED1:
+            return 1;
+        case GRAY16:
+            return 16;
+        case RGB24:
+            return 24;
+        case RGB48:
+            return 48;
+        default:
+            return 8;
+    }
+}
+
+uint8_t *tiffRow(tiff_t tiff, uint32_t y) {
+    return tiff->data + (size_t) y * tiff->stride;
+}
+
+uint8_t tiffPixel(tiff_t tiff, uint32_t x, uint32_t y) {
+    const uint8_t *row = tiffRow(tiff, y);
+
+    switch (tiff->format) {
+        case PACKED1:
+            return row[x / 8] & (0x80 >> x % 8) ? 0 : 255;
+        case GRAY16:
+            return high8(row + 2 * (size_t) x);
+        case RGB24:
+            return luma(row[3 * (size_t) x], row[3 * (size_t) x + 1], row[3 * (size_t) x + 2]);
+        case RGB48:
+            row += 6 * (size_t) x;
+            return luma(high8(row), high8(row + 2), high8(row + 4));
+        default:
+            return row[x];
+    }
+}
+
+/* inverting every byte inverts samples of any width */
+void tiffInvert(tiff_t tiff) {
+    for (uint32_t y = 0; y < tiff->height; ++y) {
+        if (tiff->format == PACKED1)
+            bitsInvert(tiffRow(tiff, y), tiff->width);
+        else
+            invertBytes(tiffRow(tiff, y), (size_t) tiff->width * pixelBits(tiff->format) / 8);
+    }
+}
+
+uint64_t tiffCountBlack(tiff_t tiff) {
+    size_t pixelBytes = pixelBits(tiff->format) / 8;
+    uint64_t count = 0;
+
+    for (uint32_t y = 0; y < tiff->height; ++y) {
+        const uint8_t *row = tiffRow(tiff, y);
+
+        if (tiff->format == PACKED1) {
+            count += bitsCount(row, tiff->width);
+            continue;
         }
 
-        /* read into buffer */
-        size_t t = 0;
-        for (int j = 0; j < stripOffset.dataCount; ++j) {
-            lseek(fd, offsets[j], SEEK_SET);
-            if (error == -1) {
-                // todo cleanup
-                err->data = offsets[j];
-                err->error = SEEK_ERROR;
-                return NULL;
-            }
-            error = readAll(fd, buff + t, byteCounts[j]);
-            if (error) {
-                // todo cleanup
-                err->data = byteCounts[j];
-                err->error = READ_ERROR;
-                return NULL;
-            }
-            t += byteCounts[j];
+        if (tiff->format == GRAY8) {
+            for (uint32_t x = 0; x < tiff->width; ++x)
+                count += row[x] == 0;
+            continue;
         }
-    }
 
-    if (bitsPerSample.dataOffset == 1) {
-        tiff->data = malloc(sizeof(uint8_t) * tiff->width * tiff->height);
-        for (int i = 0; i < tiff->height; ++i) {
-            size_t start = i * (tiff->width / 8 + (tiff->width % 8 == 0 ? 0 : 1));
-            for (int j = 0; j < tiff->width; ++j) {
-                uint8_t shift = j % 8;
-                int bi = j / 8;
-                uint8_t v = (buff[start + bi] & ((uint8_t) 0x01 << (7 - shift))) == WHITE_IS_ZERO ? (uint8_t) 0
-                                                                                                  : (uint8_t) 255;
+        for (uint32_t x = 0; x < tiff->width; ++x) {
+            size_t i = 0;
 
-                tiff->data[i * tiff->width + j] = v;
-            }
+            while (i < pixelBytes && row[x * pixelBytes + i] == 0)
+                ++i;
+            count += i == pixelBytes;
         }
-    } else if (bitsPerSample.dataOffset == 8) {
-        tiff->data = buff;
-        buff = NULL;
     }
-    return tiff;
-}
\ No newline at end of file
+
+    return count;
+}
+
+void tiffMeasure(tiff_t tiff, struct tiffHistogram *histogram) {
+    struct histogram h = {0};
+
+    histogramRows(&h, tiff->format, tiff->width, tiff->data, tiff->stride, tiff->height);
+    histogramFinish(&h, tiff->format, histogram);
+}
+
+uint32_t tiffRowCompare(tiff_t tiff, uint32_t a, uint32_t b) {
+    const uint8_t *ra = tiffRow(tiff, a);
+    const uint8_t *rb = tiffRow(tiff, b);
+    size_t pixelBytes = pixelBits(tiff->format) / 8;
+    size_t size = (size_t) tiff->width * pixelBytes;
+    size_t i = 0;
+
+    if (tiff->format == PACKED1)
+        return bitsCompare(ra, rb, tiff->width);
+
+    while (i < size && ra[i] == rb[i])
+        ++i;
+
+    return i / pixelBytes;
+}
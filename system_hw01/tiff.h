@@ -7,12 +7,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>3
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <endian.h>
 
 enum byteOrder {
@@ -57,29 +58,96 @@ enum tagId {
     FREE_BYTE_COUNTS,
     GRAY_RESPONSE_UNIT,
     GRAY_RESPONSE_CURVE,
+    T4_OPTIONS,
+    T6_OPTIONS,
     RESOLUTION_UNIT = 0x0128,
     SOFTWARE = 0x0131,
     DATE_TIME,
     ARTIST = 0x013B,
     HOST_COMPUTER,
+    PREDICTOR,
     COLOR_MAP = 0x0140,
+    TILE_WIDTH = 0x0142,
+    TILE_LENGTH,
+    TILE_OFFSETS,
+    TILE_BYTE_COUNTS,
+    SUB_IFDS = 0x014A,
     EXTRA_SAMPLES = 0x0152,
     COPYRIGHT = 0x8298
 };
 
+enum compression {
+    NO_COMPRESSION = 1,
+    CCITT_RLE,
+    CCITT_T4,
+    CCITT_T6,
+    LZW,
+    PACKBITS = 0x8005
+};
+
+enum predictor {
+    NO_PREDICTOR = 1,
+    HORIZONTAL_DIFFERENCING
+};
+
+/* where row 0 and column 0 of the stored image are shown, the side of row 0 first */
+enum orientation {
+    TOP_LEFT = 1,
+    TOP_RIGHT,
+    BOTTOM_RIGHT,
+    BOTTOM_LEFT,
+    LEFT_TOP,
+    RIGHT_TOP,
+    RIGHT_BOTTOM,
+    LEFT_BOTTOM
+};
+
+enum planarConfiguration {
+    CHUNKY = 1,
+    PLANAR
+};
+
 enum dataType {
     BYTE = 1,
     ASCIIZ,
     WORD,
     DWORD,
-    RATIONAL
+    RATIONAL,
+    /* a DWORD that is the offset of an ifd */
+    IFD = 13,
+    LONG8 = 16,
+    SLONG8,
+    IFD8
+};
+
+enum pixelFormat {
+    /* one byte per pixel, 0 is black and 255 white whatever the photometric interpretation */
+    GRAY8 = 0,
+    /* 1 bit per pixel, rows packed most significant bit first as stored, a set bit is black */
+    PACKED1,
+    /* two bytes per pixel in host byte order, 0 is black and 65535 white */
+    GRAY16,
+    /* red, green and blue bytes of every pixel together, planar files are interleaved */
+    RGB24,
+    /* red, green and blue 16 bit samples in host byte order */
+    RGB48
 };
 
 typedef struct tiff {
     enum byteOrder byteOrder;
     uint32_t width;
     uint32_t height;
+    enum pixelFormat format;
+    /* bytes from one row to the next, rows of packed images are padded to a whole byte */
+    size_t stride;
     uint8_t *data;
+    /* bytes allocated at data, which readFDReuse fills again without reallocating when they suffice */
+    size_t capacity;
+    /* set when data points into a private mapping of the file, see readMapped */
+    void *map;
+    size_t mapSize;
+    /* holders of the image, see tiffRetain. an image with more than one must not be changed */
+    atomic_uint refs;
 } *tiff_t;
 
 enum tiffErrorE {
@@ -88,6 +156,16 @@ enum tiffErrorE {
     SEEK_ERROR,
     UNKNOWN_COLOR_SPACE,
     MALLOC_ERROR,
+    MAP_ERROR,
+    UNSUPPORTED_SAMPLE_SIZE,
+    CORRUPT_DATA,
+    OUT_OF_RANGE,
+    UNSUPPORTED_COMPRESSION,
+    DECODE_ERROR,
+    WRITE_ERROR,
+    STALE_INDEX,
+    UNSUPPORTED_PREDICTOR,
+    SHARED_IMAGE,
 };
 
 struct tiffError {
@@ -95,8 +173,191 @@ struct tiffError {
     enum tiffErrorE error;
 };
 
+/* i/o accounting of a single read, used to compare the copy and the mapped paths */
+struct tiffStats {
+    uint64_t bytesRead;
+    uint64_t bytesMapped;
+    uint64_t bytesCopied;
+    long minorFaults;
+    long majorFaults;
+};
+
+/* what a decode measures of the pixels it writes when its options ask for it, see tiffMeasure */
+struct tiffHistogram {
+    /* pixels by their tiffPixel value, packed images only have 0 and 255 */
+    uint64_t bins[256];
+    uint64_t pixels;
+    /* pixels with every sample 0, as tiffCountBlack counts them */
+    uint64_t black;
+    double blackRatio;
+    /* the lowest and highest tiffPixel values, 255 and 0 for an empty image */
+    uint8_t min;
+    uint8_t max;
+};
+
+struct tiffOptions {
+    /* strips are fetched with pread and decoded on this many threads, 0 or 1 reads serially */
+    unsigned threads;
+    struct tiffStats *stats;
+    /* bilevel images are returned as PACKED1, others stay GRAY8 */
+    bool packed;
+    /* 2, 4 or 8 returns a GRAY8 thumbnail that much smaller on each side, averaging every box. 1 and 8 bit gray only */
+    unsigned scale;
+    /*
+     * strip reads are all queued on io_uring at once and every strip is decoded on the calling thread
+     * as its read completes, in place of the strip threads. pread is used where there is no io_uring.
+     */
+    bool async;
+    /*
+     * filled with the histogram of the image returned, counted strip by strip right after each is
+     * decoded and still in cache rather than in a second pass over the image. thumbnails and packed
+     * tiled images are only whole at the end, and counted then.
+     */
+    struct tiffHistogram *histogram;
+    /*
+     * the image is turned upright as its ORIENTATION tag says right after it is decoded, width and height
+     * swapped for the orientations that need it. the histogram is the same either way.
+     */
+    bool orient;
+};
+
 const char *const tiffErrorF(struct tiffError const error);
 
 tiff_t const readFD(int fd, struct tiffError *const error) __attribute__((warn_unused_result));
 
+tiff_t const readFDStats(int fd, struct tiffStats *const stats, struct tiffError *const error)
+__attribute__((warn_unused_result));
+
+tiff_t const readFDOptions(int fd, const struct tiffOptions *const opts, struct tiffError *const error)
+__attribute__((warn_unused_result));
+
+/*
+ * like readFDOptions, but decodes into the buffer of an image from an earlier read and returns it.
+ * reuse may be NULL, but not shared. on failure it stays allocated, with undefined pixels, and must
+ * still be freed.
+ */
+tiff_t const readFDReuse(int fd, tiff_t reuse, const struct tiffOptions *const opts, struct tiffError *const error)
+__attribute__((warn_unused_result));
+
+/*
+ * maps the whole file; 8 bit images laid out contiguously are returned without copying. with orient, images
+ * whose ORIENTATION tag says they are not stored upright are decoded and turned upright as with the orient
+ * option, and lose the copy they would have been spared. without it they are returned as stored.
+ */
+tiff_t const readMapped(int fd, bool orient, struct tiffStats *const stats, struct tiffError *const error)
+__attribute__((warn_unused_result));
+
+/*
+ * decodes only the w x h pixels at (x, y), reading just the strips or tiles that overlap them. the region is
+ * of the image as stored, whatever its ORIENTATION tag says.
+ */
+tiff_t const readRegion(int fd, uint32_t x, uint32_t y, uint32_t w, uint32_t h, struct tiffError *const error)
+__attribute__((warn_unused_result));
+
+/* drops a reference to the image, which is freed with the last one */
+void tiffFree(tiff_t tiff);
+
+/* adds a reference to the image for another holder, each one is dropped by tiffFree */
+tiff_t tiffRetain(tiff_t tiff);
+
+/* bits of one pixel in rows of the format */
+uint32_t pixelBits(enum pixelFormat format);
+
+uint8_t *tiffRow(tiff_t tiff, uint32_t y);
+
+/* 0 for black and 255 for white in every format, 16 bit samples are cut to their high byte and rgb to its luma */
+uint8_t tiffPixel(tiff_t tiff, uint32_t x, uint32_t y);
+
+void tiffInvert(tiff_t tiff);
+
+/* pixels with every sample 0 */
+uint64_t tiffCountBlack(tiff_t tiff);
+
+/* the histogram of an image already decoded, the same a decode with a histogram in its options fills */
+void tiffMeasure(tiff_t tiff, struct tiffHistogram *histogram);
+
+/* the first pixel at which rows a and b differ, or the width when they are equal */
+uint32_t tiffRowCompare(tiff_t tiff, uint32_t a, uint32_t b);
+
+/*
+ * writes strips, or rows of tiles, as their rows arrive. the header, ifd and block tables go in front once
+ * all are written.
+ */
+typedef struct tiffWriter *tiffWriter_t;
+
+struct tiffWriteOptions {
+    /* 0 picks strips of about 8 KB */
+    uint32_t rowsPerStrip;
+    /* NO_COMPRESSION or PACKBITS, 0 is NO_COMPRESSION */
+    uint16_t compression;
+    /* tiles of this size in place of strips when not 0, both multiples of 16 */
+    uint32_t tileWidth;
+    uint32_t tileLength;
+};
+
+/* fd must be seekable, PACKED1 is stored as a 1 bit image and GRAY8 as an 8 bit one, other formats are refused */
+tiffWriter_t const writerOpen(int fd, uint32_t width, uint32_t height, enum pixelFormat format,
+                              const struct tiffWriteOptions *const opts, struct tiffError *const error)
+__attribute__((warn_unused_result));
+
+/* appends count rows laid out one after another, in the format the writer was opened with */
+bool writerRows(tiffWriter_t writer, const uint8_t *rows, uint32_t count, struct tiffError *const error);
+
+/* writes the metadata once every row has been given and frees the writer, even on failure */
+bool writerClose(tiffWriter_t writer, struct tiffError *const error);
+
+/* frees the writer and leaves the file unfinished */
+void writerAbort(tiffWriter_t writer);
+
+/* writes the image as a classic little endian tiff */
+bool writeFD(int fd, tiff_t tiff, const struct tiffWriteOptions *const opts, struct tiffError *const error);
+
+/*
+ * streams the first image of in through the reader and writes it tiled to out, followed by levels reductions
+ * each half the size of the one before as its SubIFDs. 0 levels halves until a level fits in a tile. every
+ * reduction runs on a thread of its own, fed by the one above a few rows at a time, and only holds those and
+ * a row of tiles. gray images of up to 8 bits only, all levels are written GRAY8. without tiles in opts
+ * they are 256 x 256.
+ */
+bool writePyramid(int in, int out, unsigned levels, const struct tiffWriteOptions *const opts,
+                  struct tiffError *const error);
+
+/*
+ * decodes level n of a pyramid like the ones writePyramid writes, counting the SubIFDs of its first image from 1,
+ * 0 is the image. the SubIFDs may be stored as LONG, IFD, LONG8 or IFD8.
+ */
+tiff_t const readLevel(int fd, uint32_t level, struct tiffError *const error) __attribute__((warn_unused_result));
+
+/* every page of a multi page file, indexed by one walk over the ifd chain */
+typedef struct tiffPages *tiffPages_t;
+
+struct tiffPageInfo {
+    uint32_t width;
+    uint32_t height;
+    uint16_t bitsPerSample;
+    uint16_t samplesPerPixel;
+    uint16_t compression;
+    /* as the ORIENTATION tag says, readPage returns the page as stored and leaves turning it to the caller */
+    uint16_t orientation;
+};
+
+tiffPages_t const pagesOpen(int fd, struct tiffError *const error) __attribute__((warn_unused_result));
+
+/* writes the index to a sidecar file, so that the chain need not be walked again */
+bool pagesSave(int fd, tiffPages_t pages, int indexFd, struct tiffError *const error);
+
+/* reads an index written by pagesSave, fails with STALE_INDEX when the file changed since */
+tiffPages_t const pagesLoad(int fd, int indexFd, struct tiffError *const error) __attribute__((warn_unused_result));
+
+uint32_t pagesCount(tiffPages_t pages);
+
+/* returns true for a page past the end */
+bool pageInfo(tiffPages_t pages, uint32_t page, struct tiffPageInfo *info);
+
+/* decodes page n, counting from 0, without touching the ifds of the others. it is returned as stored */
+tiff_t const readPage(int fd, tiffPages_t pages, uint32_t page, struct tiffError *const error)
+__attribute__((warn_unused_result));
+
+void pagesClose(tiffPages_t pages);
+
 #endif //SYSTEM_HW01_TIFF_H
@@ -0,0 +1,185 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <pthread.h>
+#include "unpack.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/* 8 output bytes for every input byte, packed into a word in memory order */
+static uint64_t lut[256];
+static unpackFn kernel;
+static swapFn swapKernel;
+static const char *kernelName;
+static pthread_once_t lutOnce = PTHREAD_ONCE_INIT;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static void buildLut(void) {
+    for (int b = 0; b < 256; ++b) {
+        uint8_t bytes[8];
+
+        for (int i = 0; i < 8; ++i)
+            bytes[i] = b & (0x80 >> i) ? 0xFF : 0x00;
+
+        __builtin_memcpy(&lut[b], bytes, sizeof(bytes));
+    }
+}
+
+/* the last, padded byte of a row is expanded one pixel at a time */
+static void unpackTail(const uint8_t *packed, uint32_t from, uint32_t width, uint8_t *row, uint8_t flip) {
+    for (uint32_t j = from; j < width; ++j)
+        row[j] = (packed[j / 8] & (0x80 >> j % 8) ? 0xFF : 0x00) ^ flip;
+}
+
+void unpackRowScalar(const uint8_t *packed, uint32_t width, uint8_t *row, uint8_t flip) {
+    uint64_t mask = flip * 0x0101010101010101ull;
+    uint32_t bytes = width / 8;
+
+    pthread_once(&lutOnce, buildLut);
+
+    for (uint32_t i = 0; i < bytes; ++i) {
+        uint64_t v = lut[packed[i]] ^ mask;
+        __builtin_memcpy(row + 8 * i, &v, sizeof(v));
+    }
+
+    unpackTail(packed, bytes * 8, width, row, flip);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* 16 packed bytes to 128 pixels: every byte is spread over 8 lanes and tested against its bit */
+__attribute__((target("sse2")))
+void unpackRowSSE2(const uint8_t *packed, uint32_t width, uint8_t *row, uint8_t flip) {
+    const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, (char) 128, 1, 2, 4, 8, 16, 32, 64, (char) 128);
+    const __m128i xor = _mm_set1_epi8((char) flip);
+    uint32_t blocks = width / 128;
+
+    for (uint32_t i = 0; i < blocks; ++i) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (packed + 16 * i));
+        __m128i b8[2] = {_mm_unpacklo_epi8(v, v), _mm_unpackhi_epi8(v, v)};
+        uint8_t *out = row + 128 * i;
+
+        for (int h = 0; h < 2; ++h) {
+            __m128i b16[2] = {_mm_unpacklo_epi16(b8[h], b8[h]), _mm_unpackhi_epi16(b8[h], b8[h])};
+
+            for (int q = 0; q < 2; ++q) {
+                __m128i b32[2] = {_mm_unpacklo_epi32(b16[q], b16[q]), _mm_unpackhi_epi32(b16[q], b16[q])};
+
+                for (int k = 0; k < 2; ++k) {
+                    __m128i r = _mm_cmpeq_epi8(_mm_and_si128(b32[k], bits), bits);
+                    _mm_storeu_si128((__m128i *) out, _mm_xor_si128(r, xor));
+                    out += 16;
+                }
+            }
+        }
+    }
+
+    unpackRowScalar(packed + 16 * blocks, width - 128 * blocks, row + 128 * blocks, flip);
+}
+
+/* 4 packed bytes to 32 pixels, a byte shuffle does the spreading */
+__attribute__((target("avx2")))
+void unpackRowAVX2(const uint8_t *packed, uint32_t width, uint8_t *row, uint8_t flip) {
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bits = _mm256_set1_epi64x((long long) 0x0102040810204080ull);
+    const __m256i xor = _mm256_set1_epi8((char) flip);
+    uint32_t blocks = width / 32;
+
+    for (uint32_t i = 0; i < blocks; ++i) {
+        int32_t word;
+        __builtin_memcpy(&word, packed + 4 * i, sizeof(word));
+
+        __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32(word), spread);
+        __m256i r = _mm256_cmpeq_epi8(_mm256_and_si256(v, bits), bits);
+        _mm256_storeu_si256((__m256i *) (row + 32 * i), _mm256_xor_si256(r, xor));
+    }
+
+    unpackRowScalar(packed + 4 * blocks, width - 32 * blocks, row + 32 * blocks, flip);
+}
+
+#endif
+
+void swapBytes16Scalar(const uint8_t *src, uint8_t *dst, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        uint16_t v;
+        __builtin_memcpy(&v, src + 2 * i, sizeof(v));
+        v = __builtin_bswap16(v);
+        __builtin_memcpy(dst + 2 * i, &v, sizeof(v));
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* 8 samples at a time, each rotated by a byte within its 16 bit lane */
+__attribute__((target("sse2")))
+void swapBytes16SSE2(const uint8_t *src, uint8_t *dst, size_t count) {
+    size_t blocks = count / 8;
+
+    for (size_t i = 0; i < blocks; ++i) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + 16 * i));
+        _mm_storeu_si128((__m128i *) (dst + 16 * i), _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+    }
+
+    swapBytes16Scalar(src + 16 * blocks, dst + 16 * blocks, count - 8 * blocks);
+}
+
+/* 16 samples at a time with a byte shuffle */
+__attribute__((target("avx2")))
+void swapBytes16AVX2(const uint8_t *src, uint8_t *dst, size_t count) {
+    const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                          1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t blocks = count / 16;
+
+    for (size_t i = 0; i < blocks; ++i) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (src + 32 * i));
+        _mm256_storeu_si256((__m256i *) (dst + 32 * i), _mm256_shuffle_epi8(v, swap));
+    }
+
+    swapBytes16Scalar(src + 32 * blocks, dst + 32 * blocks, count - 16 * blocks);
+}
+
+#endif
+
+static void pickKernel(void) {
+    kernel = unpackRowScalar;
+    swapKernel = swapBytes16Scalar;
+    kernelName = "scalar";
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = unpackRowAVX2;
+        swapKernel = swapBytes16AVX2;
+        kernelName = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        kernel = unpackRowSSE2;
+        swapKernel = swapBytes16SSE2;
+        kernelName = "sse2";
+    }
+#endif
+}
+
+void unpackRow(const uint8_t *packed, uint32_t width, uint8_t *row, uint8_t flip) {
+    pthread_once(&once, pickKernel);
+    kernel(packed, width, row, flip);
+}
+
+void swapBytes16(const uint8_t *src, uint8_t *dst, size_t count) {
+    pthread_once(&once, pickKernel);
+    swapKernel(src, dst, count);
+}
+
+const char *unpackKernelName(void) {
+    pthread_once(&once, pickKernel);
+    return kernelName;
+}
+
+void invertBytes(uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; ++i)
+        data[i] = ~data[i];
+}
@@ -0,0 +1,51 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef SYSTEM_HW01_UNPACK_H
+#define SYSTEM_HW01_UNPACK_H
+
+/*
+ * expands a packed 1 bit row, most significant bit first, to one byte per pixel:
+ * a set bit becomes 255 and a clear one 0, then every byte is xored with flip.
+ * the padding bits of the last byte are never written.
+ */
+typedef void (*unpackFn)(const uint8_t *packed, uint32_t width, uint8_t *row, uint8_t flip);
+
+void unpackRowScalar(const uint8_t *packed, uint32_t width, uint8_t *row, uint8_t flip);
+
+#if defined(__x86_64__) || defined(__i386__)
+
+void unpackRowSSE2(const uint8_t *packed, uint32_t width, uint8_t *row, uint8_t flip);
+
+void unpackRowAVX2(const uint8_t *packed, uint32_t width, uint8_t *row, uint8_t flip);
+
+#endif
+
+/* the fastest kernel the running cpu supports, picked on first use */
+void unpackRow(const uint8_t *packed, uint32_t width, uint8_t *row, uint8_t flip);
+
+const char *unpackKernelName(void);
+
+void invertBytes(uint8_t *data, size_t size);
+
+/* copies count 16 bit samples from src to dst with their two bytes exchanged, src may be dst */
+typedef void (*swapFn)(const uint8_t *src, uint8_t *dst, size_t count);
+
+void swapBytes16Scalar(const uint8_t *src, uint8_t *dst, size_t count);
+
+#if defined(__x86_64__) || defined(__i386__)
+
+void swapBytes16SSE2(const uint8_t *src, uint8_t *dst, size_t count);
+
+void swapBytes16AVX2(const uint8_t *src, uint8_t *dst, size_t count);
+
+#endif
+
+/* the fastest swap kernel the running cpu supports, picked with the unpack kernel */
+void swapBytes16(const uint8_t *src, uint8_t *dst, size_t count);
+
+#endif //SYSTEM_HW01_UNPACK_H
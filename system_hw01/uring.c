@@ -0,0 +1,176 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_URING 1
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#ifdef HAVE_URING
+
+static void *mapRing(int fd, size_t size, off_t offset) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+
+    return p == MAP_FAILED ? NULL : p;
+}
+
+bool ringInit(struct ring *ring, unsigned entries) {
+    struct io_uring_params params;
+    uint8_t *sq, *cq;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+
+    if (ring->fd < 0)
+        return true;
+
+    /* the completion queue is twice as long, so it never overflows while at most entries are in flight */
+    ring->entries = params.sq_entries;
+    ring->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    /* newer kernels share one mapping between both rings */
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cqMapSize > ring->sqMapSize)
+            ring->sqMapSize = ring->cqMapSize;
+        ring->cqMapSize = ring->sqMapSize;
+    }
+
+    ring->sqMap = mapRing(ring->fd, ring->sqMapSize, IORING_OFF_SQ_RING);
+    ring->cqMap = params.features & IORING_FEAT_SINGLE_MMAP ? ring->sqMap
+                                                            : mapRing(ring->fd, ring->cqMapSize, IORING_OFF_CQ_RING);
+    ring->sqes = mapRing(ring->fd, ring->sqesSize, IORING_OFF_SQES);
+
+    if (ring->sqMap == NULL || ring->cqMap == NULL || ring->sqes == NULL) {
+        ringFree(ring);
+        return true;
+    }
+
+    sq = ring->sqMap;
+    cq = ring->cqMap;
+    ring->sqHead = (unsigned *) (sq + params.sq_off.head);
+    ring->sqTail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sqMask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned *) (sq + params.sq_off.array);
+    ring->cqHead = (unsigned *) (cq + params.cq_off.head);
+    ring->cqTail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cqMask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = cq + params.cq_off.cqes;
+    return false;
+}
+
+void ringFree(struct ring *ring) {
+    if (ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqMap != NULL && ring->cqMap != ring->sqMap)
+        munmap(ring->cqMap, ring->cqMapSize);
+    if (ring->sqMap != NULL)
+        munmap(ring->sqMap, ring->sqMapSize);
+    if (ring->fd >= 0)
+        close(ring->fd);
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+bool ringRead(struct ring *ring, int fd, void *buffer, uint32_t size, uint64_t offset, uint64_t tag) {
+    unsigned tail, index;
+    struct io_uring_sqe *sqe;
+
+    if (ring->queued + ring->inFlight == ring->entries)
+        return true;
+
+    tail = *ring->sqTail;
+    index = tail & *ring->sqMask;
+    sqe = (struct io_uring_sqe *) ring->sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t) buffer;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = tag;
+    ring->sqArray[index] = index;
+
+    /* the kernel must see the entry before the tail that publishes it */
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++ring->queued;
+    return false;
+}
+
+bool ringSubmit(struct ring *ring) {
+    while (ring->queued != 0) {
+        long n = syscall(__NR_io_uring_enter, ring->fd, ring->queued, 0, 0, NULL, 0);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            return true;
+
+        ring->queued -= n;
+        ring->inFlight += n;
+    }
+
+    return false;
+}
+
+bool ringWait(struct ring *ring, uint64_t *tag, int32_t *result) {
+    unsigned head = *ring->cqHead;
+    struct io_uring_cqe *cqe;
+
+    if (ring->inFlight == 0)
+        return true;
+
+    while (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+        if (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+            return true;
+    }
+
+    cqe = (struct io_uring_cqe *) ring->cqes + (head & *ring->cqMask);
+    *tag = cqe->user_data;
+    *result = cqe->res;
+
+    /* the slot goes back to the kernel only once it has been read */
+    __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+    --ring->inFlight;
+    return false;
+}
+
+#else
+
+bool ringInit(struct ring *ring, unsigned entries) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+    return true;
+}
+
+void ringFree(struct ring *ring) {
+}
+
+bool ringRead(struct ring *ring, int fd, void *buffer, uint32_t size, uint64_t offset, uint64_t tag) {
+    return true;
+}
+
+bool ringSubmit(struct ring *ring) {
+    return true;
+}
+
+bool ringWait(struct ring *ring, uint64_t *tag, int32_t *result) {
+    return true;
+}
+
+#endif
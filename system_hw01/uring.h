@@ -0,0 +1,52 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef SYSTEM_HW01_URING_H
+#define SYSTEM_HW01_URING_H
+
+/*
+ * an io_uring instance set up through the raw system calls, no liburing. reads are queued with
+ * ringRead, handed to the kernel together by ringSubmit and reaped one at a time by ringWait.
+ */
+struct ring {
+    int fd;
+    /* submissions the ring holds, queued or in flight */
+    unsigned entries;
+    unsigned queued;
+    unsigned inFlight;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    void *sqes;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    void *cqes;
+    void *sqMap;
+    size_t sqMapSize;
+    void *cqMap;
+    size_t cqMapSize;
+    size_t sqesSize;
+};
+
+/* true when the kernel has no io_uring or refuses it, the caller then reads with pread */
+bool ringInit(struct ring *ring, unsigned entries);
+
+void ringFree(struct ring *ring);
+
+/* queues a read of size bytes at offset into buffer, tag comes back with its completion. true when full */
+bool ringRead(struct ring *ring, int fd, void *buffer, uint32_t size, uint64_t offset, uint64_t tag);
+
+/* hands every queued read to the kernel */
+bool ringSubmit(struct ring *ring);
+
+/* waits for the next completed read, result is the byte count or a negative errno */
+bool ringWait(struct ring *ring, uint64_t *tag, int32_t *result);
+
+#endif //SYSTEM_HW01_URING_H
@@ -0,0 +1,499 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include <string.h>
+#include "tiff.h"
+#include "ifd.h"
+#include "compress.h"
+#include "writer.h"
+
+/* strips of about this many bytes when no rows per strip are asked for, as libtiff picks them */
+#define STRIP_BYTES 8192
+/* of a stripped image, a tiled one has a tag more */
+#define WRITER_TAGS 12
+
+struct tiffWriter {
+    int fd;
+    uint32_t width;
+    uint32_t height;
+    enum pixelFormat format;
+    uint16_t compression;
+    /* rows of a strip, or of a row of tiles when tileWidth is not 0 */
+    uint32_t rowsPerStrip;
+    uint32_t tileWidth;
+    /* strips or tiles */
+    uint32_t blocks;
+    size_t rowBytes;
+    /* rows taken so far and how many of them wait in strip */
+    uint32_t row;
+    uint32_t held;
+    /* where the next strip goes, right after the space kept for the header and ifd */
+    uint64_t end;
+    /* the end of a file several writers share, used in place of end, see writerOpenShared */
+    atomic_uint_fast64_t *shared;
+    uint32_t *offsets;
+    uint32_t *byteCounts;
+    uint8_t *strip;
+    /* one tile, padded out past the edges of the image */
+    uint8_t *tile;
+    uint8_t *encoded;
+};
+
+static bool pwriteAll(int fd, const void *buffer, size_t size, off_t offset) {
+    size_t total = 0;
+    ssize_t n;
+
+    while (total != size) {
+        n = pwrite(fd, (const uint8_t *) buffer + total, size - total, offset + total);
+
+        if (n <= 0)
+            return true;
+
+        total += n;
+    }
+
+    return false;
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+    v = htole16(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    v = htole32(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static uint8_t *putTag(uint8_t *p, uint16_t id, uint16_t type, uint32_t count, uint32_t value) {
+    put16(p, id);
+    put16(p + 2, type);
+    put32(p + 4, count);
+
+    if (type == WORD && count == 1) {
+        put16(p + 8, value);
+        put16(p + 10, 0);
+    } else {
+        put32(p + 8, value);
+    }
+
+    return p + 12;
+}
+
+static uint32_t tagCount(tiffWriter_t writer, uint32_t subfileType, uint32_t subIfds) {
+    return WRITER_TAGS + (writer->tileWidth != 0) + (subfileType != 0) + (subIfds != 0);
+}
+
+/* ifd, resolutions and the block and SubIFDs tables when they do not fit in their entries */
+static size_t ifdSize(tiffWriter_t writer, uint32_t subfileType, uint32_t subIfds) {
+    return 2 + 12 * tagCount(writer, subfileType, subIfds) + 4 + 16 +
+           (writer->blocks > 1 ? 8 * (size_t) writer->blocks : 0) + (subIfds > 1 ? 4 * (size_t) subIfds : 0);
+}
+
+/* takes size bytes at the end of the file and returns where they start */
+static uint64_t reserve(tiffWriter_t writer, size_t size) {
+    uint64_t at = writer->end;
+
+    /* every ifd must start on a word */
+    if (writer->shared != NULL)
+        return atomic_fetch_add(writer->shared, (size + 1) & ~(size_t) 1);
+
+    writer->end += size;
+    return at;
+}
+
+static tiffWriter_t openWriter(int fd, uint32_t width, uint32_t height, enum pixelFormat format,
+                               const struct tiffWriteOptions *const opts, atomic_uint_fast64_t *end,
+                               struct tiffError *const err) {
+    tiffWriter_t writer;
+    uint16_t compression = opts != NULL && opts->compression != 0 ? opts->compression : NO_COMPRESSION;
+    size_t rowBytes = format == PACKED1 ? (width + 7) / 8 : width;
+    uint32_t rowsPerStrip = opts != NULL ? opts->rowsPerStrip : 0;
+    uint32_t tileWidth = opts != NULL ? opts->tileWidth : 0;
+    uint32_t tileLength = opts != NULL ? opts->tileLength : 0;
+    size_t blockRowBytes;
+
+    if (width == 0 || height == 0) {
+        err->data = width;
+        err->error = OUT_OF_RANGE;
+        return NULL;
+    }
+
+    if (format != PACKED1 && format != GRAY8) {
+        err->data = pixelBits(format);
+        err->error = UNSUPPORTED_SAMPLE_SIZE;
+        return NULL;
+    }
+
+    if (compression != NO_COMPRESSION && compression != PACKBITS) {
+        err->data = compression;
+        err->error = UNSUPPORTED_COMPRESSION;
+        return NULL;
+    }
+
+    /* tiff wants both sides of a tile multiples of 16 */
+    if (tileWidth % 16 != 0 || tileLength % 16 != 0 || (tileWidth == 0) != (tileLength == 0)) {
+        err->data = tileWidth != 0 ? tileWidth : tileLength;
+        err->error = OUT_OF_RANGE;
+        return NULL;
+    }
+
+    if (tileWidth != 0)
+        rowsPerStrip = tileLength;
+
+    if (rowsPerStrip == 0)
+        rowsPerStrip = rowBytes < STRIP_BYTES ? STRIP_BYTES / rowBytes : 1;
+
+    /* tiles are always whole, however small the image */
+    if (rowsPerStrip > height && tileWidth == 0)
+        rowsPerStrip = height;
+
+    writer = calloc(1, sizeof(struct tiffWriter));
+
+    if (writer == NULL) {
+        err->error = MALLOC_ERROR;
+        return NULL;
+    }
+
+    writer->fd = fd;
+    writer->width = width;
+    writer->height = height;
+    writer->format = format;
+    writer->compression = compression;
+    writer->rowsPerStrip = rowsPerStrip;
+    writer->tileWidth = tileWidth;
+    writer->blocks = (height + rowsPerStrip - 1) / rowsPerStrip;
+    writer->rowBytes = rowBytes;
+    writer->shared = end;
+
+    if (tileWidth != 0)
+        writer->blocks *= (width + tileWidth - 1) / tileWidth;
+
+    writer->end = end != NULL ? 0 : 8 + ifdSize(writer, 0, 0);
+    writer->offsets = malloc(sizeof(uint32_t) * writer->blocks);
+    writer->byteCounts = malloc(sizeof(uint32_t) * writer->blocks);
+    writer->strip = malloc(rowBytes * rowsPerStrip);
+    blockRowBytes = rowBytes;
+
+    if (tileWidth != 0) {
+        blockRowBytes = format == PACKED1 ? tileWidth / 8 : tileWidth;
+        writer->tile = malloc(blockRowBytes * tileLength);
+    }
+
+    /* packbits codes every row on its own, a row grows by at most a byte in 128 plus one */
+    if (compression == PACKBITS)
+        writer->encoded = malloc((blockRowBytes + blockRowBytes / 128 + 1) * rowsPerStrip);
+
+    if (writer->offsets == NULL || writer->byteCounts == NULL || writer->strip == NULL ||
+        (tileWidth != 0 && writer->tile == NULL) || (compression == PACKBITS && writer->encoded == NULL)) {
+        writerAbort(writer);
+        err->error = MALLOC_ERROR;
+        return NULL;
+    }
+
+    return writer;
+}
+
+tiffWriter_t const writerOpen(int fd, uint32_t width, uint32_t height, enum pixelFormat format,
+                              const struct tiffWriteOptions *const opts, struct tiffError *const err) {
+    return openWriter(fd, width, height, format, opts, NULL, err);
+}
+
+tiffWriter_t const writerOpenShared(int fd, uint32_t width, uint32_t height, enum pixelFormat format,
+                                    const struct tiffWriteOptions *const opts, atomic_uint_fast64_t *end,
+                                    struct tiffError *const err) {
+    return openWriter(fd, width, height, format, opts, end, err);
+}
+
+/* encodes rows of rowBytes each and writes them as strip or tile j */
+static bool writeBlock(tiffWriter_t writer, uint32_t j, const uint8_t *rows, size_t rowBytes, uint32_t count,
+                       struct tiffError *const err) {
+    const uint8_t *out = rows;
+    size_t size = rowBytes * count;
+    uint64_t at;
+
+    if (writer->compression == PACKBITS) {
+        size = 0;
+
+        for (uint32_t i = 0; i < count; ++i)
+            size += packBitsEncode(rows + i * rowBytes, rowBytes, writer->encoded + size);
+
+        out = writer->encoded;
+    }
+
+    at = reserve(writer, size);
+
+    /* classic tiff offsets are 32 bits */
+    if (at + size > UINT32_MAX) {
+        err->data = j;
+        err->error = WRITE_ERROR;
+        return true;
+    }
+
+    if (pwriteAll(writer->fd, out, size, at)) {
+        err->data = writer->fd;
+        err->error = WRITE_ERROR;
+        return true;
+    }
+
+    writer->offsets[j] = at;
+    writer->byteCounts[j] = size;
+    return false;
+}
+
+/* cuts count rows at rows into a row of tiles, the parts past the right and bottom edges cleared */
+static bool writeTiles(tiffWriter_t writer, const uint8_t *rows, uint32_t count, struct tiffError *const err) {
+    size_t tileBytes = writer->format == PACKED1 ? writer->tileWidth / 8 : writer->tileWidth;
+    uint32_t across = (writer->width + writer->tileWidth - 1) / writer->tileWidth;
+    uint32_t first = writer->row / writer->rowsPerStrip * across;
+
+    for (uint32_t t = 0; t < across; ++t) {
+        size_t left = t * tileBytes;
+        size_t bytes = writer->rowBytes - left < tileBytes ? writer->rowBytes - left : tileBytes;
+
+        for (uint32_t i = 0; i < count; ++i) {
+            memcpy(writer->tile + i * tileBytes, rows + i * writer->rowBytes + left, bytes);
+            memset(writer->tile + i * tileBytes + bytes, 0, tileBytes - bytes);
+        }
+
+        memset(writer->tile + count * tileBytes, 0, (writer->rowsPerStrip - count) * tileBytes);
+
+        if (writeBlock(writer, first + t, writer->tile, tileBytes, writer->rowsPerStrip, err))
+            return true;
+    }
+
+    return false;
+}
+
+/* writes count rows at rows as the next strip or row of tiles */
+static bool writeStrip(tiffWriter_t writer, const uint8_t *rows, uint32_t count, struct tiffError *const err) {
+    if (writer->tileWidth != 0 ? writeTiles(writer, rows, count, err)
+                               : writeBlock(writer, writer->row / writer->rowsPerStrip, rows, writer->rowBytes,
+                                            count, err))
+        return true;
+
+    writer->row += count;
+    return false;
+}
+
+bool writerRows(tiffWriter_t writer, const uint8_t *rows, uint32_t count, struct tiffError *const err) {
+    if (count > writer->height - writer->row - writer->held) {
+        err->data = writer->row + writer->held + count;
+        err->error = OUT_OF_RANGE;
+        return true;
+    }
+
+    while (count != 0) {
+        uint32_t want = writer->row + writer->rowsPerStrip > writer->height ? writer->height - writer->row
+                                                                           : writer->rowsPerStrip;
+        uint32_t take = want - writer->held < count ? want - writer->held : count;
+
+        /* whole strips go out from the caller's rows, only partial ones are gathered in strip */
+        if (writer->held == 0 && take == want) {
+            if (writeStrip(writer, rows, want, err))
+                return true;
+        } else {
+            memcpy(writer->strip + writer->held * writer->rowBytes, rows, take * writer->rowBytes);
+            writer->held += take;
+
+            if (writer->held == want) {
+                writer->held = 0;
+
+                if (writeStrip(writer, writer->strip, want, err))
+                    return true;
+            }
+        }
+
+        rows += take * writer->rowBytes;
+        count -= take;
+    }
+
+    return false;
+}
+
+/* the ifd at offset at of the file, with the resolutions and the tables right after it */
+static void putIfd(tiffWriter_t writer, uint8_t *meta, uint32_t at, uint32_t subfileType, const uint32_t *subIfds,
+                   uint32_t count) {
+    uint16_t tags = tagCount(writer, subfileType, count);
+    /* from the start of the ifd, the tags point at them from the start of the file */
+    uint32_t resolutions = 2 + 12 * tags + 4;
+    uint32_t tables = resolutions + 16;
+    uint32_t subTable = tables + (writer->blocks > 1 ? 8 * writer->blocks : 0);
+    bool packed = writer->format == PACKED1;
+    bool single = writer->blocks == 1;
+    bool tiled = writer->tileWidth != 0;
+    uint8_t *tag;
+
+    put16(meta, tags);
+
+    /* packed rows keep a set bit black, expanded ones 0 black, so neither is ever inverted */
+    tag = meta + 2;
+    if (subfileType != 0)
+        tag = putTag(tag, NEW_SUBFILE_TYPE, DWORD, 1, subfileType);
+    tag = putTag(tag, IMAGE_WIDTH, DWORD, 1, writer->width);
+    tag = putTag(tag, IMAGE_LENGTH, DWORD, 1, writer->height);
+    tag = putTag(tag, BITS_PER_SAMPLE, WORD, 1, packed ? 1 : 8);
+    tag = putTag(tag, COMPRESSION, WORD, 1, writer->compression);
+    tag = putTag(tag, PHOTOMETRIC_INTERPRETATION, WORD, 1, packed ? WHITE_IS_ZERO : BLACK_IS_ZERO);
+    if (!tiled)
+        tag = putTag(tag, STRIP_OFFSETS, DWORD, writer->blocks, single ? writer->offsets[0] : at + tables);
+    tag = putTag(tag, SAMPLES_PER_PIXEL, WORD, 1, 1);
+    if (!tiled) {
+        tag = putTag(tag, ROWS_PER_STRIP, DWORD, 1, writer->rowsPerStrip);
+        tag = putTag(tag, STRIP_BYTE_COUNTS, DWORD, writer->blocks,
+                     single ? writer->byteCounts[0] : at + tables + 4 * writer->blocks);
+    }
+    tag = putTag(tag, X_RESOLUTION, RATIONAL, 1, at + resolutions);
+    tag = putTag(tag, Y_RESOLUTION, RATIONAL, 1, at + resolutions + 8);
+    tag = putTag(tag, RESOLUTION_UNIT, WORD, 1, 2);
+    if (tiled) {
+        tag = putTag(tag, TILE_WIDTH, DWORD, 1, writer->tileWidth);
+        tag = putTag(tag, TILE_LENGTH, DWORD, 1, writer->rowsPerStrip);
+        tag = putTag(tag, TILE_OFFSETS, DWORD, writer->blocks, single ? writer->offsets[0] : at + tables);
+        tag = putTag(tag, TILE_BYTE_COUNTS, DWORD, writer->blocks,
+                     single ? writer->byteCounts[0] : at + tables + 4 * writer->blocks);
+    }
+    if (count != 0)
+        tag = putTag(tag, SUB_IFDS, IFD, count, count == 1 ? subIfds[0] : at + subTable);
+    put32(tag, 0);
+
+    put32(meta + resolutions, 72);
+    put32(meta + resolutions + 4, 1);
+    put32(meta + resolutions + 8, 72);
+    put32(meta + resolutions + 12, 1);
+
+    for (uint32_t j = 0; j < writer->blocks && !single; ++j) {
+        put32(meta + tables + 4 * j, writer->offsets[j]);
+        put32(meta + tables + 4 * (writer->blocks + j), writer->byteCounts[j]);
+    }
+
+    for (uint32_t i = 0; i < count && count > 1; ++i)
+        put32(meta + subTable + 4 * i, subIfds[i]);
+}
+
+static bool checkFull(tiffWriter_t writer, struct tiffError *const err) {
+    if (writer->row == writer->height)
+        return false;
+
+    err->data = writer->row;
+    err->error = OUT_OF_RANGE;
+    writerAbort(writer);
+    return true;
+}
+
+bool writerClose(tiffWriter_t writer, struct tiffError *const err) {
+    size_t size = 8 + ifdSize(writer, 0, 0);
+    uint8_t *meta __attribute__((__cleanup__(clean8))) = NULL;
+    uint32_t ifd = 8;
+
+    if (checkFull(writer, err))
+        return true;
+
+    meta = calloc(size, 1);
+
+    if (meta == NULL) {
+        err->error = MALLOC_ERROR;
+        writerAbort(writer);
+        return true;
+    }
+
+    put16(meta, II);
+    put16(meta + 2, 42);
+    put32(meta + 4, ifd);
+    putIfd(writer, meta + ifd, ifd, 0, NULL, 0);
+
+    /* the space for all of this was left at the start of the file when the writer was opened */
+    if (pwriteAll(writer->fd, meta, size, 0)) {
+        err->data = writer->fd;
+        err->error = WRITE_ERROR;
+        writerAbort(writer);
+        return true;
+    }
+
+    writerAbort(writer);
+    return false;
+}
+
+bool writerFinish(tiffWriter_t writer, uint32_t subfileType, const uint32_t *subIfds, uint32_t count,
+                  uint32_t *offset, struct tiffError *const err) {
+    size_t size = ifdSize(writer, subfileType, count);
+    uint8_t *meta __attribute__((__cleanup__(clean8))) = NULL;
+    uint64_t at;
+
+    if (checkFull(writer, err))
+        return true;
+
+    meta = calloc(size, 1);
+
+    if (meta == NULL) {
+        err->error = MALLOC_ERROR;
+        writerAbort(writer);
+        return true;
+    }
+
+    at = reserve(writer, size);
+
+    if (at + size > UINT32_MAX) {
+        err->data = writer->blocks;
+        err->error = WRITE_ERROR;
+        writerAbort(writer);
+        return true;
+    }
+
+    putIfd(writer, meta, at, subfileType, subIfds, count);
+
+    if (pwriteAll(writer->fd, meta, size, at)) {
+        err->data = writer->fd;
+        err->error = WRITE_ERROR;
+        writerAbort(writer);
+        return true;
+    }
+
+    *offset = at;
+    writerAbort(writer);
+    return false;
+}
+
+bool writerHeader(int fd, uint32_t offset, struct tiffError *const err) {
+    uint8_t header[8];
+
+    put16(header, II);
+    put16(header + 2, 42);
+    put32(header + 4, offset);
+
+    if (pwriteAll(fd, header, sizeof(header), 0)) {
+        err->data = fd;
+        err->error = WRITE_ERROR;
+        return true;
+    }
+
+    return false;
+}
+
+void writerAbort(tiffWriter_t writer) {
+    if (writer == NULL)
+        return;
+
+    free(writer->offsets);
+    free(writer->byteCounts);
+    free(writer->strip);
+    free(writer->tile);
+    free(writer->encoded);
+    free(writer);
+}
+
+bool writeFD(int fd, tiff_t tiff, const struct tiffWriteOptions *const opts, struct tiffError *const err) {
+    tiffWriter_t writer = writerOpen(fd, tiff->width, tiff->height, tiff->format, opts, err);
+
+    if (writer == NULL)
+        return true;
+
+    /* rows of an image in memory are contiguous, so every full strip is written without a copy */
+    if (writerRows(writer, tiff->data, tiff->height, err)) {
+        writerAbort(writer);
+        return true;
+    }
+
+    return writerClose(writer, err);
+}
@@ -0,0 +1,30 @@
+//
+// Created by siyahas on 16.03.2018.
+//
+
+#include "tiff.h"
+
+#ifndef SYSTEM_HW01_WRITER_H
+#define SYSTEM_HW01_WRITER_H
+
+/*
+ * like writerOpen, for one of several images written to the same file at once. strips, tiles and the
+ * ifd are all put at end, which the writers of the file advance together and keep even. nothing is
+ * kept at the start of the file, see writerHeader.
+ */
+tiffWriter_t const writerOpenShared(int fd, uint32_t width, uint32_t height, enum pixelFormat format,
+                                    const struct tiffWriteOptions *const opts, atomic_uint_fast64_t *end,
+                                    struct tiffError *const error) __attribute__((warn_unused_result));
+
+/*
+ * writes the ifd of a shared writer once every row has been given, with a NewSubfileType tag when
+ * subfileType is not 0 and the offsets of count SubIFDs when there are any. its own offset goes to
+ * *offset. the writer is freed, even on failure.
+ */
+bool writerFinish(tiffWriter_t writer, uint32_t subfileType, const uint32_t *subIfds, uint32_t count,
+                  uint32_t *offset, struct tiffError *const error);
+
+/* the classic little endian header, with the first ifd at offset */
+bool writerHeader(int fd, uint32_t offset, struct tiffError *const error);
+
+#endif //SYSTEM_HW01_WRITER_H